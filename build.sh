@@ -15,9 +15,9 @@ do
 	if [ $s -nt $o ]
 	then
 		echo Building $s
-		gcc -c $s -o $o -Iinclude
+		gcc -c $s -o $o -Iinclude -pthread
 	fi
 done
 
 echo Building $OBJECTS
-gcc -g $OBJECTS -o build/out -lncurses
+gcc -g $OBJECTS -o build/out -lncurses -lcrypto -pthread
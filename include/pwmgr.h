@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <sys/types.h>
 #include <ncurses.h>
 
 #define ARRLEN(a) (sizeof(a)/(sizeof*(a)))
@@ -24,11 +25,26 @@
 
 typedef int8_t I8;
 typedef uint8_t U8;
+typedef uint16_t U16;
 typedef int32_t I32;
 typedef uint32_t U32;
 typedef int64_t I64;
 typedef uint64_t U64;
 
+// FNV-1a
+static inline U32
+hashname(const char *name, U32 nName)
+{
+	U32 h = 2166136261;
+
+	while(nName--)
+	{
+		h ^= (U8) *(name++);
+		h *= 16777619;
+	}
+	return h;
+}
+
 #define MAX_NAME 64
 
 #define ATTR_DEFAULT (COLOR_PAIR(0))
@@ -49,27 +65,441 @@ extern int iPage;
 
 void setoutpage(int page);
 
+// a field of a record, raw values are written as they are (numbers and booleans)
+struct field {
+	const char *name;
+	const char *value;
+	U32 nValue;
+	bool raw;
+};
+
+// output sinks (defined in src/out.c), commands write through the active sink
+// which is the output pad or stdout in batch mode, that is when the commands come
+// from the command line, a script or anything but a terminal
+struct sink {
+	void (*attr)(int attr);
+	void (*write)(const char *str, size_t nStr);
+	// reads the answer to a question, returns the first character of it
+	int (*ask)(void);
+	// reads a line without showing it, returns its length or ERR when there is no more input
+	int (*secret)(char *buf, U32 capBuf);
+	// writes a result as a structured record, the sinks for people don't have this
+	void (*record)(const char *type, const struct field *fields, U32 nFields);
+	// ends the output before the program exits
+	void (*end)(void);
+};
+
+extern const struct sink cursesSink;
+extern const struct sink plainSink;
+// NDJSON, every line of text becomes a message object and results become records
+extern const struct sink jsonSink;
+// only lets fatal messages through (to stderr)
+extern const struct sink setupSink;
+extern const struct sink *sink;
+
+void outattr(int attr);
+void outwrite(const char *str, size_t nStr);
+void outstr(const char *str);
+void outprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int outask(void);
+int outsecret(char *buf, U32 capBuf);
+// returns false when the sink has no records, the caller writes the result as text then
+bool outrecord(const char *type, const struct field *fields, U32 nFields);
+void outend(void);
+
+// variables (defined in src/var.c), built-in variables are typed and store
+// their number in a global, the setter may reject a value or apply it
 struct variable {
-	char *name;
+	const char *name;
+	U32 nName;
+	U32 hash;
 	char *value;
+	U32 nValue, capValue;
+	U32 *number;
+	int (*set)(struct variable *var, U32 value);
 };
 
 extern U32 area;
 extern U32 inputHeight;
 
-void addvariable(const struct variable *var);
+struct variable *addvariable(const char *name, U32 nName, const char *value, U32 nValue);
 struct variable *getvariable(const char *name, U32 nName);
+// EINVAL when a built-in variable gets a value that is no number
+int setvariable(struct variable *var, const char *value, U32 nValue);
+const char *variablevalue(struct variable *var, U32 *nValue);
+
+// single file vault (defined in src/vault.c);
+// fdVault is ERR when accounts are stored as files inside the real path
+extern int fdVault;
+
+int vault_open(const char *path);
+void vault_close(void);
+// reads the vault again after another process changed it, the old one stays open when that fails
+int vault_reload(void);
+// writes the live records into a new vault that replaces the current one
+int vault_compact(void);
+int vault_get(const char *name, U32 nName, char **data, U32 *nData);
+int vault_find(const char *name, U32 nName, U64 *data, U32 *nData);
+// put and remove zero the record they replace or unlink
+int vault_put(const char *name, U32 nName, const char *data, U32 nData);
+int vault_insert(const char *name, U32 nName, const char *data, U32 nData);
+int vault_remove(const char *name, U32 nName);
+int vault_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg);
+int vault_convert(const char *dirPath, const char *path);
+
+// location of the main directory and a buffer for paths inside of it (defined in src/main.c)
+extern const char *realPath;
+extern char path[1024];
+
+void appendrealpath(const char *app, U32 nApp);
+
+// account data is a series of name/value pairs
+// [name][0][value][0]...
+// struct account is a read only view of that data mapped straight from the account file
+// or the vault (defined in src/account.c)
+struct account {
+	const char *data;
+	size_t nData;
+	size_t pos;
+	void *map;
+	size_t nMap;
+	// decrypted data in secure memory, wiped when the account is closed
+	char *plain;
+};
+
+struct record {
+	const char *name;
+	U32 nName;
+	const char *value;
+	size_t nValue;
+};
+
+struct iovec;
+
+int account_open(const char *name, U32 nName, struct account *acc);
+void account_close(struct account *acc);
+// returns 1 when a record was read, 0 at the end of the data and ERR when the data is corrupt
+int account_next(struct account *acc, struct record *rec);
+// atomically replaces the data of an account
+int account_write(const char *name, U32 nName, const struct iovec *iov, int nIov);
+int account_append(const char *name, U32 nName, const struct iovec *iov, int nIov);
+// errno is EEXIST when the account already exists
+int account_create(const char *name, U32 nName, const char *data, size_t nData);
+int account_delete(const char *name, U32 nName);
+// calls proc for every account until it returns non zero
+int account_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg);
+// read and replace the stored bytes of an account as they are, without
+// decrypting or updating any index; these can be called from multiple threads
+int account_readraw(const char *name, U32 nName, char **data, size_t *nData);
+int account_rewrite(const char *name, U32 nName, const char *data, size_t nData);
+
+// locked memory for secrets (defined in src/secure.c), allocations are only
+// valid until the end of the current command when all of it is wiped
+void *secure_alloc(size_t n);
+// wipes the allocation and gives the memory back when it was the latest one
+void secure_free(void *ptr, size_t n);
+void secure_reset(void);
+// locked memory that stays for the whole session
+void *secure_keep(size_t n);
+
+// authenticated encryption of the account data (defined in src/crypt.c);
+// the key is derived from a passphrase once per session and kept in locked
+// memory, cryptActive is set while there is a key and every account that
+// is written is encrypted; data that was never encrypted can still be read
+extern bool cryptActive;
+
+// reads the parameters of the key file, errno is ENOENT when the accounts are not encrypted
+int crypt_open(const char *path);
+// derives the key after crypt_open, errno is EACCES when the passphrase is wrong
+int crypt_unlock(const char *path, const char *pass, size_t nPass);
+// creates a new key file for the passphrase and unlocks it
+int crypt_create(const char *path, const char *pass, size_t nPass);
+void crypt_close(void);
+bool crypt_isencrypted(const char *data, size_t nData);
+// the returned blob is allocated and the returned plaintext is secure memory,
+// errno is EBADMSG when the data was changed or belongs to another account
+// and ENOKEY when there is no key
+int crypt_encrypt(const char *name, U32 nName, const struct iovec *iov, int nIov,
+		char **blob, size_t *nBlob);
+int crypt_decrypt(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **data, size_t *nData);
+// like crypt_decrypt but it can be called from any thread, the plaintext is
+// allocated and the caller wipes it before freeing it
+int crypt_decryptcopy(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **data, size_t *nData);
+// key rotation: begin derives the next key and creates its key file or, when the
+// file is already there from an interrupted rotation, checks the passphrase against it
+int crypt_rekeybegin(const char *nextPath, const char *pass, size_t nPass, bool *resumed);
+// seals a blob for the next key, returns 1 when it already is
+int crypt_reseal(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **newBlob, size_t *nNewBlob);
+// moves the next key file in place of the current one and switches to the next key
+int crypt_rekeyend(const char *path, const char *nextPath);
+void crypt_rekeyabort(void);
+// frees the cipher contexts of the calling thread
+void crypt_threadexit(void);
+
+// sorted index of the account names (defined in src/names.c), it is loaded on
+// first use and account_create and account_delete keep it up to date
+int names_load(void);
+void names_added(const char *name, U32 nName);
+void names_removed(const char *name, U32 nName);
+// drops the index so it's loaded again on the next use
+void names_invalidate(void);
+// i must be below the count of names_prefix or an index names_find returned
+const char *names_get(U32 i, U32 *nName);
+// like account_foreach but in sorted order
+int names_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg);
+// returns the number of names starting with the prefix, they start at *first
+U32 names_prefix(const char *prefix, U32 nPrefix, U32 *first);
+// stores up to maxFound names that fuzzily match the pattern into found,
+// the best match comes first
+U32 names_find(const char *pattern, U32 nPattern, U32 *found, U32 maxFound);
+
+// in memory hash index of the properties of an account (defined in src/property.c),
+// off and len locate the whole name/value pair inside the account data
+struct property {
+	U32 hash;
+	U32 nName;
+	char *name;
+	size_t off, len;
+};
+
+struct propstamp {
+	dev_t dev;
+	ino_t ino;
+	U64 size;
+	U64 off;
+	struct timespec mtime;
+};
+
+struct propindex {
+	struct propstamp stamp;
+	// size of the account data, which is not the stored size when it's encrypted
+	size_t nData;
+	struct property *properties;
+	U32 nProperties, capProperties;
+	U32 nAccName;
+	char accName[];
+};
+
+// returns the cached index of an account or builds it when the account changed since,
+// errno is EILSEQ when the account is corrupt
+struct propindex *property_index(const char *accName, U32 nAccName);
+struct property *property_find(struct propindex *idx, const char *name, U32 nName);
+// these keep an index in sync with changes made through account_append and account_write
+void property_added(struct propindex *idx, const char *name, U32 nName, size_t len);
+void property_removed(struct propindex *idx, struct property *prop);
+void property_invalidate(const char *accName, U32 nAccName);
+// errno is EEXIST when the property already exists
+int property_add(const char *accName, U32 nAccName, const char *name, U32 nName,
+		const char *value, size_t nValue);
+// errno is ENOENT when the property doesn't exist and ESTALE when the account was changed
+// while reading it; the removed value is returned in secure memory when oldValue is not NULL
+int property_remove(const char *accName, U32 nAccName, const char *name, U32 nName,
+		char **oldValue, size_t *nOldValue);
+
+// full text index of the account properties (defined in src/search.c), an on disk
+// log of the property changes that is loaded into memory by the first search;
+// names and values are split into lowercase terms, the values of secret
+// properties are left out; while the accounts are encrypted all values are
+// and the index is only kept in memory
+int search_open(const char *path);
+void search_close(void);
+// drops the index so the next search builds it from the accounts again
+void search_invalidate(void);
+bool search_secret(const char *name, U32 nName);
+// these keep the index in sync with the accounts
+void search_added(const char *accName, U32 nAccName, const char *name, U32 nName,
+		const char *value, size_t nValue);
+void search_removed(const char *accName, U32 nAccName, const char *name, U32 nName);
+void search_accountadded(const char *accName, U32 nAccName, const char *data, size_t nData);
+void search_accountremoved(const char *accName, U32 nAccName);
+// calls proc for every property containing all terms of the query until it returns non zero,
+// errno is EINVAL when the query has no terms
+int search_query(const char *query, size_t nQuery,
+		int (*proc)(const char *accName, U32 nAccName, const char *name, U32 nName, void *arg),
+		void *arg);
+
+// bulk import of CSV or JSON files (defined in src/import.c)
+struct import {
+	U32 nAccounts, nProperties;
+	// accounts that already exist are skipped
+	U32 nSkipped;
+	// where the file couldn't be read
+	size_t errOff;
+	U32 errLine;
+	// the account that couldn't be created
+	char errAccount[MAX_NAME];
+	U32 nErrAccount;
+};
+
+// creates the accounts of the file, each with a single write, and begins an
+// import entry in the backup that the caller commits when accounts were created
+int import_file(const char *path, struct import *result);
+// the data of an import entry
+U32 import_count(const char *data, size_t nData);
+int import_undo(const char *data, size_t nData);
+int import_redo(const char *data, size_t nData);
+
+// export of all accounts (defined in src/export.c), CSV and JSON are written
+// in the shapes the import reads; the archive layout is
+// [magic][accounts...][0]
+// where every account is [length][name][length][data], the data is
+// encrypted with the current key when the accounts are encrypted
+#define EXPORT_MAGIC "PWARCHV1"
+
+enum {
+	EXPORT_CSV,
+	EXPORT_JSON,
+	EXPORT_ARCHIVE,
+};
+
+struct export {
+	U32 nAccounts, nProperties;
+	// accounts without properties that the format can't hold
+	U32 nLeftOut;
+	// the account that couldn't be read
+	char errAccount[MAX_NAME];
+	U32 nErrAccount;
+};
+
+// streams the accounts one at a time into a new file that replaces the one at path
+int export_file(const char *path, int format, struct export *result);
+
+// integrity check of the accounts (defined in src/check.c), err is set when
+// the records stop being valid at off, nData is the size of the data which
+// is the decrypted size when it's encrypted
+struct damage {
+	size_t off, nData;
+	int err;
+	bool encrypted;
+	bool repaired;
+};
+
+// returns 1 when the account is damaged and ERR when it can't be read,
+// repair cuts the data off after the last valid record;
+// this can be called from multiple threads
+int check_account(const char *name, U32 nName, bool repair, struct damage *d);
+
+// watcher of the account directory (defined in src/watch.c), changes other
+// processes make to the accounts are applied to the caches before every command
+int watch_open(const char *dirPath);
+void watch_close(void);
+// reads the changes that happened since the last call
+void watch_update(void);
+// notes a change this process made so it's not applied again,
+// this can be called from multiple threads
+void watch_wrote(const char *name, U32 nName);
+
+U32 crc32c(U32 crc, const void *data, size_t nData);
+
+// backup journal (defined in src/journal.c)
+// an entry is built with journal_begin and journal_field and written with a single write by journal_commit
+extern int fdBackup;
+extern U32 syncEntries;
+extern U32 syncInterval;
+extern U32 compactEntries;
+
+// opens the backup file, a backup of the old format is rewritten in the current one
+int journal_open(const char *path);
+void journal_begin(U8 id);
+void journal_field(const void *data, size_t nData);
+// adds to the last field so a large field can be written in pieces
+void journal_append(const void *data, size_t nData);
+int journal_commit(void);
+int journal_sync(void);
+// syncs the backup when the sync interval has passed,
+// returns the milliseconds until the next sync is due or -1
+int journal_idle(void);
+
+// the backup index allows to step backwards through the entries for undo and redo,
+// entries from journal_applied() on were undone and get dropped by the next commit
+U64 journal_entries(void);
+U64 journal_applied(void);
+int journal_setapplied(U64 n);
+// number of entries up to and including the last checkpoint, they can not be undone
+U64 journal_checkpoint(void);
+// replaces the backup with a snapshot of all accounts followed by a checkpoint
+// and the entries that were undone; while the accounts are encrypted every
+// entry is sealed afterwards and the old backup is overwritten with zeroes
+int journal_compact(void);
+// seals every sealed entry for the next key of a key rotation
+int journal_reseal(void);
+
+// result of journal_check, only the first corrupt spans are kept
+struct journal_check {
+	U64 nEntries;
+	U32 nSpans;
+	struct {
+		size_t off, size;
+	} spans[8];
+	// bytes cut off the end of the backup
+	size_t nCut;
+};
+
+// reads every entry of the backup and notes the spans that are corrupt,
+// repair cuts off a corrupt end (a write that didn't finish), spans between
+// valid entries are skipped by every reader and stay
+int journal_check(bool repair, struct journal_check *check);
+
+#define JOURNAL_MAX_FIELDS 4
+
+// read only view of the backup file
+struct journal {
+	const char *data;
+	size_t nData;
+	size_t pos;
+	bool legacy;
+	void *map;
+	// the fields of sealed entries are not decrypted, the blob is the only field
+	bool raw;
+	// decrypted fields of the last sealed entry
+	char *plain;
+	size_t nPlain;
+};
+
+struct journal_entry {
+	size_t off, size;
+	U8 id;
+	// the fields were encrypted while the accounts were
+	bool sealed;
+	time_t time;
+	U32 nFields;
+	struct {
+		const char *data;
+		U32 nData;
+	} fields[JOURNAL_MAX_FIELDS];
+};
+
+int journal_map(struct journal *j);
+void journal_unmap(struct journal *j);
+// returns 1 when an entry was read, 0 at the end and ERR when the entry at j->pos is corrupt
+// or can't be decrypted
+int journal_next(struct journal *j, struct journal_entry *e);
+// moves the reader to the next valid entry after a corrupt one, returns 0 if there is none
+int journal_recover(struct journal *j);
+// reads entry i through the index, the fields stay valid until the next call
+int journal_read(U64 i, struct journal_entry *e);
 
 // backup entries
 // [id][time][additional information]
 // addition information can be:
 // [account]
-// [property][account]
+// [account][data] (removed account)
+// [property][account][value]
+// [property][account][old value] (removed property, older backups lack the value)
+// [account][data] (snapshot)
+// [number of accounts] (checkpoint, ends a snapshot)
+// [accounts] (import, every account is [length][name][length][data])
 enum {
 	BACKUP_ENTRY_ADDACCOUNT,
 	BACKUP_ENTRY_REMOVEACCOUNT,
 	BACKUP_ENTRY_ADDPROPERTY,
 	BACKUP_ENTRY_REMOVEPROPERTY,
+	BACKUP_ENTRY_SNAPSHOT,
+	BACKUP_ENTRY_CHECKPOINT,
+	BACKUP_ENTRY_IMPORT,
 };
 
 struct value {
@@ -96,6 +526,8 @@ enum {
 	ZMAX,
 	// literals
 	TWORD, TSTRING, TNUMBER,
+	// $name, replaced by the value of the variable when it is read
+	TVARIABLE,
 	// special characters
 	TCOLON, TDOT, TCOMMA,
 	TPERCENT, TEXCLAM, TQUESTION, THASH, TAT,
@@ -109,12 +541,14 @@ typedef struct {
 
 #define MAX_INPUT 0x1000
 
+// keys for the start and end of a bracketed paste
+#define KEY_PASTE_BEGIN (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+
 struct input {
 	WINDOW *win;
 	char *buf;
 	U32 nBuf;
-	U32 nextHistory;
-	char history[0x8000];
 	TOKEN *tokens;
 	U32 nTokens, capTokens;
 	U32 iToken;
@@ -122,22 +556,37 @@ struct input {
 };
 
 int getinput(struct input *input, bool isUtf8);
+
+// command history (defined in src/history.c), a memory mapped ring of the
+// latest commands that is written through to the history file;
+// entries are numbered, [history_first(), history_end()) are available
+int history_open(const char *path);
+void history_close(void);
+U64 history_first(void);
+U64 history_end(void);
+// copies entry i into buf which must hold MAX_INPUT bytes, returns its length
+U32 history_get(U64 i, char *buf);
+void history_add(const char *entry, U32 nEntry);
+// finds the latest entry before *i that contains the pattern and stores it in *i
+int history_search(const char *pattern, U32 nPattern, U64 *i);
+
 int tokenize(struct input *input);
+// tokenizes the input again after it changed at *from and onwards,
+// *from is moved back to where lexing resumed
+int retokenize(struct input *input, U32 *from);
 bool hasnexttoken(struct input *input);
 TOKEN *peektoken(struct input *input, struct value *value);
 TOKEN *nexttoken(struct input *input, struct value *value);
 U32 gettokenlen(struct input *input, U32 token);
 
-static const struct {
-	const char *name;
+// token a branch consumes right after its name, a token of 0 accepts any token
+struct dependency {
 	const char *description;
-	U32 token;	
-} dependencies[] = {
-	{ "account", "name", TWORD },
-	{ "property", "name", TWORD },
-	{ "value", "string|number", 0 },
-	{ "set", "name", TWORD },
+	U32 token;
+	// the token is the name of an existing account and is completed from the account names
+	bool account;
 };
+
 #define IS_EXEC_BRANCH(branch) (!(branch)->nSubnodes || (I32) (branch)->nSubnodes == -1)
 struct branch {
 	const char *name;
@@ -148,11 +597,19 @@ struct branch {
 		void (*proc)(const struct branch *branch, struct value *values);
 		void (*special)(const struct branch *branch, struct input *input);
 	};
+	const struct dependency *dependency;
+	// perfect hash of the subnode names, slots hold the subnode index + 1
+	// (built at startup by src/branch.c)
+	U32 seed, mask;
+	U8 *slots;
 };
 
 extern const struct branch *const root; // defined in src/branch.c
 
 void printoptions(const struct branch *branch);
 const struct branch *nextbranch(const struct branch *branch, struct input *input);
+// follows the first nTokens tokens without printing errors, the next token is
+// a subnode of the returned branch or its value when *isValue is set
+const struct branch *completebranch(struct input *input, U32 nTokens, bool *isValue);
 
 #endif
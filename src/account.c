@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include "pwmgr.h"
+
+// reads of the vault only use pread so account_readraw can run on any number of
+// threads at once, account_rewrite appends and relinks records and runs alone;
+// the callers decrypt and encrypt outside of the lock
+static pthread_rwlock_t vaultLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// maps the region [off, off + n) of a file, the mapping has to start on a page boundary
+static int
+maprange(int fd, U64 off, size_t n, struct account *acc)
+{
+	const U64 page = sysconf(_SC_PAGESIZE);
+	const U64 base = off & ~(page - 1);
+	void *map;
+
+	acc->pos = 0;
+	acc->nData = n;
+	if(!n)
+	{
+		acc->map = NULL;
+		acc->nMap = 0;
+		acc->data = "";
+		return OK;
+	}
+	map = mmap(NULL, n + off - base, PROT_READ, MAP_PRIVATE, fd, base);
+	if(map == MAP_FAILED)
+		return ERR;
+	madvise(map, n + off - base, MADV_SEQUENTIAL);
+	acc->map = map;
+	acc->nMap = n + off - base;
+	acc->data = (const char*) map + (off - base);
+	return OK;
+}
+
+// encrypted data is replaced by its plaintext, the mapping is not needed after that
+static int
+decrypt(const char *name, U32 nName, struct account *acc)
+{
+	char *data;
+	size_t nData;
+	int r;
+
+	acc->plain = NULL;
+	if(!crypt_isencrypted(acc->data, acc->nData))
+		return OK;
+	r = crypt_decrypt(name, nName, acc->data, acc->nData, &data, &nData);
+	account_close(acc);
+	if(r)
+		return ERR;
+	acc->data = acc->plain = data;
+	acc->nData = nData;
+	return OK;
+}
+
+int
+account_open(const char *name, U32 nName, struct account *acc)
+{
+	int fd;
+	struct stat st;
+	int r;
+
+	acc->plain = NULL;
+	if(fdVault != ERR)
+	{
+		U64 off;
+		U32 nData;
+
+		if(vault_find(name, nName, &off, &nData) ||
+				maprange(fdVault, off, nData, acc))
+			return ERR;
+		return decrypt(name, nName, acc);
+	}
+	appendrealpath(name, nName);
+	fd = open(path, O_RDONLY);
+	if(fd == ERR)
+		return ERR;
+	if(fstat(fd, &st))
+	{
+		close(fd);
+		return ERR;
+	}
+	// the mapping stays valid after the file is closed or replaced
+	r = maprange(fd, 0, st.st_size, acc);
+	close(fd);
+	return r ? ERR : decrypt(name, nName, acc);
+}
+
+void
+account_close(struct account *acc)
+{
+	if(acc->map)
+		munmap(acc->map, acc->nMap);
+	acc->map = NULL;
+	secure_free(acc->plain, MAX(acc->nData, 1));
+	acc->plain = NULL;
+}
+
+int
+account_next(struct account *acc, struct record *rec)
+{
+	const char *ptr, *end, *nul;
+
+	ptr = acc->data + acc->pos;
+	end = acc->data + acc->nData;
+	if(ptr == end)
+		return 0;
+	nul = memchr(ptr, 0, end - ptr);
+	if(!nul)
+		goto corrupt;
+	rec->name = ptr;
+	rec->nName = nul - ptr;
+	ptr = nul + 1;
+	nul = memchr(ptr, 0, end - ptr);
+	if(!nul)
+		goto corrupt;
+	rec->value = ptr;
+	rec->nValue = nul - ptr;
+	acc->pos = nul + 1 - acc->data;
+	return 1;
+corrupt:
+	errno = EILSEQ;
+	return ERR;
+}
+
+static int
+writeraw(const char *name, U32 nName, const struct iovec *iov, int nIov)
+{
+	int fd;
+	char tmpPath[sizeof(path)];
+	ssize_t n = 0;
+
+	if(fdVault != ERR)
+	{
+		char *data, *ptr;
+		int r;
+
+		for(int i = 0; i < nIov; i++)
+			n += iov[i].iov_len;
+		if(n > UINT32_MAX)
+		{
+			errno = EFBIG;
+			return ERR;
+		}
+		data = ptr = malloc(MAX(n, 1));
+		if(!data)
+			return ERR;
+		for(int i = 0; i < nIov; i++)
+			ptr = mempcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+		r = vault_put(name, nName, data, n);
+		free(data);
+		return r;
+	}
+	appendrealpath(".tmp", 4);
+	strcpy(tmpPath, path);
+	fd = open(tmpPath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	for(int i = 0; i < nIov; i++)
+		n += iov[i].iov_len;
+	if(writev(fd, iov, nIov) != n)
+	{
+		close(fd);
+		remove(tmpPath);
+		return ERR;
+	}
+	close(fd);
+	appendrealpath(name, nName);
+	if(renameat2(AT_FDCWD, tmpPath, AT_FDCWD, path, RENAME_EXCHANGE))
+	{
+		remove(tmpPath);
+		return ERR;
+	}
+	remove(tmpPath);
+	return OK;
+}
+
+int
+account_write(const char *name, U32 nName, const struct iovec *iov, int nIov)
+{
+	char *blob;
+	size_t nBlob;
+	int r;
+
+	if(!cryptActive)
+		r = writeraw(name, nName, iov, nIov);
+	else
+	{
+		if(crypt_encrypt(name, nName, iov, nIov, &blob, &nBlob))
+			return ERR;
+		r = writeraw(name, nName, &(struct iovec) { blob, nBlob }, 1);
+		free(blob);
+	}
+	if(!r)
+		watch_wrote(name, nName);
+	return r;
+}
+
+int
+account_append(const char *name, U32 nName, const struct iovec *iov, int nIov)
+{
+	int fd;
+	ssize_t n = 0;
+	int r;
+
+	// encrypted data and records inside the vault are written as a whole
+	if(fdVault != ERR || cryptActive)
+	{
+		struct account acc;
+		struct iovec all[nIov + 1];
+
+		if(account_open(name, nName, &acc))
+			return ERR;
+		all[0] = (struct iovec) { (void*) acc.data, acc.nData };
+		memcpy(all + 1, iov, sizeof(*iov) * nIov);
+		r = account_write(name, nName, all, nIov + 1);
+		account_close(&acc);
+		return r;
+	}
+	appendrealpath(name, nName);
+	fd = open(path, O_WRONLY | O_APPEND);
+	if(fd == ERR)
+		return ERR;
+	for(int i = 0; i < nIov; i++)
+		n += iov[i].iov_len;
+	r = writev(fd, iov, nIov) == n ? OK : ERR;
+	close(fd);
+	if(!r)
+		watch_wrote(name, nName);
+	return r;
+}
+
+static int
+createraw(const char *name, U32 nName, const char *data, size_t nData)
+{
+	int fd;
+	int r;
+
+	if(fdVault != ERR)
+	{
+		if(nData > UINT32_MAX)
+		{
+			errno = EFBIG;
+			return ERR;
+		}
+		return vault_insert(name, nName, data, nData);
+	}
+	appendrealpath(name, nName);
+	fd = open(path, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	r = nData && write(fd, data, nData) != (ssize_t) nData ? ERR : OK;
+	close(fd);
+	if(r)
+		remove(path);
+	return r;
+}
+
+int
+account_create(const char *name, U32 nName, const char *data, size_t nData)
+{
+	char *blob;
+	size_t nBlob;
+	int r;
+
+	if(!cryptActive)
+		r = createraw(name, nName, data, nData);
+	else
+	{
+		// an empty account is encrypted as well so it can't be told apart
+		if(crypt_encrypt(name, nName, &(struct iovec) { (void*) data, nData }, 1, &blob, &nBlob))
+			return ERR;
+		r = createraw(name, nName, blob, nBlob);
+		free(blob);
+	}
+	if(r)
+		return ERR;
+	watch_wrote(name, nName);
+	names_added(name, nName);
+	search_accountadded(name, nName, data, nData);
+	return OK;
+}
+
+int
+account_delete(const char *name, U32 nName)
+{
+	int r;
+
+	property_invalidate(name, nName);
+	if(fdVault != ERR)
+		r = vault_remove(name, nName);
+	else
+	{
+		appendrealpath(name, nName);
+		r = remove(path);
+	}
+	if(!r)
+	{
+		watch_wrote(name, nName);
+		names_removed(name, nName);
+		search_accountremoved(name, nName);
+	}
+	return r;
+}
+
+// builds the path of an account file without touching the global path
+static void
+localpath(char *dest, const char *name, U32 nName, const char *ext)
+{
+	snprintf(dest, sizeof(path), "%s/%.*s%s", realPath, (int) nName, name, ext);
+}
+
+int
+account_readraw(const char *name, U32 nName, char **data, size_t *nData)
+{
+	char accPath[sizeof(path)];
+	int fd;
+	struct stat st;
+	char *buf;
+
+	if(fdVault != ERR)
+	{
+		U32 n;
+		int r;
+
+		pthread_rwlock_rdlock(&vaultLock);
+		r = vault_get(name, nName, data, &n);
+		pthread_rwlock_unlock(&vaultLock);
+		*nData = n;
+		return r;
+	}
+	localpath(accPath, name, nName, "");
+	fd = open(accPath, O_RDONLY);
+	if(fd == ERR)
+		return ERR;
+	if(fstat(fd, &st) || !(buf = malloc(st.st_size + 1)))
+	{
+		close(fd);
+		return ERR;
+	}
+	if(read(fd, buf, st.st_size) != st.st_size)
+	{
+		close(fd);
+		free(buf);
+		errno = EIO;
+		return ERR;
+	}
+	close(fd);
+	*data = buf;
+	*nData = st.st_size;
+	return OK;
+}
+
+int
+account_rewrite(const char *name, U32 nName, const char *data, size_t nData)
+{
+	char accPath[sizeof(path)];
+	char tmpPath[sizeof(path)];
+	int fd;
+	int r;
+
+	if(fdVault != ERR)
+	{
+		if(nData > UINT32_MAX)
+		{
+			errno = EFBIG;
+			return ERR;
+		}
+		pthread_rwlock_wrlock(&vaultLock);
+		r = vault_put(name, nName, data, nData);
+		pthread_rwlock_unlock(&vaultLock);
+		if(!r)
+			watch_wrote(name, nName);
+		return r;
+	}
+	// every account has its own temporary file so accounts can be rewritten at the same time
+	localpath(accPath, name, nName, "");
+	localpath(tmpPath, name, nName, ".rekey");
+	fd = open(tmpPath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	if(write(fd, data, nData) != (ssize_t) nData || fsync(fd))
+	{
+		close(fd);
+		remove(tmpPath);
+		return ERR;
+	}
+	close(fd);
+	r = renameat2(AT_FDCWD, tmpPath, AT_FDCWD, accPath, RENAME_EXCHANGE);
+	remove(tmpPath);
+	if(!r)
+		watch_wrote(name, nName);
+	return r;
+}
+
+int
+account_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg)
+{
+	DIR *dir;
+	struct dirent *dirent;
+
+	if(fdVault != ERR)
+		return vault_foreach(proc, arg);
+	dir = opendir(realPath);
+	if(!dir)
+		return ERR;
+	while((dirent = readdir(dir)))
+		if(dirent->d_type == DT_REG && !strchr(dirent->d_name, '.') &&
+				proc(dirent->d_name, strlen(dirent->d_name), arg))
+			break;
+	closedir(dir);
+	return OK;
+}
@@ -6,8 +6,9 @@ void set(const struct branch *branch, struct value *values);
 void add_account(const struct branch *branch, struct value *values);
 void add_property(const struct branch *branch, struct value *values);
 void backup_edit(const struct branch *branch, struct value *values){}
-void backup_undo(const struct branch *branch, struct value *values){}
-void backup_redo(const struct branch *branch, struct value *values){}
+void backup_undo(const struct branch *branch, struct value *values);
+void backup_redo(const struct branch *branch, struct value *values);
+void backup_compact(const struct branch *branch, struct value *values);
 void remove_account(const struct branch *branch, struct value *values);
 void remove_property(const struct branch *branch, struct value *values);
 void remove_backup(const struct branch *branch, struct value *values);
@@ -15,115 +16,265 @@ void info_account(const struct branch *branch, struct value *values);
 void info_backup(const struct branch *branch, struct value *values);
 void tree(const struct branch *branch, struct value *values);
 void list_account(const struct branch *branch, struct value *values);
+void find_account(const struct branch *branch, struct value *values);
+void search_properties(const struct branch *branch, struct value *values);
+void import_accounts(const struct branch *branch, struct value *values);
+void export_accounts(const struct branch *branch, struct value *values);
+void check_vault(const struct branch *branch, struct value *values);
+void vault_migrate(const struct branch *branch, struct value *values);
+void vault_encrypt(const struct branch *branch, struct value *values);
+void vault_rekey(const struct branch *branch, struct value *values);
 void cmd_quit(const struct branch *branch, struct value *values);
 void cmd_clear(const struct branch *branch, struct value *values);
 
-static const struct branch setNodes[] = {
-	{ "value", "possible values are", 0, .proc = set },
+static const struct dependency nameDependency = { "name", TWORD };
+static const struct dependency accountDependency = { "name", TWORD, .account = true };
+static const struct dependency valueDependency = { "string|number", 0 };
+
+static struct branch setNodes[] = {
+	{ "value", "possible values are", 0, .proc = set, .dependency = &valueDependency },
+};
+static struct branch addPropertyAccountNodes[] = {
+	{ "value", "set a specific value (\"value\")", 0, .proc = add_property, .dependency = &valueDependency },
 };
-static const struct branch addPropertyAccountNodes[] = {
-	{ "value", "set a specific value (\"value\")", 0, .proc = add_property },
+static struct branch addPropertyNodes[] = {
+	{ "account", "choose an account to add the property to", ARRLEN(addPropertyAccountNodes), .subnodes = addPropertyAccountNodes, .dependency = &accountDependency },
 };
-static const struct branch addNodes[] = {
-	{ "account", "add an account", 0, .proc = add_account },
+static struct branch addNodes[] = {
+	{ "account", "add an account", 0, .proc = add_account, .dependency = &nameDependency },
+	{ "property", "add a property to an account", ARRLEN(addPropertyNodes), .subnodes = addPropertyNodes, .dependency = &nameDependency },
 };
-static const struct branch removePropertyNodes[] = {
-	{ "account", "choose an account to remove the property from", 0, .proc = remove_property },
+static struct branch removePropertyNodes[] = {
+	{ "account", "choose an account to remove the property from", 0, .proc = remove_property, .dependency = &accountDependency },
 };
-static const struct branch removeNodes[] = {
-	{ "account", "remove an account from the list of accounts", 0, .proc = remove_account },
+static struct branch removeNodes[] = {
+	{ "account", "remove an account from the list of accounts", 0, .proc = remove_account, .dependency = &accountDependency },
 	{ "backup", "remove the active backup", 0, .proc = remove_backup },
-	{ "property", "remove the active backup", ARRLEN(removePropertyNodes), .subnodes = removePropertyNodes},
+	{ "property", "remove the active backup", ARRLEN(removePropertyNodes), .subnodes = removePropertyNodes, .dependency = &nameDependency },
+};
+static struct branch infoNodes[] = {
+	{ "backup", "browse the entries of the backup", 0, .proc = info_backup },
+	{ "account", "shows all properties of an account", 0, .proc = info_account, .dependency = &accountDependency },
 };
-static const struct branch listNodes[] = {
+static struct branch listNodes[] = {
 	{ "accounts", "lists all accounts", 0, .proc = list_account },
 };
-static const struct branch accountNodes[] = {
+static struct branch accountNodes[] = {
 	{ "show", "shows data of given account", 0, .proc = list_account },
 	//{ "property", "adds a property", ARRLEN(accountPropertyNodes), .subnodes = accountPropertyNodes },
 };
-static const struct branch backupNodes[] = {
+static struct branch backupNodes[] = {
 	{ "edit", "directly edit the backup file", 0, .proc = backup_edit },
 	{ "undo", "undoes the last operation in the backup file", 0, .proc = backup_undo },
 	{ "redo", "redoes the last undone action", 0, .proc = backup_redo },
+	{ "compact", "replaces the backup with a snapshot of all accounts", 0, .proc = backup_compact },
+};
+static struct branch vaultNodes[] = {
+	{ "migrate", "moves all account files into a single indexed vault file", 0, .proc = vault_migrate },
+	{ "encrypt", "encrypts all accounts with a passphrase", 0, .proc = vault_encrypt },
+	{ "rekey", "re-encrypts all accounts with a new passphrase, vault writes go one at a time", 0, .proc = vault_rekey },
+};
+static struct branch exportNodes[] = {
+	{ "csv", "writes one property per row (\"path\")", 0, .proc = export_accounts, .dependency = &valueDependency },
+	{ "json", "writes one object per account (\"path\")", 0, .proc = export_accounts, .dependency = &valueDependency },
+	{ "archive", "writes the account data, encrypted when the accounts are (\"path\")", 0, .proc = export_accounts, .dependency = &valueDependency },
 };
-static const struct branch nodes[] = {
+static struct branch checkNodes[] = {
+	{ "all", "checks every account and the backup for corrupt data", 0, .proc = check_vault },
+	{ "repair", "checks everything and cuts corrupt data off after the last valid record", 0, .proc = check_vault },
+};
+static struct branch nodes[] = {
 	{ "help", "shows help for a specific command", -1, .special = help },
-	{ "set", "set a system variable (options are: area)", ARRLEN(setNodes), .subnodes = setNodes },
+	{ "set", "set a system variable (options are: area)", ARRLEN(setNodes), .subnodes = setNodes, .dependency = &nameDependency },
 	{ "add", "add an account", ARRLEN(addNodes), .subnodes = addNodes },
 	{ "remove", "remove an account", ARRLEN(removeNodes), .subnodes = removeNodes },
+	{ "info", "shows information about a specific object", ARRLEN(infoNodes), .subnodes = infoNodes },
 	{ "list", "shows a specific list", ARRLEN(listNodes), .subnodes = listNodes },
 	{ "tree", "shows a tree view of all commands", 0, .proc = tree },
-	{ "account", "access account file", ARRLEN(accountNodes), .subnodes = accountNodes },
+	{ "account", "access account file", ARRLEN(accountNodes), .subnodes = accountNodes, .dependency = &accountDependency },
+	{ "find", "finds accounts with a name similar to the given one", 0, .proc = find_account, .dependency = &valueDependency },
+	{ "search", "finds the properties whose name or value contains all given words", 0, .proc = search_properties, .dependency = &valueDependency },
+	{ "import", "adds the accounts of a CSV or JSON file or an archive", 0, .proc = import_accounts, .dependency = &valueDependency },
+	{ "export", "writes all accounts into a file that import reads", ARRLEN(exportNodes), .subnodes = exportNodes },
+	{ "check", "checks the accounts and the backup in parallel", ARRLEN(checkNodes), .subnodes = checkNodes },
 	{ "backup", "access the backup file", ARRLEN(backupNodes), .subnodes = backupNodes },
+	{ "vault", "access the single file vault", ARRLEN(vaultNodes), .subnodes = vaultNodes },
 	{ "clear", "clears the screen", 0, .proc = cmd_clear },
 	{ "quit", "quit the program", 0, .proc = cmd_quit },
 	{ "exit", "exit the program (same as quit)", 0, .proc = cmd_quit },
 };
-static const struct branch _root[] = {
+static struct branch _root[] = {
 	{ NULL, NULL, ARRLEN(nodes), .subnodes = nodes },
 };
 const struct branch *const root = _root;
 
-void
-printoptions(const struct branch *branch)
+static U32
+slotof(const struct branch *branch, U32 hash)
 {
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nPossible options are:");
-	for(U32 i = 0; i < branch->nSubnodes; i++)
+	return (((hash ^ branch->seed) * 2654435761u) >> 16) & branch->mask;
+}
+
+// finds a seed for which all subnode names land in different slots,
+// the table grows when no seed works for its size
+static void
+buildslots(struct branch *branch)
+{
+	if(IS_EXEC_BRANCH(branch))
+		return;
+	for(U32 size = 1; size <= 0x10000 && !branch->slots; size *= 2)
 	{
-		wattrset(out, ATTR_HIGHLIGHT);
-		wprintw(out, "\n\t%s", branch->subnodes[i].name);
-		for(U32 i = 0; i < ARRLEN(dependencies); i++)
-			if(!strcmp(dependencies[i].name, branch->subnodes[i].name))
+		if(size < branch->nSubnodes)
+			continue;
+		branch->slots = calloc(size, sizeof(*branch->slots));
+		if(!branch->slots)
+			break;
+		branch->mask = size - 1;
+		for(branch->seed = 0; branch->seed < 256; branch->seed++)
+		{
+			U32 i;
+
+			for(i = 0; i < branch->nSubnodes; i++)
 			{
-				wattron(out, A_ITALIC);
-				wprintw(out, " %s", dependencies[i].description);
-				break;
+				const char *const name = branch->subnodes[i].name;
+				U8 *const slot = branch->slots +
+					slotof(branch, hashname(name, strlen(name)));
+
+				if(*slot)
+					break;
+				*slot = i + 1;
 			}
-		wattrset(out, ATTR_DEFAULT);
-		wprintw(out, "\t%s", branch->subnodes[i].description);
+			if(i == branch->nSubnodes)
+				break;
+			memset(branch->slots, 0, size);
+		}
+		if(branch->seed == 256)
+		{
+			free(branch->slots);
+			branch->slots = NULL;
+		}
 	}
+	for(U32 i = 0; i < branch->nSubnodes; i++)
+		buildslots((struct branch*) branch->subnodes + i);
 }
 
-const struct branch *
-nextbranch(const struct branch *branch, struct input *input)
+static void __attribute__((constructor))
+init(void)
 {
-	TOKEN *tok;
-	struct value value;
-	const struct branch *newBranch = NULL; const char *word; U32 nWord;
+	buildslots(_root);
+}
 
-	if(IS_EXEC_BRANCH(branch) || !(tok = nexttoken(input, &value)))
-		return NULL;
-	switch(tok->type)
+static const struct branch *
+findsubnode(const struct branch *branch, const char *word, U32 nWord)
+{
+	const struct branch *sub;
+	U8 slot;
+
+	if(!branch->slots)
 	{
-	case TWORD: word = value.word; nWord = value.nWord; break;
-	case TPLUS: word = "add"; nWord = 3; break;
-	case TMINUS: word = "remove"; nWord = 6; break;	
-	case TCOLON: word = "account"; nWord = 7; break;
-	case TQUESTION: word = "info"; nWord = 4; break;
-	case TEQU: word = "value"; nWord = 5; break;
-	case TAT: word = "property"; nWord = 8; break;
-	case TDOT: word = "set"; nWord = 3; break;
-	default: return NULL;
+		// no perfect hash could be built
+		for(U32 i = 0; i < branch->nSubnodes; i++)
+		{
+			sub = branch->subnodes + i;
+			if(!strncmp(sub->name, word, nWord) && !sub->name[nWord])
+				return sub;
+		}
+		return NULL;
 	}
+	slot = branch->slots[slotof(branch, hashname(word, nWord))];
+	if(!slot)
+		return NULL;
+	sub = branch->subnodes + slot - 1;
+	return !strncmp(sub->name, word, nWord) && !sub->name[nWord] ? sub : NULL;
+}
+
+void
+printoptions(const struct branch *branch)
+{
+	outattr(ATTR_LOG);
+	outprintf("\nPossible options are:");
 	for(U32 i = 0; i < branch->nSubnodes; i++)
 	{
-		if(strlen(branch->subnodes[i].name) == nWord && !memcmp(branch->subnodes[i].name, word, nWord))
+		const struct branch *const sub = branch->subnodes + i;
+
+		outattr(ATTR_HIGHLIGHT);
+		outprintf("\n\t%s", sub->name);
+		if(sub->dependency)
 		{
-			newBranch = branch->subnodes + i;
-			break;
+			outattr(ATTR_HIGHLIGHT | A_ITALIC);
+			outprintf(" %s", sub->dependency->description);
 		}
+		outattr(ATTR_DEFAULT);
+		outprintf("\t%s", sub->description);
 	}
+}
+
+// the word that selects a subnode, symbols stand for the common branches
+static bool
+branchword(const TOKEN *tok, const struct value *value, const char **word, U32 *nWord)
+{
+	switch(tok->type)
+	{
+	case TWORD: *word = value->word; *nWord = value->nWord; break;
+	case TPLUS: *word = "add"; *nWord = 3; break;
+	case TMINUS: *word = "remove"; *nWord = 6; break;
+	case TCOLON: *word = "account"; *nWord = 7; break;
+	case TQUESTION: *word = "info"; *nWord = 4; break;
+	case TEQU: *word = "value"; *nWord = 5; break;
+	case TAT: *word = "property"; *nWord = 8; break;
+	case TDOT: *word = "set"; *nWord = 3; break;
+	default: return false;
+	}
+	return true;
+}
+
+const struct branch *
+nextbranch(const struct branch *branch, struct input *input)
+{
+	TOKEN *tok;
+	struct value value;
+	const struct branch *newBranch; const char *word; U32 nWord;
+
+	if(IS_EXEC_BRANCH(branch) || !(tok = nexttoken(input, &value)) ||
+			!branchword(tok, &value, &word, &nWord))
+		return NULL;
+	newBranch = findsubnode(branch, word, nWord);
 	if(!newBranch)
 	{
-		wattrset(out, ATTR_ERROR);
+		outattr(ATTR_ERROR);
 		if(branch->name)
-			wprintw(out, "\nBranch '%s' doesn't have the option '%.*s'", branch->name, nWord, word);
+			outprintf("\nBranch '%s' doesn't have the option '%.*s'", branch->name, nWord, word);
 		else
-			wprintw(out, "\nBranch '%.*s' doesn't exist", nWord, word);
+			outprintf("\nBranch '%.*s' doesn't exist", nWord, word);
 		printoptions(branch);
 		return NULL;
 	}
 	return newBranch;
 }
+
+const struct branch *
+completebranch(struct input *input, U32 nTokens, bool *isValue)
+{
+	const struct branch *branch = root;
+	TOKEN *tok;
+	struct value value;
+	const char *word;
+	U32 nWord;
+
+	*isValue = false;
+	input->iToken = 0;
+	while(input->iToken < nTokens)
+	{
+		tok = nexttoken(input, &value);
+		if(*isValue)
+		{
+			// the token the branch depends on
+			*isValue = false;
+			continue;
+		}
+		if(IS_EXEC_BRANCH(branch) || !branchword(tok, &value, &word, &nWord) ||
+				!(branch = findsubnode(branch, word, nWord)))
+			return NULL;
+		*isValue = !!branch->dependency;
+	}
+	return branch;
+}
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// the account data is read as it is stored and walked with the record
+// parser, every record is a name and a value each ended by a null and the
+// name can't be empty; encrypted data is checked after decrypting it, the
+// authentication tag already covers every byte of it
+
+// offset after the last valid record
+static size_t
+validlength(const char *data, size_t nData, int *err)
+{
+	struct account acc = { .data = data, .nData = nData };
+	struct record rec;
+	size_t valid = 0;
+	int r;
+
+	while((r = account_next(&acc, &rec)) == 1)
+	{
+		if(!rec.nName)
+		{
+			*err = EILSEQ;
+			return valid;
+		}
+		valid = acc.pos;
+	}
+	*err = r ? errno : 0;
+	return valid;
+}
+
+int
+check_account(const char *name, U32 nName, bool repair, struct damage *d)
+{
+	char *raw, *data;
+	size_t nRaw, nData;
+	bool encrypted;
+	int r = 0;
+
+	memset(d, 0, sizeof(*d));
+	if(account_readraw(name, nName, &raw, &nRaw))
+	{
+		d->err = errno;
+		return ERR;
+	}
+	encrypted = crypt_isencrypted(raw, nRaw);
+	if(encrypted)
+	{
+		if(crypt_decryptcopy(name, nName, raw, nRaw, &data, &nData))
+		{
+			d->err = errno;
+			free(raw);
+			if(d->err == ENOKEY)
+				return ERR;
+			// there is nothing left to cut off when the whole blob is wrong
+			d->nData = nRaw;
+			return 1;
+		}
+		d->encrypted = true;
+	}
+	else
+	{
+		data = raw;
+		nData = nRaw;
+	}
+	d->nData = nData;
+	d->off = validlength(data, nData, &d->err);
+	if(d->err)
+	{
+		r = 1;
+		if(repair)
+		{
+			char *blob = NULL;
+			size_t nBlob;
+
+			if(!encrypted)
+				d->repaired = !account_rewrite(name, nName, data, d->off);
+			else if(!crypt_encrypt(name, nName, &(struct iovec) { data, d->off }, 1, &blob, &nBlob))
+				d->repaired = !account_rewrite(name, nName, blob, nBlob);
+			free(blob);
+		}
+	}
+	if(encrypted)
+	{
+		explicit_bzero(data, nData);
+		free(data);
+	}
+	else
+		explicit_bzero(raw, nRaw);
+	free(raw);
+	return r;
+}
@@ -0,0 +1,98 @@
+#include "pwmgr.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C (Castagnoli), the polynomial SSE4.2 implements in hardware;
+// the software fallback processes 8 bytes per step (slicing by 8)
+#define CRC32C_POLY 0x82F63B78
+
+static U32 table[8][256];
+static U32 (*update)(U32 crc, const U8 *data, size_t nData);
+
+static U32
+update_sw(U32 crc, const U8 *data, size_t nData)
+{
+	while(nData && ((uintptr_t) data & 7))
+	{
+		crc = table[0][(crc ^ *(data++)) & 0xFF] ^ (crc >> 8);
+		nData--;
+	}
+	while(nData >= 8)
+	{
+		U64 v;
+
+		memcpy(&v, data, 8);
+		v ^= crc;
+		crc = table[7][v & 0xFF] ^
+			table[6][(v >> 8) & 0xFF] ^
+			table[5][(v >> 16) & 0xFF] ^
+			table[4][(v >> 24) & 0xFF] ^
+			table[3][(v >> 32) & 0xFF] ^
+			table[2][(v >> 40) & 0xFF] ^
+			table[1][(v >> 48) & 0xFF] ^
+			table[0][v >> 56];
+		data += 8;
+		nData -= 8;
+	}
+	while(nData--)
+		crc = table[0][(crc ^ *(data++)) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static U32
+update_hw(U32 crc, const U8 *data, size_t nData)
+{
+	U64 crc64;
+
+	while(nData && ((uintptr_t) data & 7))
+	{
+		crc = _mm_crc32_u8(crc, *(data++));
+		nData--;
+	}
+	crc64 = crc;
+	while(nData >= 8)
+	{
+		U64 v;
+
+		memcpy(&v, data, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+		data += 8;
+		nData -= 8;
+	}
+	crc = crc64;
+	while(nData--)
+		crc = _mm_crc32_u8(crc, *(data++));
+	return crc;
+}
+#endif
+
+static void __attribute__((constructor))
+init(void)
+{
+	for(U32 i = 0; i < 256; i++)
+	{
+		U32 crc = i;
+
+		for(U32 k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		table[0][i] = crc;
+	}
+	for(U32 i = 0; i < 256; i++)
+		for(U32 t = 1; t < 8; t++)
+			table[t][i] = table[0][table[t - 1][i] & 0xFF] ^ (table[t - 1][i] >> 8);
+	update = update_sw;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse4.2"))
+		update = update_hw;
+#endif
+}
+
+U32
+crc32c(U32 crc, const void *data, size_t nData)
+{
+	return ~update(~crc, data, nData);
+}
@@ -0,0 +1,530 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include "pwmgr.h"
+
+// key file layout
+// [header][check]
+// the header holds the scrypt parameters and the salt the key is derived with,
+// check is an encrypted empty blob bound to the header so a wrong passphrase
+// is noticed before anything is decrypted with it
+//
+// encrypted account data is
+// [version][cipher][nonce][ciphertext][tag]
+// with the account name as associated data, so the data of one account
+// can't be passed off as the data of another
+#define CRYPT_MAGIC "PWCRYP"
+#define CRYPT_VERSION 1
+#define BLOB_VERSION 1
+#define KEY_SIZE 32
+#define NONCE_SIZE 12
+#define TAG_SIZE 16
+#define SALT_SIZE 16
+#define BLOB_OVERHEAD (2 + NONCE_SIZE + TAG_SIZE)
+// about 32 MiB and a tenth of a second, the derivation runs once per session
+#define SCRYPT_N (1 << 15)
+#define SCRYPT_R 8
+#define SCRYPT_P 1
+#define SCRYPT_MAXMEM ((U64) 1 << 30)
+
+enum {
+	CIPHER_AES_GCM = 1,
+	CIPHER_CHACHA20_POLY1305,
+};
+
+struct crypt_header {
+	char magic[6];
+	U16 version;
+	U64 n;
+	U32 r, p;
+	U8 salt[SALT_SIZE];
+};
+
+// the current key and during a key rotation the next one
+enum {
+	SLOT_CURRENT,
+	SLOT_NEXT,
+};
+
+// every key lives in its own locked page that is never swapped or dumped
+struct key {
+	struct crypt_header header;
+	U8 *bytes;
+	size_t nPage;
+	// changes whenever the key does so contexts made for an older key are noticed
+	U32 generation;
+};
+
+// a context keeps the key schedule so only the nonce changes per blob; contexts
+// are per thread because the workers of a key rotation use the keys at the same time
+struct context {
+	EVP_CIPHER_CTX *ctx;
+	U32 generation;
+};
+
+bool cryptActive;
+
+static struct key keys[2];
+static U32 generation;
+static __thread struct context contexts[2][2][3];
+// cipher for new blobs
+static U8 preferred;
+
+static const EVP_CIPHER *
+cipherof(U8 id)
+{
+	switch(id)
+	{
+	case CIPHER_AES_GCM: return EVP_aes_256_gcm();
+	case CIPHER_CHACHA20_POLY1305: return EVP_chacha20_poly1305();
+	}
+	return NULL;
+}
+
+static void __attribute__((constructor))
+init(void)
+{
+	// without AES instructions ChaCha20 is faster and doesn't depend on table lookups
+	preferred = CIPHER_CHACHA20_POLY1305;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"))
+		preferred = CIPHER_AES_GCM;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+	preferred = CIPHER_AES_GCM;
+#endif
+}
+
+// sets up the context of a key and cipher the first time the thread uses it
+static EVP_CIPHER_CTX *
+contextof(U32 k, U8 id, bool enc)
+{
+	struct context *c;
+	const EVP_CIPHER *cipher;
+
+	cipher = cipherof(id);
+	if(!cipher)
+	{
+		errno = EILSEQ;
+		return NULL;
+	}
+	c = &contexts[k][enc][id];
+	if(c->ctx && c->generation == keys[k].generation)
+		return c->ctx;
+	EVP_CIPHER_CTX_free(c->ctx);
+	c->ctx = EVP_CIPHER_CTX_new();
+	if(!c->ctx)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	if(!EVP_CipherInit_ex(c->ctx, cipher, NULL, keys[k].bytes, NULL, enc) ||
+			!EVP_CIPHER_CTX_ctrl(c->ctx, EVP_CTRL_AEAD_SET_IVLEN, NONCE_SIZE, NULL))
+	{
+		EVP_CIPHER_CTX_free(c->ctx);
+		c->ctx = NULL;
+		errno = EIO;
+		return NULL;
+	}
+	c->generation = keys[k].generation;
+	return c->ctx;
+}
+
+static int
+seal(U32 k, const char *ad, size_t nAd, const struct iovec *iov, int nIov,
+		char **blob, size_t *nBlob)
+{
+	EVP_CIPHER_CTX *ctx;
+	size_t n = 0;
+	U8 *out, *at;
+	int len;
+
+	ctx = contextof(k, preferred, true);
+	if(!ctx)
+		return ERR;
+	for(int i = 0; i < nIov; i++)
+		n += iov[i].iov_len;
+	if(n > INT32_MAX)
+	{
+		errno = EFBIG;
+		return ERR;
+	}
+	out = malloc(BLOB_OVERHEAD + n);
+	if(!out)
+		return ERR;
+	out[0] = BLOB_VERSION;
+	out[1] = preferred;
+	if(RAND_bytes(out + 2, NONCE_SIZE) != 1 ||
+			!EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, out + 2) ||
+			// the version and cipher are authenticated along with the name
+			!EVP_EncryptUpdate(ctx, NULL, &len, out, 2) ||
+			!EVP_EncryptUpdate(ctx, NULL, &len, (const U8*) ad, nAd))
+		goto err;
+	at = out + 2 + NONCE_SIZE;
+	for(int i = 0; i < nIov; i++)
+	{
+		if(!iov[i].iov_len)
+			continue;
+		if(!EVP_EncryptUpdate(ctx, at, &len, iov[i].iov_base, iov[i].iov_len))
+			goto err;
+		at += len;
+	}
+	if(!EVP_EncryptFinal_ex(ctx, at, &len) ||
+			!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, out + 2 + NONCE_SIZE + n))
+		goto err;
+	*blob = (char*) out;
+	*nBlob = BLOB_OVERHEAD + n;
+	return OK;
+err:
+	free(out);
+	errno = EIO;
+	return ERR;
+}
+
+// the plaintext goes into secure memory unless the caller is a worker thread
+static int
+unseal(U32 k, const char *ad, size_t nAd, const char *blob, size_t nBlob,
+		char **data, size_t *nData, bool secure)
+{
+	const U8 *const in = (const U8*) blob;
+	EVP_CIPHER_CTX *ctx;
+	size_t n;
+	char *out;
+	int len;
+
+	if(nBlob < BLOB_OVERHEAD || in[0] != BLOB_VERSION)
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	ctx = contextof(k, in[1], false);
+	if(!ctx)
+		return ERR;
+	n = nBlob - BLOB_OVERHEAD;
+	out = secure ? secure_alloc(MAX(n, 1)) : malloc(MAX(n, 1));
+	if(!out)
+	{
+		errno = ENOMEM;
+		return ERR;
+	}
+	if(!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, in + 2) ||
+			!EVP_DecryptUpdate(ctx, NULL, &len, in, 2) ||
+			!EVP_DecryptUpdate(ctx, NULL, &len, (const U8*) ad, nAd) ||
+			(n && !EVP_DecryptUpdate(ctx, (U8*) out, &len, in + 2 + NONCE_SIZE, n)) ||
+			!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_SIZE,
+				(void*) (in + 2 + NONCE_SIZE + n)) ||
+			EVP_DecryptFinal_ex(ctx, (U8*) out + n, &len) <= 0)
+	{
+		// the data was changed, belongs to another account or to another key
+		if(secure)
+			secure_free(out, MAX(n, 1));
+		else
+		{
+			OPENSSL_cleanse(out, n);
+			free(out);
+		}
+		errno = EBADMSG;
+		return ERR;
+	}
+	*data = out;
+	*nData = n;
+	return OK;
+}
+
+static void
+dropkey(U32 k)
+{
+	struct key *const key = keys + k;
+
+	if(!key->bytes)
+		return;
+	OPENSSL_cleanse(key->bytes, KEY_SIZE);
+	munlock(key->bytes, key->nPage);
+	munmap(key->bytes, key->nPage);
+	key->bytes = NULL;
+}
+
+static int
+derive(U32 k, const char *pass, size_t nPass)
+{
+	struct key *const key = keys + k;
+
+	if(!key->bytes)
+	{
+		key->nPage = sysconf(_SC_PAGESIZE);
+		key->bytes = mmap(NULL, key->nPage, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(key->bytes == MAP_FAILED)
+		{
+			key->bytes = NULL;
+			return ERR;
+		}
+		if(mlock(key->bytes, key->nPage))
+		{
+			munmap(key->bytes, key->nPage);
+			key->bytes = NULL;
+			return ERR;
+		}
+		madvise(key->bytes, key->nPage, MADV_DONTDUMP);
+	}
+	key->generation = ++generation;
+	// the memory limit has to be raised, the default is exactly what the parameters need
+	if(!EVP_PBE_scrypt(pass, nPass, key->header.salt, sizeof(key->header.salt),
+				key->header.n, key->header.r, key->header.p, SCRYPT_MAXMEM,
+				key->bytes, KEY_SIZE))
+	{
+		dropkey(k);
+		errno = EINVAL;
+		return ERR;
+	}
+	return OK;
+}
+
+static int
+readheader(const char *path, struct crypt_header *hdr)
+{
+	int fd;
+	ssize_t n;
+
+	fd = open(path, O_RDONLY);
+	if(fd == ERR)
+		return ERR;
+	n = read(fd, hdr, sizeof(*hdr));
+	close(fd);
+	if(n != sizeof(*hdr) || memcmp(hdr->magic, CRYPT_MAGIC, sizeof(hdr->magic)) ||
+			hdr->version != CRYPT_VERSION)
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	return OK;
+}
+
+// derives key k from the key file and checks that the passphrase is right
+static int
+unlock(U32 k, const char *path, const char *pass, size_t nPass)
+{
+	int fd;
+	char check[BLOB_OVERHEAD];
+	char *data;
+	size_t nData;
+
+	if(readheader(path, &keys[k].header))
+		return ERR;
+	fd = open(path, O_RDONLY);
+	if(fd == ERR)
+		return ERR;
+	if(pread(fd, check, sizeof(check), sizeof(keys[k].header)) != sizeof(check))
+	{
+		close(fd);
+		errno = EILSEQ;
+		return ERR;
+	}
+	close(fd);
+	if(derive(k, pass, nPass))
+		return ERR;
+	if(unseal(k, (const char*) &keys[k].header, sizeof(keys[k].header),
+				check, sizeof(check), &data, &nData, false))
+	{
+		dropkey(k);
+		errno = EACCES;
+		return ERR;
+	}
+	free(data);
+	return OK;
+}
+
+// derives key k from a new salt and writes its key file
+static int
+create(U32 k, const char *path, const char *pass, size_t nPass)
+{
+	struct crypt_header *const hdr = &keys[k].header;
+	int fd;
+	char *check;
+	size_t nCheck;
+	int r;
+
+	memcpy(hdr->magic, CRYPT_MAGIC, sizeof(hdr->magic));
+	hdr->version = CRYPT_VERSION;
+	hdr->n = SCRYPT_N;
+	hdr->r = SCRYPT_R;
+	hdr->p = SCRYPT_P;
+	if(RAND_bytes(hdr->salt, sizeof(hdr->salt)) != 1)
+	{
+		errno = EIO;
+		return ERR;
+	}
+	if(derive(k, pass, nPass))
+		return ERR;
+	if(seal(k, (const char*) hdr, sizeof(*hdr), NULL, 0, &check, &nCheck))
+	{
+		dropkey(k);
+		return ERR;
+	}
+	fd = open(path, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+	{
+		free(check);
+		dropkey(k);
+		return ERR;
+	}
+	r = write(fd, hdr, sizeof(*hdr)) == sizeof(*hdr) &&
+		write(fd, check, nCheck) == (ssize_t) nCheck && !fsync(fd) ? OK : ERR;
+	close(fd);
+	free(check);
+	if(r)
+	{
+		remove(path);
+		dropkey(k);
+		return ERR;
+	}
+	return OK;
+}
+
+int
+crypt_open(const char *path)
+{
+	return readheader(path, &keys[SLOT_CURRENT].header);
+}
+
+int
+crypt_unlock(const char *path, const char *pass, size_t nPass)
+{
+	if(unlock(SLOT_CURRENT, path, pass, nPass))
+		return ERR;
+	cryptActive = true;
+	return OK;
+}
+
+int
+crypt_create(const char *path, const char *pass, size_t nPass)
+{
+	if(create(SLOT_CURRENT, path, pass, nPass))
+		return ERR;
+	cryptActive = true;
+	return OK;
+}
+
+void
+crypt_close(void)
+{
+	crypt_threadexit();
+	dropkey(SLOT_CURRENT);
+	dropkey(SLOT_NEXT);
+	cryptActive = false;
+}
+
+void
+crypt_threadexit(void)
+{
+	for(U32 k = 0; k < 2; k++)
+		for(U32 e = 0; e < 2; e++)
+			for(U32 c = 0; c < ARRLEN(contexts[k][e]); c++)
+			{
+				EVP_CIPHER_CTX_free(contexts[k][e][c].ctx);
+				contexts[k][e][c].ctx = NULL;
+			}
+}
+
+bool
+crypt_isencrypted(const char *data, size_t nData)
+{
+	// account data starts with a property name which can't start with this byte
+	return nData >= BLOB_OVERHEAD && data[0] == BLOB_VERSION;
+}
+
+int
+crypt_encrypt(const char *name, U32 nName, const struct iovec *iov, int nIov,
+		char **blob, size_t *nBlob)
+{
+	return seal(SLOT_CURRENT, name, nName, iov, nIov, blob, nBlob);
+}
+
+int
+crypt_decrypt(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **data, size_t *nData)
+{
+	if(!cryptActive)
+	{
+		errno = ENOKEY;
+		return ERR;
+	}
+	return unseal(SLOT_CURRENT, name, nName, blob, nBlob, data, nData, true);
+}
+
+int
+crypt_decryptcopy(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **data, size_t *nData)
+{
+	if(!cryptActive)
+	{
+		errno = ENOKEY;
+		return ERR;
+	}
+	return unseal(SLOT_CURRENT, name, nName, blob, nBlob, data, nData, false);
+}
+
+int
+crypt_rekeybegin(const char *nextPath, const char *pass, size_t nPass, bool *resumed)
+{
+	if(!cryptActive)
+	{
+		errno = ENOKEY;
+		return ERR;
+	}
+	*resumed = !access(nextPath, F_OK);
+	return *resumed ? unlock(SLOT_NEXT, nextPath, pass, nPass) :
+		create(SLOT_NEXT, nextPath, pass, nPass);
+}
+
+int
+crypt_reseal(const char *name, U32 nName, const char *blob, size_t nBlob,
+		char **newBlob, size_t *nNewBlob)
+{
+	char *data = NULL;
+	size_t nData;
+	int r;
+
+	if(!crypt_isencrypted(blob, nBlob))
+		// data that was never encrypted
+		return seal(SLOT_NEXT, name, nName,
+				&(struct iovec) { (void*) blob, nBlob }, 1, newBlob, nNewBlob);
+	// an earlier rotation that was interrupted already got to this one
+	if(!unseal(SLOT_NEXT, name, nName, blob, nBlob, &data, &nData, false))
+	{
+		OPENSSL_cleanse(data, nData);
+		free(data);
+		return 1;
+	}
+	if(unseal(SLOT_CURRENT, name, nName, blob, nBlob, &data, &nData, false))
+		return ERR;
+	r = seal(SLOT_NEXT, name, nName, &(struct iovec) { data, nData }, 1, newBlob, nNewBlob);
+	OPENSSL_cleanse(data, nData);
+	free(data);
+	return r;
+}
+
+int
+crypt_rekeyend(const char *path, const char *nextPath)
+{
+	if(rename(nextPath, path))
+		return ERR;
+	dropkey(SLOT_CURRENT);
+	keys[SLOT_CURRENT] = keys[SLOT_NEXT];
+	keys[SLOT_NEXT].bytes = NULL;
+	return OK;
+}
+
+void
+crypt_rekeyabort(void)
+{
+	dropkey(SLOT_NEXT);
+}
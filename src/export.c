@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// the accounts are written one at a time through a fixed buffer in secure
+// memory, an account is mapped (or decrypted) while it is written and closed
+// right after, so the memory use doesn't depend on the size of the vault;
+// the output goes to a temporary file that replaces the target at the end
+#define EXPORT_BUFFER 0x8000
+
+struct writer {
+	int fd;
+	char *buf;
+	size_t n;
+	// errno of the first failed write, everything after it is dropped
+	int err;
+};
+
+static void
+flush(struct writer *w)
+{
+	for(size_t off = 0; off < w->n && !w->err; )
+	{
+		const ssize_t n = write(w->fd, w->buf + off, w->n - off);
+
+		if(n < 0)
+		{
+			if(errno != EINTR)
+				w->err = errno;
+			continue;
+		}
+		off += n;
+	}
+	explicit_bzero(w->buf, w->n);
+	w->n = 0;
+}
+
+static void
+put(struct writer *w, const void *data, size_t nData)
+{
+	while(nData)
+	{
+		const size_t n = MIN(nData, EXPORT_BUFFER - w->n);
+
+		memcpy(w->buf + w->n, data, n);
+		w->n += n;
+		data = (const char*) data + n;
+		nData -= n;
+		if(w->n == EXPORT_BUFFER)
+			flush(w);
+	}
+}
+
+static void
+putch(struct writer *w, char ch)
+{
+	if(w->n == EXPORT_BUFFER)
+		flush(w);
+	w->buf[w->n++] = ch;
+}
+
+// fields are only quoted when the import would read them differently otherwise
+static void
+putcsv(struct writer *w, const char *str, size_t nStr)
+{
+	const char *quote;
+
+	if(nStr && !memchr(str, '"', nStr) && !memchr(str, ',', nStr) &&
+			!memchr(str, '\n', nStr) && !memchr(str, '\r', nStr))
+	{
+		put(w, str, nStr);
+		return;
+	}
+	putch(w, '"');
+	while((quote = memchr(str, '"', nStr)))
+	{
+		put(w, str, quote + 1 - str);
+		putch(w, '"');
+		nStr -= quote + 1 - str;
+		str = quote + 1;
+	}
+	put(w, str, nStr);
+	putch(w, '"');
+}
+
+static void
+putjson(struct writer *w, const char *str, size_t nStr)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t run = 0;
+
+	putch(w, '"');
+	for(size_t i = 0; i < nStr; i++)
+	{
+		const U8 ch = str[i];
+
+		if(ch >= 0x20 && ch != '"' && ch != '\\')
+			continue;
+		put(w, str + run, i - run);
+		run = i + 1;
+		putch(w, '\\');
+		switch(ch)
+		{
+		case '"': putch(w, '"'); break;
+		case '\\': putch(w, '\\'); break;
+		case '\n': putch(w, 'n'); break;
+		case '\t': putch(w, 't'); break;
+		case '\r': putch(w, 'r'); break;
+		default:
+			put(w, "u00", 3);
+			putch(w, hex[ch >> 4]);
+			putch(w, hex[ch & 0xF]);
+		}
+	}
+	put(w, str + run, nStr - run);
+	putch(w, '"');
+}
+
+struct exporter {
+	struct writer w;
+	int format;
+	struct export *result;
+};
+
+static int
+exportone(const char *name, U32 nName, void *arg)
+{
+	struct exporter *const e = arg;
+	struct export *const result = e->result;
+	struct account acc;
+	struct record rec;
+	U32 nProperties = 0;
+	int r;
+
+	if(account_open(name, nName, &acc))
+		goto err;
+	switch(e->format)
+	{
+	case EXPORT_CSV:
+		while((r = account_next(&acc, &rec)) == 1)
+		{
+			putcsv(&e->w, name, nName);
+			putch(&e->w, ',');
+			putcsv(&e->w, rec.name, rec.nName);
+			putch(&e->w, ',');
+			putcsv(&e->w, rec.value, rec.nValue);
+			putch(&e->w, '\n');
+			nProperties++;
+		}
+		// CSV has no way to write an account without properties
+		if(!r && !nProperties)
+		{
+			account_close(&acc);
+			result->nLeftOut++;
+			return 0;
+		}
+		break;
+	case EXPORT_JSON:
+		put(&e->w, "{\"account\":", sizeof("{\"account\":") - 1);
+		putjson(&e->w, name, nName);
+		put(&e->w, ",\"properties\":{", sizeof(",\"properties\":{") - 1);
+		while((r = account_next(&acc, &rec)) == 1)
+		{
+			if(nProperties++)
+				putch(&e->w, ',');
+			putjson(&e->w, rec.name, rec.nName);
+			putch(&e->w, ':');
+			putjson(&e->w, rec.value, rec.nValue);
+		}
+		put(&e->w, "}}\n", 3);
+		break;
+	default:
+	{
+		U32 nData;
+
+		// the records are only counted, the data is written as it is
+		while((r = account_next(&acc, &rec)) == 1)
+			nProperties++;
+		if(r)
+			break;
+		if(cryptActive)
+		{
+			char *blob = NULL;
+			size_t nBlob;
+
+			r = crypt_encrypt(name, nName, &(struct iovec) { (void*) acc.data, acc.nData }, 1,
+					&blob, &nBlob);
+			if(!r && nBlob > UINT32_MAX)
+			{
+				errno = EFBIG;
+				r = ERR;
+			}
+			if(!r)
+			{
+				nData = nBlob;
+				put(&e->w, &nName, sizeof(nName));
+				put(&e->w, name, nName);
+				put(&e->w, &nData, sizeof(nData));
+				put(&e->w, blob, nBlob);
+			}
+			free(blob);
+			break;
+		}
+		if(acc.nData > UINT32_MAX)
+		{
+			errno = EFBIG;
+			r = ERR;
+			break;
+		}
+		nData = acc.nData;
+		put(&e->w, &nName, sizeof(nName));
+		put(&e->w, name, nName);
+		put(&e->w, &nData, sizeof(nData));
+		put(&e->w, acc.data, acc.nData);
+	}
+	}
+	account_close(&acc);
+	if(r)
+		goto err;
+	if(e->w.err)
+		return 1;
+	result->nAccounts++;
+	result->nProperties += nProperties;
+	return 0;
+err:
+	memcpy(result->errAccount, name, MIN(nName, (U32) MAX_NAME));
+	result->nErrAccount = MIN(nName, (U32) MAX_NAME);
+	return 1;
+}
+
+int
+export_file(const char *path, int format, struct export *result)
+{
+	char tmpPath[strlen(path) + 5];
+	struct exporter e;
+	int err;
+
+	memset(result, 0, sizeof(*result));
+	e.format = format;
+	e.result = result;
+	e.w.n = 0;
+	e.w.err = 0;
+	e.w.buf = secure_alloc(EXPORT_BUFFER);
+	if(!e.w.buf)
+		return ERR;
+	sprintf(tmpPath, "%s.tmp", path);
+	// a left over file (or a link someone put there) is never written through
+	if(unlink(tmpPath) && errno != ENOENT)
+	{
+		e.w.fd = ERR;
+		goto err;
+	}
+	e.w.fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if(e.w.fd == ERR)
+		goto err;
+	switch(format)
+	{
+	case EXPORT_CSV:
+		put(&e.w, "account,name,value\n", sizeof("account,name,value\n") - 1);
+		break;
+	case EXPORT_ARCHIVE:
+		put(&e.w, EXPORT_MAGIC, sizeof(EXPORT_MAGIC) - 1);
+		break;
+	}
+	if(account_foreach(exportone, &e) || result->nErrAccount)
+		goto err;
+	if(e.w.err)
+	{
+		errno = e.w.err;
+		goto err;
+	}
+	// the archive ends with an empty name so a cut off file is noticed
+	if(format == EXPORT_ARCHIVE)
+		put(&e.w, &(U32) { 0 }, sizeof(U32));
+	flush(&e.w);
+	if(e.w.err)
+	{
+		errno = e.w.err;
+		goto err;
+	}
+	if(fsync(e.w.fd))
+		goto err;
+	err = close(e.w.fd);
+	e.w.fd = ERR;
+	if(err || rename(tmpPath, path))
+		goto err;
+	secure_free(e.w.buf, EXPORT_BUFFER);
+	return OK;
+err:
+	err = errno;
+	if(e.w.fd != ERR)
+		close(e.w.fd);
+	unlink(tmpPath);
+	secure_free(e.w.buf, EXPORT_BUFFER);
+	errno = err;
+	return ERR;
+}
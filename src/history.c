@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// history layout
+// [header][slots...][data ring]
+// entries are numbered from the start of the history, entry i is described
+// by slot i % capSlots and its bytes start at the logical offset slot.off
+// which is stored at off % capData inside the data ring (wrapping around its end);
+// the oldest entries are dropped when either ring is full
+#define HISTORY_MAGIC "PWHIST"
+#define HISTORY_VERSION 1
+#define HISTORY_SLOTS 0x10000
+#define HISTORY_DATA 0x400000
+// size of the history file of the old format
+#define LEGACY_SIZE (sizeof(U32) + 0x8000)
+
+struct history_header {
+	char magic[6];
+	U16 version;
+	U32 capSlots;
+	U32 reserved;
+	U64 capData;
+	// entries [first, next) are in the history
+	U64 first, next;
+	// logical offset for the data of the next entry
+	U64 head;
+};
+
+struct history_slot {
+	U64 off;
+	U32 len;
+	U32 reserved;
+};
+
+static struct history_header *header;
+static struct history_slot *slots;
+static char *data;
+static size_t nMap;
+
+// trigram index for the search, it only lives in memory and is built by the
+// first search so the startup does not depend on the size of the history;
+// every trigram has the list of entries containing it
+// in ascending order, entries that were dropped are removed from the front
+// of a list once they make up half of it
+struct gram {
+	// the three bytes and a bit marking the slot as used
+	U32 key;
+	U32 nEntries, capEntries;
+	U64 *entries;
+};
+
+static struct gram *grams;
+static U32 capGrams;
+static U32 nGrams;
+// set once the index covers every entry, new entries are added to it from then on
+static bool indexed;
+// set when the index ran out of memory, the search then scans all entries
+static bool noIndex;
+
+static size_t
+mapsize(void)
+{
+	return sizeof(struct history_header) + sizeof(struct history_slot) * HISTORY_SLOTS + HISTORY_DATA;
+}
+
+static void
+layout(void *map)
+{
+	header = map;
+	slots = (struct history_slot*) (header + 1);
+	data = (char*) (slots + header->capSlots);
+}
+
+static void
+ringread(char *dest, U64 off, U32 n)
+{
+	const U64 at = off % header->capData;
+	const U32 nFirst = MIN((U64) n, header->capData - at);
+
+	memcpy(dest, data + at, nFirst);
+	memcpy(dest + nFirst, data, n - nFirst);
+}
+
+static void
+ringwrite(const char *src, U64 off, U32 n)
+{
+	const U64 at = off % header->capData;
+	const U32 nFirst = MIN((U64) n, header->capData - at);
+
+	memcpy(data + at, src, nFirst);
+	memcpy(data, src + nFirst, n - nFirst);
+}
+
+static U32
+gramkey(const char *str)
+{
+	return 0x1000000 | (U8) str[0] << 16 | (U8) str[1] << 8 | (U8) str[2];
+}
+
+static struct gram *
+gramslot(struct gram *table, U32 cap, U32 key)
+{
+	const U32 mask = cap - 1;
+
+	for(U32 i = (key * 0x9E3779B1) >> 8 & mask; ; i = (i + 1) & mask)
+		if(!table[i].key || table[i].key == key)
+			return table + i;
+}
+
+static void
+freeindex(void)
+{
+	for(U32 i = 0; i < capGrams; i++)
+		free(grams[i].entries);
+	free(grams);
+	grams = NULL;
+	capGrams = 0;
+	nGrams = 0;
+	indexed = false;
+	noIndex = false;
+}
+
+// index of the first entry in the list that is not below i
+static U32
+lowerbound(const struct gram *gram, U64 i)
+{
+	U32 lo = 0, hi = gram->nEntries;
+
+	while(lo < hi)
+	{
+		const U32 mid = lo + (hi - lo) / 2;
+
+		if(gram->entries[mid] < i)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int
+addgram(U32 key, U64 i)
+{
+	struct gram *gram;
+
+	// keep the load factor below one half
+	if((nGrams + 1) * 2 > capGrams)
+	{
+		const U32 cap = MAX(capGrams * 2, 1024);
+		struct gram *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return ERR;
+		for(U32 k = 0; k < capGrams; k++)
+			if(grams[k].key)
+				*gramslot(table, cap, grams[k].key) = grams[k];
+		free(grams);
+		grams = table;
+		capGrams = cap;
+	}
+	gram = gramslot(grams, capGrams, key);
+	if(!gram->key)
+	{
+		gram->key = key;
+		nGrams++;
+	}
+	// a trigram that appears multiple times in an entry is listed once
+	if(gram->nEntries && gram->entries[gram->nEntries - 1] == i)
+		return OK;
+	if(gram->nEntries == gram->capEntries)
+	{
+		U32 nDropped;
+		U64 *entries;
+
+		nDropped = lowerbound(gram, header->first);
+		if(nDropped * 2 >= gram->nEntries && nDropped)
+		{
+			gram->nEntries -= nDropped;
+			memmove(gram->entries, gram->entries + nDropped,
+					sizeof(*gram->entries) * gram->nEntries);
+		}
+		else
+		{
+			const U32 cap = MAX(gram->capEntries * 2, 4);
+
+			entries = realloc(gram->entries, sizeof(*entries) * cap);
+			if(!entries)
+				return ERR;
+			gram->entries = entries;
+			gram->capEntries = cap;
+		}
+	}
+	gram->entries[gram->nEntries++] = i;
+	return OK;
+}
+
+static void
+indexentry(U64 i, const char *entry, U32 nEntry)
+{
+	if(noIndex)
+		return;
+	for(U32 k = 0; k + 3 <= nEntry; k++)
+		if(addgram(gramkey(entry + k), i))
+		{
+			freeindex();
+			noIndex = true;
+			return;
+		}
+}
+
+static void
+buildindex(void)
+{
+	char buf[MAX_INPUT];
+
+	freeindex();
+	for(U64 i = header->first; i < header->next; i++)
+		indexentry(i, buf, history_get(i, buf));
+	indexed = !noIndex;
+}
+
+static bool
+validheader(const struct history_header *hdr, size_t size)
+{
+	return !memcmp(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic)) &&
+		hdr->version == HISTORY_VERSION &&
+		hdr->capSlots && hdr->capData &&
+		size == sizeof(*hdr) + sizeof(struct history_slot) * hdr->capSlots + hdr->capData &&
+		hdr->first <= hdr->next && hdr->next - hdr->first <= hdr->capSlots;
+}
+
+// the old history file is
+// [next][entries...]
+// with a fixed size buffer of null terminated entries
+static void
+importlegacy(const char *old, size_t nOld)
+{
+	U32 next;
+
+	if(nOld < sizeof(next))
+		return;
+	memcpy(&next, old, sizeof(next));
+	next = MIN(next, (U32) (nOld - sizeof(next)));
+	for(U32 i = sizeof(next), end = sizeof(next) + next; i < end; )
+	{
+		const char *const nul = memchr(old + i, 0, end - i);
+		const U32 n = nul ? (U32) (nul - old) - i : end - i;
+
+		if(n)
+			history_add(old + i, n);
+		i += n + 1;
+	}
+}
+
+static void
+reset(void)
+{
+	memcpy(header->magic, HISTORY_MAGIC, sizeof(header->magic));
+	header->version = HISTORY_VERSION;
+	header->capSlots = HISTORY_SLOTS;
+	header->capData = HISTORY_DATA;
+	header->first = 0;
+	header->next = 0;
+	header->head = 0;
+	layout(header);
+}
+
+int
+history_open(const char *path)
+{
+	int fd;
+	struct stat st;
+	struct history_header hdr;
+	char *old = NULL;
+	size_t nOld = 0;
+	bool valid;
+	void *map;
+
+	history_close();
+	fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		goto anonymous;
+	if(fstat(fd, &st))
+		goto err;
+	valid = st.st_size >= (off_t) sizeof(hdr) &&
+		pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		validheader(&hdr, st.st_size);
+	if(valid)
+		nMap = st.st_size;
+	else
+	{
+		// anything else is replaced by an empty history,
+		// the entries of a history of the old format are taken over
+		if(st.st_size && st.st_size <= LEGACY_SIZE)
+		{
+			old = malloc(st.st_size);
+			if(old && pread(fd, old, st.st_size, 0) == st.st_size)
+				nOld = st.st_size;
+		}
+		nMap = mapsize();
+		if(ftruncate(fd, 0) || ftruncate(fd, nMap))
+			goto err;
+	}
+	// the file is only read as far as it is used, so the size of the
+	// history does not matter for the startup
+	map = mmap(NULL, nMap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		free(old);
+		goto anonymous;
+	}
+	header = map;
+	if(valid)
+		layout(map);
+	else
+	{
+		reset();
+		importlegacy(old, nOld);
+		free(old);
+	}
+	return OK;
+err:
+	free(old);
+	close(fd);
+anonymous:
+	// the history still works for this session
+	nMap = mapsize();
+	map = mmap(NULL, nMap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+	{
+		header = NULL;
+		return ERR;
+	}
+	header = map;
+	reset();
+	return ERR;
+}
+
+void
+history_close(void)
+{
+	freeindex();
+	if(header)
+		munmap(header, nMap);
+	header = NULL;
+}
+
+U64
+history_first(void)
+{
+	return header ? header->first : 0;
+}
+
+U64
+history_end(void)
+{
+	return header ? header->next : 0;
+}
+
+U32
+history_get(U64 i, char *buf)
+{
+	const struct history_slot *slot;
+	U32 n;
+
+	if(!header || i < header->first || i >= header->next)
+		return 0;
+	slot = slots + i % header->capSlots;
+	// never trust the file to stay within the buffer
+	n = MIN(slot->len, (U32) MAX_INPUT - 1);
+	ringread(buf, slot->off, n);
+	return n;
+}
+
+void
+history_add(const char *entry, U32 nEntry)
+{
+	struct history_slot *slot;
+
+	if(!header || nEntry > header->capData)
+		return;
+	// drop the oldest entries until both rings have room, every entry is
+	// dropped at most once so this is constant on average
+	while(header->next - header->first == header->capSlots ||
+			(header->next != header->first &&
+			 header->head + nEntry - slots[header->first % header->capSlots].off > header->capData))
+		header->first++;
+	ringwrite(entry, header->head, nEntry);
+	slot = slots + header->next % header->capSlots;
+	slot->off = header->head;
+	slot->len = nEntry;
+	// the entry only becomes part of the history once it is complete
+	header->head += nEntry;
+	if(indexed)
+		indexentry(header->next, entry, nEntry);
+	header->next++;
+}
+
+int
+history_search(const char *pattern, U32 nPattern, U64 *i)
+{
+	char buf[MAX_INPUT];
+	const struct gram *rarest = NULL;
+	U64 end;
+
+	if(!header || !nPattern)
+		return ERR;
+	end = MIN(*i, header->next);
+	if(nPattern >= 3 && !indexed && !noIndex)
+		buildindex();
+	if(nPattern < 3 || noIndex)
+	{
+		for(U64 k = end; k-- > header->first; )
+			if(memmem(buf, history_get(k, buf), pattern, nPattern))
+			{
+				*i = k;
+				return OK;
+			}
+		return ERR;
+	}
+	// only entries listed for every trigram of the pattern can contain it,
+	// so it's enough to check the entries of the rarest one
+	for(U32 k = 0; k + 3 <= nPattern; k++)
+	{
+		const struct gram *gram;
+
+		if(!capGrams)
+			return ERR;
+		gram = gramslot(grams, capGrams, gramkey(pattern + k));
+		if(!gram->key)
+			return ERR;
+		if(!rarest || gram->nEntries < rarest->nEntries)
+			rarest = gram;
+	}
+	for(U32 k = lowerbound(rarest, end); k--; )
+	{
+		const U64 e = rarest->entries[k];
+
+		if(e < header->first)
+			break;
+		if(memmem(buf, history_get(e, buf), pattern, nPattern))
+		{
+			*i = e;
+			return OK;
+		}
+	}
+	return ERR;
+}
@@ -0,0 +1,1036 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// the file is mapped and parsed in one pass, fields point into the mapping
+// unless they contain escapes; the properties are grouped by account in
+// memory so every account is created with a single write at the end
+//
+// CSV has one property per row
+// account,name,value
+// with an optional header row of exactly these names, fields can be quoted
+//
+// JSON is a sequence of objects, optionally inside an array, which are
+// {"account": ..., "name": ..., "value": ...}
+// for a single property (what 'info account' writes in NDJSON mode) or
+// {"account": ..., "properties": {name: value, ...}}
+// for any number of them (what 'export json' writes); other keys are ignored
+//
+// the archive of 'export archive' holds the account data as it is, it is
+// read with the same record parser as the accounts
+
+// an account of the import, the name is in the names buffer
+struct group {
+	U32 hash;
+	U32 offName;
+	U32 nName;
+	U32 nProperties;
+	char *data;
+	size_t nData, capData;
+};
+
+// a property name inside the data of a group
+struct propslot {
+	U32 hash;
+	U32 group;
+	size_t off;
+	U32 nName;
+};
+
+struct importer {
+	struct group *groups;
+	U32 nGroups;
+	size_t capGroups;
+	// open addressing tables with a load factor below one half,
+	// the group table holds the index plus one
+	U32 *groupTable;
+	U32 capGroupTable;
+	struct propslot *props;
+	U32 nProps, capProps;
+	char *names;
+	size_t nNames, capNames;
+	struct import *result;
+};
+
+// strings that had escapes are unescaped into these, one per field
+struct scratch {
+	char *buf;
+	size_t n, cap;
+};
+
+// the buffers hold values, so the old one is wiped instead of realloc
+// leaving a copy behind
+static int
+grow(void **ptr, size_t size, size_t n, size_t *cap)
+{
+	void *p;
+	size_t newCap;
+
+	if(n <= *cap)
+		return OK;
+	newCap = MAX(*cap * 2, MAX(n, (size_t) 64));
+	p = malloc(size * newCap);
+	if(!p)
+		return ERR;
+	if(*ptr)
+	{
+		memcpy(p, *ptr, size * *cap);
+		explicit_bzero(*ptr, size * *cap);
+		free(*ptr);
+	}
+	*ptr = p;
+	*cap = newCap;
+	return OK;
+}
+
+static int
+scratchput(struct scratch *s, const char *str, size_t n)
+{
+	if(grow((void**) &s->buf, 1, s->n + n, &s->cap))
+		return ERR;
+	memcpy(s->buf + s->n, str, n);
+	s->n += n;
+	return OK;
+}
+
+// the same rule the tokenizer has for words, only words can be used as names
+static bool
+isname(const char *str, size_t n)
+{
+	if(!n || n > MAX_NAME || (!isalpha((U8) *str) && *str != '_'))
+		return false;
+	for(size_t i = 1; i < n; i++)
+		if(!isalnum((U8) str[i]) && str[i] != '_')
+			return false;
+	return true;
+}
+
+static struct group *
+groupof(struct importer *imp, const char *name, U32 nName)
+{
+	const U32 hash = hashname(name, nName);
+	U32 mask, i;
+	struct group *g;
+
+	if((imp->nGroups + 1) * 2 > imp->capGroupTable)
+	{
+		const U32 cap = MAX(imp->capGroupTable * 2, 1024);
+		U32 *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return NULL;
+		for(U32 k = 0; k < imp->nGroups; k++)
+		{
+			for(i = imp->groups[k].hash & (cap - 1); table[i]; i = (i + 1) & (cap - 1));
+			table[i] = k + 1;
+		}
+		free(imp->groupTable);
+		imp->groupTable = table;
+		imp->capGroupTable = cap;
+	}
+	mask = imp->capGroupTable - 1;
+	for(i = hash & mask; imp->groupTable[i]; i = (i + 1) & mask)
+	{
+		g = imp->groups + imp->groupTable[i] - 1;
+		if(g->hash == hash && g->nName == nName && !memcmp(imp->names + g->offName, name, nName))
+			return g;
+	}
+	if(grow((void**) &imp->groups, sizeof(*imp->groups), imp->nGroups + 1, &imp->capGroups) ||
+			grow((void**) &imp->names, 1, imp->nNames + nName, &imp->capNames))
+		return NULL;
+	g = imp->groups + imp->nGroups;
+	memset(g, 0, sizeof(*g));
+	g->hash = hash;
+	g->offName = imp->nNames;
+	g->nName = nName;
+	memcpy(imp->names + imp->nNames, name, nName);
+	imp->nNames += nName;
+	imp->groupTable[i] = ++imp->nGroups;
+	return g;
+}
+
+// the names of properties repeat across accounts, so the group has to be
+// mixed into all bits of the hash or linear probing clusters
+static U32
+prophash(const char *name, U32 nName, U32 group)
+{
+	U32 h = hashname(name, nName) ^ group * 0x9E3779B1;
+
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	return h ^ h >> 16;
+}
+
+// registers the name of a new property of the group, errno is EEXIST when the group already has it
+static int
+addprop(struct importer *imp, U32 group, const char *name, U32 nName)
+{
+	const U32 hash = prophash(name, nName, group);
+	const struct group *const g = imp->groups + group;
+	U32 mask, i;
+
+	if((imp->nProps + 1) * 2 > imp->capProps)
+	{
+		const U32 cap = MAX(imp->capProps * 2, 1024);
+		struct propslot *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return ERR;
+		for(U32 k = 0; k < imp->capProps; k++)
+		{
+			if(!imp->props[k].nName)
+				continue;
+			for(i = imp->props[k].hash & (cap - 1); table[i].nName; i = (i + 1) & (cap - 1));
+			table[i] = imp->props[k];
+		}
+		free(imp->props);
+		imp->props = table;
+		imp->capProps = cap;
+	}
+	mask = imp->capProps - 1;
+	for(i = hash & mask; imp->props[i].nName; i = (i + 1) & mask)
+	{
+		const struct propslot *const p = imp->props + i;
+
+		if(p->hash == hash && p->group == group && p->nName == nName &&
+				!memcmp(g->data + p->off, name, nName))
+		{
+			errno = EEXIST;
+			return ERR;
+		}
+	}
+	imp->props[i] = (struct propslot) { hash, group, g->nData, nName };
+	imp->nProps++;
+	return OK;
+}
+
+static struct group *
+addaccount(struct importer *imp, const char *acc, size_t nAcc)
+{
+	if(!isname(acc, nAcc))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	return groupof(imp, acc, nAcc);
+}
+
+static int
+add(struct importer *imp, const char *acc, size_t nAcc, const char *name, size_t nName,
+		const char *value, size_t nValue)
+{
+	struct group *g;
+
+	if(!isname(name, nName))
+	{
+		errno = EINVAL;
+		return ERR;
+	}
+	// the values are stored null terminated
+	if(memchr(value, 0, nValue) || nValue > UINT32_MAX)
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	g = addaccount(imp, acc, nAcc);
+	if(!g || grow((void**) &g->data, 1, g->nData + nName + nValue + 2, &g->capData) ||
+			addprop(imp, g - imp->groups, name, nName))
+		return ERR;
+	memcpy(g->data + g->nData, name, nName);
+	g->nData += nName;
+	g->data[g->nData++] = 0;
+	memcpy(g->data + g->nData, value, nValue);
+	g->nData += nValue;
+	g->data[g->nData++] = 0;
+	g->nProperties++;
+	return OK;
+}
+
+// reads a CSV field and moves past its separator, *rowEnd is set after the last field of a row
+static int
+csvfield(const char **ptr, const char *end, struct scratch *s,
+		const char **field, size_t *nField, bool *rowEnd)
+{
+	const char *p = *ptr;
+
+	if(p < end && *p == '"')
+	{
+		const char *start = ++p;
+		bool escaped = false;
+
+		s->n = 0;
+		while(1)
+		{
+			const char *const quote = memchr(p, '"', end - p);
+
+			if(!quote)
+			{
+				errno = EILSEQ;
+				return ERR;
+			}
+			// a doubled quote stands for one quote
+			if(quote + 1 < end && quote[1] == '"')
+			{
+				if(scratchput(s, start, quote + 1 - start))
+					return ERR;
+				escaped = true;
+				p = start = quote + 2;
+				continue;
+			}
+			if(escaped)
+			{
+				if(scratchput(s, start, quote - start))
+					return ERR;
+				*field = s->buf;
+				*nField = s->n;
+			}
+			else
+			{
+				*field = start;
+				*nField = quote - start;
+			}
+			p = quote + 1;
+			break;
+		}
+		if(p < end && *p != ',' && *p != '\n' && *p != '\r')
+		{
+			errno = EILSEQ;
+			return ERR;
+		}
+	}
+	else
+	{
+		*field = p;
+		while(p < end && *p != ',' && *p != '\n' && *p != '\r')
+			p++;
+		*nField = p - *field;
+	}
+	*rowEnd = p == end || *p != ',';
+	if(p < end && *p == '\r')
+	{
+		p++;
+		if(p < end && *p == '\n')
+			p++;
+	}
+	else if(p < end)
+		p++;
+	*ptr = p;
+	return OK;
+}
+
+static int
+parsecsv(struct importer *imp, const char *data, size_t nData)
+{
+	struct scratch s[3] = { 0 };
+	const char *ptr = data;
+	const char *const end = data + nData;
+	const char *fields[3];
+	size_t nFields[3];
+	bool first = true;
+	int r = OK;
+
+	while(ptr < end)
+	{
+		const char *const row = ptr;
+		bool rowEnd = false;
+		U32 n;
+
+		if(*ptr == '\n' || *ptr == '\r')
+		{
+			ptr++;
+			continue;
+		}
+		for(n = 0; !rowEnd; n++)
+		{
+			const char *field;
+			size_t nField;
+
+			if(csvfield(&ptr, end, s + MIN(n, 2), &field, &nField, &rowEnd))
+			{
+				imp->result->errOff = row - data;
+				r = ERR;
+				goto end;
+			}
+			if(n < 3)
+			{
+				fields[n] = field;
+				nFields[n] = nField;
+			}
+		}
+		if(n != 3)
+		{
+			imp->result->errOff = row - data;
+			errno = EILSEQ;
+			r = ERR;
+			goto end;
+		}
+		if(first && nFields[0] == 7 && !strncasecmp(fields[0], "account", 7) &&
+				nFields[1] == 4 && !strncasecmp(fields[1], "name", 4) &&
+				nFields[2] == 5 && !strncasecmp(fields[2], "value", 5))
+		{
+			first = false;
+			continue;
+		}
+		first = false;
+		if(add(imp, fields[0], nFields[0], fields[1], nFields[1], fields[2], nFields[2]))
+		{
+			imp->result->errOff = row - data;
+			r = ERR;
+			goto end;
+		}
+	}
+end:
+	for(U32 i = 0; i < ARRLEN(s); i++)
+	{
+		if(s[i].buf)
+			explicit_bzero(s[i].buf, s[i].cap);
+		free(s[i].buf);
+	}
+	return r;
+}
+
+struct json {
+	const char *data, *ptr, *end;
+	// all strings of the current object, the spans below are offsets into it
+	struct scratch strings;
+};
+
+// a string of the current object
+struct span {
+	size_t off, n;
+};
+
+static void
+jsonspace(struct json *j)
+{
+	while(j->ptr < j->end && isspace((U8) *j->ptr))
+		j->ptr++;
+}
+
+static void
+pututf8(char *buf, size_t *n, U32 cp)
+{
+	if(cp < 0x80)
+		buf[(*n)++] = cp;
+	else if(cp < 0x800)
+	{
+		buf[(*n)++] = 0xC0 | cp >> 6;
+		buf[(*n)++] = 0x80 | (cp & 0x3F);
+	}
+	else if(cp < 0x10000)
+	{
+		buf[(*n)++] = 0xE0 | cp >> 12;
+		buf[(*n)++] = 0x80 | (cp >> 6 & 0x3F);
+		buf[(*n)++] = 0x80 | (cp & 0x3F);
+	}
+	else
+	{
+		buf[(*n)++] = 0xF0 | cp >> 18;
+		buf[(*n)++] = 0x80 | (cp >> 12 & 0x3F);
+		buf[(*n)++] = 0x80 | (cp >> 6 & 0x3F);
+		buf[(*n)++] = 0x80 | (cp & 0x3F);
+	}
+}
+
+static int
+hex4(const char *p, U32 *cp)
+{
+	*cp = 0;
+	for(U32 i = 0; i < 4; i++)
+	{
+		const int ch = tolower((U8) p[i]);
+
+		if(!isxdigit(ch))
+			return ERR;
+		*cp = *cp << 4 | (isdigit(ch) ? ch - '0' : ch - 'a' + 10);
+	}
+	return OK;
+}
+
+// reads a string into the strings of the object
+static int
+jsonstring(struct json *j, struct span *span)
+{
+	struct scratch *const s = &j->strings;
+	const char *start;
+
+	if(j->ptr == j->end || *j->ptr != '"')
+		return ERR;
+	start = ++j->ptr;
+	span->off = s->n;
+	while(1)
+	{
+		const char *p = start;
+		char esc[4];
+		size_t nEsc = 0;
+
+		while(p < j->end && *p != '"' && *p != '\\')
+			p++;
+		if(p == j->end || scratchput(s, start, p - start))
+			return ERR;
+		if(*p == '"')
+		{
+			j->ptr = p + 1;
+			break;
+		}
+		if(++p == j->end)
+			return ERR;
+		switch(*p)
+		{
+		case '"': case '\\': case '/': esc[nEsc++] = *p; break;
+		case 'b': esc[nEsc++] = '\b'; break;
+		case 'f': esc[nEsc++] = '\f'; break;
+		case 'n': esc[nEsc++] = '\n'; break;
+		case 'r': esc[nEsc++] = '\r'; break;
+		case 't': esc[nEsc++] = '\t'; break;
+		case 'u':
+		{
+			U32 cp, low;
+
+			if(j->end - p < 5 || hex4(p + 1, &cp))
+				return ERR;
+			p += 4;
+			// a surrogate pair encodes a code point above the basic plane
+			if(cp >= 0xD800 && cp < 0xDC00)
+			{
+				if(j->end - p < 7 || p[1] != '\\' || p[2] != 'u' || hex4(p + 3, &low) ||
+						low < 0xDC00 || low >= 0xE000)
+					return ERR;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				p += 6;
+			}
+			pututf8(esc, &nEsc, cp);
+			break;
+		}
+		default:
+			return ERR;
+		}
+		if(scratchput(s, esc, nEsc))
+			return ERR;
+		start = p + 1;
+	}
+	span->n = s->n - span->off;
+	return OK;
+}
+
+// numbers, booleans and null are taken as they are written
+static int
+jsonliteral(struct json *j, struct span *span)
+{
+	const char *const start = j->ptr;
+
+	while(j->ptr < j->end && (isalnum((U8) *j->ptr) || *j->ptr == '-' ||
+				*j->ptr == '+' || *j->ptr == '.'))
+		j->ptr++;
+	if(j->ptr == start)
+		return ERR;
+	span->off = j->strings.n;
+	span->n = j->ptr - start;
+	return scratchput(&j->strings, start, span->n);
+}
+
+static int
+jsonscalar(struct json *j, struct span *span)
+{
+	return j->ptr < j->end && *j->ptr == '"' ? jsonstring(j, span) : jsonliteral(j, span);
+}
+
+// skips a value of any kind
+static int
+jsonskip(struct json *j)
+{
+	struct span span;
+	char close;
+
+	jsonspace(j);
+	if(j->ptr == j->end)
+		return ERR;
+	if(*j->ptr != '{' && *j->ptr != '[')
+		return jsonscalar(j, &span);
+	close = *j->ptr == '{' ? '}' : ']';
+	j->ptr++;
+	jsonspace(j);
+	if(j->ptr < j->end && *j->ptr == close)
+	{
+		j->ptr++;
+		return OK;
+	}
+	while(1)
+	{
+		if(close == '}')
+		{
+			jsonspace(j);
+			if(jsonstring(j, &span))
+				return ERR;
+			jsonspace(j);
+			if(j->ptr == j->end || *j->ptr++ != ':')
+				return ERR;
+		}
+		if(jsonskip(j))
+			return ERR;
+		jsonspace(j);
+		if(j->ptr == j->end)
+			return ERR;
+		if(*j->ptr == close)
+		{
+			j->ptr++;
+			return OK;
+		}
+		if(*j->ptr++ != ',')
+			return ERR;
+	}
+}
+
+static bool
+iskey(const struct json *j, const struct span *key, const char *name)
+{
+	const size_t n = strlen(name);
+
+	return key->n == n && !memcmp(j->strings.buf + key->off, name, n);
+}
+
+// reads the pairs of an object into the spans, the spans array grows as needed
+static int
+jsonpairs(struct json *j, struct span **pairs, size_t *nPairs, size_t *capPairs)
+{
+	if(j->ptr == j->end || *j->ptr++ != '{')
+		return ERR;
+	jsonspace(j);
+	if(j->ptr < j->end && *j->ptr == '}')
+	{
+		j->ptr++;
+		return OK;
+	}
+	while(1)
+	{
+		struct span key, value;
+
+		jsonspace(j);
+		if(jsonstring(j, &key))
+			return ERR;
+		jsonspace(j);
+		if(j->ptr == j->end || *j->ptr++ != ':')
+			return ERR;
+		jsonspace(j);
+		if(j->ptr < j->end && (*j->ptr == '{' || *j->ptr == '['))
+			return ERR;
+		if(jsonscalar(j, &value) ||
+				grow((void**) pairs, sizeof(**pairs), *nPairs + 2, capPairs))
+			return ERR;
+		(*pairs)[(*nPairs)++] = key;
+		(*pairs)[(*nPairs)++] = value;
+		jsonspace(j);
+		if(j->ptr == j->end)
+			return ERR;
+		if(*j->ptr == '}')
+		{
+			j->ptr++;
+			return OK;
+		}
+		if(*j->ptr++ != ',')
+			return ERR;
+	}
+}
+
+static int
+jsonobject(struct importer *imp, struct json *j, struct span **props, size_t *capProps)
+{
+	struct span key, account = { 0 }, name = { 0 }, value = { 0 };
+	bool hasAccount = false, hasName = false, hasValue = false, hasProperties = false;
+	size_t nProps = 0;
+	const char *str;
+
+	j->strings.n = 0;
+	if(j->ptr == j->end || *j->ptr++ != '{')
+		return ERR;
+	jsonspace(j);
+	if(j->ptr < j->end && *j->ptr == '}')
+		return ERR;
+	while(1)
+	{
+		jsonspace(j);
+		if(jsonstring(j, &key))
+			return ERR;
+		jsonspace(j);
+		if(j->ptr == j->end || *j->ptr++ != ':')
+			return ERR;
+		jsonspace(j);
+		if(iskey(j, &key, "properties"))
+		{
+			if(jsonpairs(j, props, &nProps, capProps))
+				return ERR;
+			hasProperties = true;
+		}
+		else if(iskey(j, &key, "account") || iskey(j, &key, "name") || iskey(j, &key, "value"))
+		{
+			struct span *const dest = iskey(j, &key, "account") ? &account :
+				iskey(j, &key, "name") ? &name : &value;
+
+			if(jsonscalar(j, dest))
+				return ERR;
+			if(dest == &account)
+				hasAccount = true;
+			else if(dest == &name)
+				hasName = true;
+			else
+				hasValue = true;
+		}
+		else if(jsonskip(j))
+			return ERR;
+		jsonspace(j);
+		if(j->ptr == j->end)
+			return ERR;
+		if(*j->ptr == '}')
+		{
+			j->ptr++;
+			break;
+		}
+		if(*j->ptr++ != ',')
+			return ERR;
+	}
+	// the strings don't move anymore once the object is read
+	str = j->strings.buf;
+	if(!hasAccount || hasName != hasValue || (!hasName && !hasProperties))
+	{
+		errno = ENODATA;
+		return ERR;
+	}
+	// an empty object of properties stands for an account without any
+	if(!hasName && !nProps)
+		return addaccount(imp, str + account.off, account.n) ? OK : ERR;
+	if(hasName && add(imp, str + account.off, account.n, str + name.off, name.n,
+				str + value.off, value.n))
+		return ERR;
+	for(size_t i = 0; i < nProps; i += 2)
+		if(add(imp, str + account.off, account.n, str + (*props)[i].off, (*props)[i].n,
+					str + (*props)[i + 1].off, (*props)[i + 1].n))
+			return ERR;
+	return OK;
+}
+
+static int
+parsejson(struct importer *imp, const char *data, size_t nData)
+{
+	struct json j = { data, data, data + nData, { 0 } };
+	struct span *props = NULL;
+	size_t capProps = 0;
+	bool inArray = false;
+	int r = OK;
+
+	jsonspace(&j);
+	if(j.ptr < j.end && *j.ptr == '[')
+	{
+		inArray = true;
+		j.ptr++;
+	}
+	while(1)
+	{
+		const char *obj;
+
+		jsonspace(&j);
+		// objects are separated by commas inside the array and by new lines outside of it
+		if(j.ptr < j.end && *j.ptr == ',')
+		{
+			j.ptr++;
+			jsonspace(&j);
+		}
+		if(j.ptr == j.end)
+		{
+			if(inArray)
+				goto err;
+			break;
+		}
+		if(inArray && *j.ptr == ']')
+		{
+			j.ptr++;
+			jsonspace(&j);
+			if(j.ptr != j.end)
+				goto err;
+			break;
+		}
+		obj = j.ptr;
+		errno = EILSEQ;
+		if(jsonobject(imp, &j, &props, &capProps))
+		{
+			j.ptr = obj;
+			goto err;
+		}
+	}
+	goto end;
+err:
+	imp->result->errOff = j.ptr - data;
+	r = ERR;
+end:
+	if(j.strings.buf)
+		explicit_bzero(j.strings.buf, j.strings.cap);
+	free(j.strings.buf);
+	free(props);
+	return r;
+}
+
+static int
+parsearchive(struct importer *imp, const char *data, size_t nData)
+{
+	size_t pos = sizeof(EXPORT_MAGIC) - 1;
+
+	while(1)
+	{
+		U32 nName, nAcc;
+		const char *name;
+		struct account acc = { 0 };
+		struct record rec;
+		int r;
+
+		imp->result->errOff = pos;
+		if(nData - pos < sizeof(nName))
+			goto corrupt;
+		memcpy(&nName, data + pos, sizeof(nName));
+		pos += sizeof(nName);
+		if(!nName)
+			return OK;
+		if(nData - pos < (U64) nName + sizeof(nAcc))
+			goto corrupt;
+		name = data + pos;
+		pos += nName;
+		memcpy(&nAcc, data + pos, sizeof(nAcc));
+		pos += sizeof(nAcc);
+		if(nData - pos < nAcc)
+			goto corrupt;
+		acc.data = data + pos;
+		acc.nData = nAcc;
+		pos += nAcc;
+		if(crypt_isencrypted(acc.data, acc.nData))
+		{
+			char *plain;
+			size_t nPlain;
+
+			if(crypt_decrypt(name, nName, acc.data, acc.nData, &plain, &nPlain))
+				return ERR;
+			acc.data = acc.plain = plain;
+			acc.nData = nPlain;
+		}
+		if(!addaccount(imp, name, nName))
+			r = ERR;
+		else
+			while((r = account_next(&acc, &rec)) == 1)
+				if(add(imp, name, nName, rec.name, rec.nName, rec.value, rec.nValue))
+				{
+					r = ERR;
+					break;
+				}
+		secure_free(acc.plain, MAX(acc.nData, 1));
+		if(r)
+			return ERR;
+	}
+corrupt:
+	errno = EILSEQ;
+	return ERR;
+}
+
+static void
+freeimporter(struct importer *imp)
+{
+	for(U32 i = 0; i < imp->nGroups; i++)
+	{
+		if(imp->groups[i].data)
+			explicit_bzero(imp->groups[i].data, imp->groups[i].capData);
+		free(imp->groups[i].data);
+	}
+	free(imp->groups);
+	free(imp->groupTable);
+	free(imp->props);
+	free(imp->names);
+}
+
+int
+import_file(const char *path, struct import *result)
+{
+	int fd;
+	struct stat st;
+	char *map = NULL;
+	struct importer imp;
+	const char *p;
+	bool archive;
+	int r;
+
+	memset(result, 0, sizeof(*result));
+	memset(&imp, 0, sizeof(imp));
+	imp.result = result;
+	fd = open(path, O_RDONLY);
+	if(fd == ERR)
+		return ERR;
+	if(fstat(fd, &st))
+	{
+		close(fd);
+		return ERR;
+	}
+	if(st.st_size)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED)
+		{
+			close(fd);
+			return ERR;
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	archive = (size_t) st.st_size >= sizeof(EXPORT_MAGIC) - 1 &&
+		!memcmp(map, EXPORT_MAGIC, sizeof(EXPORT_MAGIC) - 1);
+	for(p = map; p < map + st.st_size && isspace((U8) *p); p++);
+	r = archive ? parsearchive(&imp, map, st.st_size) :
+		p < map + st.st_size && (*p == '{' || *p == '[') ?
+		parsejson(&imp, map, st.st_size) : parsecsv(&imp, map, st.st_size);
+	if(r && archive)
+		goto end;
+	if(r)
+	{
+		// the line of the error is more useful than its offset
+		result->errLine = 1;
+		for(size_t i = 0; i < result->errOff; i++)
+			result->errLine += map[i] == '\n';
+		goto end;
+	}
+	// inserting into the sorted names one by one would be quadratic,
+	// they are loaded again on the next use instead
+	names_invalidate();
+	journal_begin(BACKUP_ENTRY_IMPORT);
+	journal_field(NULL, 0);
+	for(U32 i = 0; i < imp.nGroups; i++)
+	{
+		const struct group *const g = imp.groups + i;
+		const char *const name = imp.names + g->offName;
+		const U32 nData = g->nData;
+
+		// existing accounts are left as they are
+		if(account_create(name, g->nName, g->data, g->nData))
+		{
+			if(errno != EEXIST)
+			{
+				memcpy(result->errAccount, name, g->nName);
+				result->nErrAccount = g->nName;
+				r = ERR;
+				break;
+			}
+			result->nSkipped++;
+			continue;
+		}
+		result->nAccounts++;
+		result->nProperties += g->nProperties;
+		journal_append(&g->nName, sizeof(g->nName));
+		journal_append(name, g->nName);
+		journal_append(&nData, sizeof(nData));
+		journal_append(g->data, g->nData);
+	}
+end:
+	if(map)
+		munmap(map, st.st_size);
+	freeimporter(&imp);
+	return r;
+}
+
+// calls proc for every account of an import entry
+static int
+foreachimported(const char *data, size_t nData,
+		int (*proc)(const char *name, U32 nName, const char *accData, U32 nAccData, void *arg),
+		void *arg)
+{
+	size_t pos = 0;
+
+	while(pos < nData)
+	{
+		U32 nName, nAccData;
+		const char *name;
+
+		if(nData - pos < sizeof(nName))
+			goto corrupt;
+		memcpy(&nName, data + pos, sizeof(nName));
+		pos += sizeof(nName);
+		if(nData - pos < nName + sizeof(nAccData))
+			goto corrupt;
+		name = data + pos;
+		pos += nName;
+		memcpy(&nAccData, data + pos, sizeof(nAccData));
+		pos += sizeof(nAccData);
+		if(nData - pos < nAccData)
+			goto corrupt;
+		if(proc && proc(name, nName, data + pos, nAccData, arg))
+			return ERR;
+		pos += nAccData;
+	}
+	return OK;
+corrupt:
+	errno = EILSEQ;
+	return ERR;
+}
+
+static int
+countone(const char *name, U32 nName, const char *accData, U32 nAccData, void *arg)
+{
+	(*(U32*) arg)++;
+	return 0;
+}
+
+U32
+import_count(const char *data, size_t nData)
+{
+	U32 n = 0;
+
+	return foreachimported(data, nData, countone, &n) ? 0 : n;
+}
+
+// an account is only removed when it is still what was imported
+static int
+checkone(const char *name, U32 nName, const char *accData, U32 nAccData, void *arg)
+{
+	struct account acc;
+	bool same;
+
+	if(account_open(name, nName, &acc))
+		return errno == ENOENT ? 0 : ERR;
+	same = acc.nData == nAccData && !memcmp(acc.data, accData, nAccData);
+	account_close(&acc);
+	if(!same)
+	{
+		errno = ENOTEMPTY;
+		return ERR;
+	}
+	return 0;
+}
+
+static int
+removeone(const char *name, U32 nName, const char *accData, U32 nAccData, void *arg)
+{
+	return account_delete(name, nName) && errno != ENOENT ? ERR : 0;
+}
+
+static int
+createone(const char *name, U32 nName, const char *accData, U32 nAccData, void *arg)
+{
+	return account_create(name, nName, accData, nAccData) ? ERR : 0;
+}
+
+int
+import_undo(const char *data, size_t nData)
+{
+	if(foreachimported(data, nData, checkone, NULL))
+		return ERR;
+	return foreachimported(data, nData, removeone, NULL);
+}
+
+int
+import_redo(const char *data, size_t nData)
+{
+	// checked first so a corrupt entry doesn't leave half of the accounts behind
+	if(foreachimported(data, nData, NULL, NULL))
+		return ERR;
+	names_invalidate();
+	return foreachimported(data, nData, createone, NULL);
+}
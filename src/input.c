@@ -1,117 +1,395 @@
 #include "pwmgr.h"
 
-int
-renderinput(struct input *input, U32 iBuf, U32 nBuf)
+// screen cell (y * width + x) of every byte of the input, drawing resumes at
+// the cell of the first changed byte and the cursor is placed with it
+static U32 cellAt[MAX_INPUT + 1];
+static int cellWidth;
+
+static void
+drawrange(struct input *input, U32 from, U32 to, int attr)
+{
+	const char *const buf = input->buf;
+	int y, x;
+
+	wattrset(input->win, attr);
+	while(from < to)
+	{
+		U32 n = 1;
+
+		getyx(input->win, y, x);
+		cellAt[from] = y * cellWidth + x;
+		while(from + n < to && (buf[from + n] & 0xC0) == 0x80)
+		{
+			cellAt[from + n] = cellAt[from];
+			n++;
+		}
+		waddnstr(input->win, buf + from, n);
+		from += n;
+	}
+}
+
+static void
+movetocell(struct input *input, U32 i)
+{
+	wmove(input->win, cellAt[i] / cellWidth, cellAt[i] % cellWidth);
+}
+
+// tokenizes and draws the input from the byte at from onwards,
+// everything before it is still on the screen from the last call
+static int
+renderinput(struct input *input, U32 from, U32 nBuf)
 {
-	int cy, cx;
 	int err;
-	TOKEN *last = NULL;
-	U32 tokenLen;
-
-	// measure cursor position
-	mvwaddnstr(input->win, 0, 0, input->buf, iBuf);
-	getyx(input->win, cy, cx);
-	// erase input
-	werase(input->win);
+	U32 i, at;
+	int y, x;
+
+	if(cellWidth != getmaxx(input->win))
+	{
+		cellWidth = getmaxx(input->win);
+		from = 0;
+	}
 	input->buf[nBuf] = 0;
-	err = tokenize(input);
-	for(U32 i = 0, nTokens = input->nTokens; i < nTokens; i++)
+	err = retokenize(input, &from);
+	movetocell(input, from);
+	wclrtobot(input->win);
+	for(i = input->nTokens; i && input->tokens[i - 1].pos >= from; i--);
+	at = from;
+	for(; i < input->nTokens; i++)
 	{
 		TOKEN *tok;
+		int attr;
 
 		tok = input->tokens + i;
-		if(last)
-		{
-			wattrset(input->win, ATTR_DEFAULT);
-			waddnstr(input->win, input->buf + last->pos + tokenLen, tok->pos - last->pos - tokenLen);
-		}
+		drawrange(input, at, tok->pos, ATTR_DEFAULT);
 		switch(tok->type)
 		{
-		case TWORD: wattrset(input->win, ATTR_SYNTAX_WORD); break;
-		case TSTRING: wattrset(input->win, ATTR_SYNTAX_STRING); break;
+		case TWORD: attr = ATTR_SYNTAX_WORD; break;
+		case TSTRING: attr = ATTR_SYNTAX_STRING; break;
 		default:
-			wattrset(input->win, ATTR_SYNTAX_KEYWORD);
+			attr = ATTR_SYNTAX_KEYWORD;
 		}
-		tokenLen = gettokenlen(input, i);
-		waddnstr(input->win, input->buf + tok->pos, tokenLen);
-		last = tok;
+		at = tok->pos + gettokenlen(input, i);
+		drawrange(input, tok->pos, at, attr);
 	}
 	if(err)
 	{
-		U32 pos;
+		const U32 pos = MAX(input->errPos, at);
 
-		pos = input->errPos;
-		if(last)
+		drawrange(input, at, pos, ATTR_DEFAULT);
+		drawrange(input, pos, nBuf, ATTR_ERROR);
+		at = nBuf;
+	}
+	drawrange(input, at, nBuf, ATTR_DEFAULT);
+	getyx(input->win, y, x);
+	cellAt[nBuf] = y * cellWidth + x;
+	return err;
+}
+
+#define IS_INSERTABLE(ch, isUtf8) ((ch) >= 0x20 && (((ch) <= 0xFF && (isUtf8)) || (ch) < 0x7F))
+#define KEY_CTRL(ch) ((ch) & 0x1F)
+
+// reverse incremental search through the history, the prompt replaces the
+// input until the search ends; keys that end the search are handled by the
+// caller, returns the entry that was put into the input or history_end()
+static U64
+searchhistory(struct input *input, U32 *nBuf, bool isUtf8)
+{
+	const U64 end = history_end();
+	char *const pattern = secure_alloc(MAX_INPUT);
+	char *const match = secure_alloc(MAX_INPUT);
+	U32 nPattern = 0, nMatch = 0;
+	U64 cur = end;
+	bool failed = false;
+
+	if(!pattern || !match)
+		return end;
+	while(1)
+	{
+		int ch;
+		int y, x;
+		U64 i;
+
+		werase(input->win);
+		wattrset(input->win, ATTR_LOG);
+		waddstr(input->win, failed ? "(failed reverse-i-search)'" : "(reverse-i-search)'");
+		waddnstr(input->win, pattern, nPattern);
+		waddstr(input->win, "': ");
+		getyx(input->win, y, x);
+		wattrset(input->win, ATTR_DEFAULT);
+		waddnstr(input->win, match, nMatch);
+		wmove(input->win, y, x);
+		ch = wgetch(input->win);
+		if(ch == ERR)
+			continue;
+		if(IS_INSERTABLE(ch, isUtf8))
+		{
+			// the current match is kept while it still contains the pattern
+			i = cur == end ? end : cur + 1;
+			if(nPattern + 1 < MAX_INPUT)
+				pattern[nPattern++] = ch;
+			// wait for the rest of a multi byte character
+			for(U32 mask = 0x40; (ch & 0x80) && (ch & mask) && nPattern + 1 < MAX_INPUT; mask >>= 1)
+				pattern[nPattern++] = wgetch(input->win);
+		}
+		else if(ch == KEY_CTRL('R'))
+		{
+			if(!nPattern)
+				continue;
+			i = cur;
+		}
+		else if(ch == KEY_BACKSPACE || ch == 0x7F || ch == '\b')
+		{
+			while(nPattern && (pattern[--nPattern] & 0xC0) == 0x80);
+			i = end;
+			if(!nPattern)
+			{
+				cur = end;
+				nMatch = 0;
+				failed = false;
+				continue;
+			}
+		}
+		else if(ch == 0x1B || ch == KEY_CTRL('G'))
 		{
-			wattrset(input->win, ATTR_DEFAULT);
-			waddnstr(input->win, input->buf + last->pos + tokenLen, pos - last->pos - tokenLen);
+			cur = end;
+			break;
+		}
+		else
+		{
+			if(cur != end)
+			{
+				memcpy(input->buf, match, nMatch);
+				*nBuf = nMatch;
+			}
+			ungetch(ch);
+			break;
+		}
+		failed = history_search(pattern, nPattern, &i) != OK;
+		if(!failed)
+		{
+			cur = i;
+			nMatch = history_get(cur, match);
 		}
-		wattrset(input->win, ATTR_ERROR);
-		waddnstr(input->win, input->buf + pos, nBuf - pos);
 	}
-	wmove(input->win, cy, cx);
-	return err;
+	secure_free(match, MAX_INPUT);
+	secure_free(pattern, MAX_INPUT);
+	return cur;
+}
+
+// number of candidates that are listed when a word can't be completed further
+#define MAX_CANDIDATES 50
+
+// completes the word before the cursor with a subnode of the branch the input
+// leads to or with an account name, returns the first byte that changed
+static U32
+completeword(struct input *input, U32 *iBuf, U32 *nBuf)
+{
+	char *const buf = input->buf;
+	const struct branch *branch;
+	bool isValue;
+	U32 start, iToken;
+	const char *subs[64];
+	U32 nCands = 0, first = 0;
+	const char *common, *last;
+	U32 nCommon, nLast;
+
+	start = *iBuf;
+	while(start && (isalnum(buf[start - 1]) || buf[start - 1] == '_'))
+		start--;
+	if(start && buf[start - 1] == '$')
+		return UINT32_MAX;
+	for(iToken = 0; iToken < input->nTokens && input->tokens[iToken].pos < start; iToken++);
+	branch = completebranch(input, iToken, &isValue);
+	input->iToken = 0;
+	if(!branch)
+		return UINT32_MAX;
+	if(isValue)
+	{
+		if(!branch->dependency->account)
+			return UINT32_MAX;
+		nCands = names_prefix(buf + start, *iBuf - start, &first);
+		if(!nCands)
+		{
+			beep();
+			return UINT32_MAX;
+		}
+		// the names are sorted so the first and last one share the prefix of all
+		last = names_get(first + nCands - 1, &nLast);
+		common = names_get(first, &nCommon);
+		nCommon = MIN(nCommon, nLast);
+		for(U32 i = *iBuf - start; i < nCommon; i++)
+			if(common[i] != last[i])
+				nCommon = i;
+	}
+	else
+	{
+		if(IS_EXEC_BRANCH(branch))
+			return UINT32_MAX;
+		for(U32 i = 0; i < branch->nSubnodes && nCands < ARRLEN(subs); i++)
+		{
+			const char *const name = branch->subnodes[i].name;
+
+			if(!strncmp(name, buf + start, *iBuf - start))
+				subs[nCands++] = name;
+		}
+		if(!nCands)
+		{
+			beep();
+			return UINT32_MAX;
+		}
+		common = subs[0];
+		nCommon = strlen(common);
+		for(U32 c = 1; c < nCands; c++)
+			for(U32 i = *iBuf - start; i < nCommon; i++)
+				if(common[i] != subs[c][i])
+					nCommon = i;
+	}
+	if(nCommon > *iBuf - start || nCands == 1)
+	{
+		const U32 from = *iBuf;
+		const U32 nAdd = nCommon - (*iBuf - start);
+		// a complete word is followed by a space
+		const U32 nSpace = nCands == 1 && (*iBuf == *nBuf || buf[*iBuf] != ' ');
+
+		if(*nBuf + nAdd + nSpace >= MAX_INPUT)
+			return UINT32_MAX;
+		memmove(buf + *iBuf + nAdd + nSpace, buf + *iBuf, *nBuf - *iBuf);
+		memcpy(buf + *iBuf, common + nCommon - nAdd, nAdd);
+		if(nSpace)
+			buf[*iBuf + nAdd] = ' ';
+		*nBuf += nAdd + nSpace;
+		// the cursor goes behind the space, also when it was already there
+		*iBuf += nAdd + (nCands == 1);
+		return from;
+	}
+	outattr(ATTR_LOG);
+	for(U32 c = 0; c < MIN(nCands, (U32) MAX_CANDIDATES); c++)
+	{
+		const char *name;
+		U32 nName;
+
+		if(isValue)
+			name = names_get(first + c, &nName);
+		else
+		{
+			name = subs[c];
+			nName = strlen(name);
+		}
+		outprintf("\n\t%.*s", nName, name);
+	}
+	if(nCands > MAX_CANDIDATES)
+		outprintf("\n\t...and %u more", nCands - MAX_CANDIDATES);
+	setoutpage(0);
+	return UINT32_MAX;
 }
 
 int
 getinput(struct input *input, bool isUtf8)
 {
 	char *buf;
-	char saveBuf[MAX_INPUT];
+	char *saveBuf, *ins;
 	U32 iBuf, nBuf;
-	char *history;
-	U32 nextHistory;
-	I32 overflowHistory;
-	U32 curHistory;
-	U32 lastHistory;
+	U64 endHistory;
+	U64 curHistory;
 	int tokErr;
+	// first byte that changed since the input was last drawn
+	U32 damage = 0;
 
 	input->nBuf = 0;
+	// the line being edited may be a secret, so everything it's copied to is secure memory
+	saveBuf = secure_alloc(MAX_INPUT);
+	ins = secure_alloc(MAX_INPUT);
+	if(!saveBuf || !ins)
+		return ERR;
 	buf = input->buf;
 	iBuf = 0;
 	nBuf = 0;
-	history = input->history;
-	nextHistory = input->nextHistory;
-	curHistory = nextHistory;
+	endHistory = history_end();
+	curHistory = endHistory;
 	while(1)
 	{
 		int ch;
+		U32 nIns = 0;
 
-		tokErr = renderinput(input, iBuf, nBuf);
+		if(damage <= nBuf)
+		{
+			tokErr = renderinput(input, damage, nBuf);
+			damage = UINT32_MAX;
+		}
+		movetocell(input, iBuf);
+		// wake up to sync the backup when it has entries that are due
+		wtimeout(input->win, journal_idle());
 		ch = wgetch(input->win);
+		wtimeout(input->win, -1);
+		if(ch == ERR)
+			continue;
 		if(ch == '\n')
 		{
 			wclear(input->win);
 			break;
 		}
-		if(ch >= 0x20 && ((ch <= 0xFF && isUtf8) || ch < 0x7F))
+		if(IS_INSERTABLE(ch, isUtf8))
 		{
-			char bUtf8[12];
-			U32 nUtf8 = 1;
-			U32 headUtf8 = ch;
-
-			bUtf8[0] = ch;
-			if(headUtf8 & 0x80)
+			// characters that are already waiting, like the rest of a paste,
+			// are inserted together and drawn once
+			do
 			{
-				U32 mask;
+				char bUtf8[12];
+				U32 nUtf8 = 1;
+				U32 headUtf8 = ch;
 
-				mask = 0x80 >> 1;
-				while(headUtf8 & mask)
+				bUtf8[0] = ch;
+				if(headUtf8 & 0x80)
 				{
-					mask >>= 1;
-					bUtf8[nUtf8++] = wgetch(input->win);
+					U32 mask;
+
+					mask = 0x80 >> 1;
+					while(headUtf8 & mask)
+					{
+						mask >>= 1;
+						bUtf8[nUtf8++] = wgetch(input->win);
+					}
+				}
+				if(nBuf + nIns + nUtf8 < MAX_INPUT)
+				{
+					memcpy(ins + nIns, bUtf8, nUtf8);
+					nIns += nUtf8;
 				}
+				wtimeout(input->win, 0);
+				ch = wgetch(input->win);
+				wtimeout(input->win, -1);
 			}
-			if(nBuf + nUtf8 >= MAX_INPUT)
-				continue;
-			memmove(buf + iBuf + nUtf8, buf + iBuf, nBuf - iBuf);
-			memcpy(buf + iBuf, bUtf8, nUtf8);
-			iBuf += nUtf8;
-			nBuf += nUtf8;
+			while(ch != ERR && IS_INSERTABLE(ch, isUtf8));
+			if(ch != ERR)
+				ungetch(ch);
+			ch = ERR;
+		}
+		else if(ch == KEY_PASTE_BEGIN)
+		{
+			// the whole paste is inserted at once, line breaks and other
+			// control characters become spaces so they don't run the command
+			while((ch = wgetch(input->win)) != KEY_PASTE_END && ch != ERR)
+			{
+				if(ch > 0xFF || nBuf + nIns + 1 >= MAX_INPUT)
+					continue;
+				ins[nIns++] = ch < 0x20 || ch == 0x7F ? ' ' : ch;
+			}
+			ch = ERR;
+		}
+		if(nIns)
+		{
+			memmove(buf + iBuf + nIns, buf + iBuf, nBuf - iBuf);
+			memcpy(buf + iBuf, ins, nIns);
+			damage = MIN(damage, iBuf);
+			iBuf += nIns;
+			nBuf += nIns;
 			// this is so the save buf can be updated at the next call of up
-			curHistory = nextHistory;
+			curHistory = endHistory;
 			continue;
 		}
+		// the keys were inserted or dropped because the input is full
+		if(ch == ERR)
+			continue;
 		switch(ch)
 		{
 		case KEY_PPAGE:
@@ -155,6 +433,7 @@ getinput(struct input *input, bool isUtf8)
 				}
 				nBuf -= nRem;
 				memmove(buf + iBuf, buf + iBuf + nRem, nBuf - iBuf);
+				damage = MIN(damage, iBuf);
 			}
 			break;
 		case KEY_DC:
@@ -166,43 +445,55 @@ getinput(struct input *input, bool isUtf8)
 					nRem++;
 				nBuf -= nRem;
 				memmove(buf + iBuf, buf + iBuf + nRem, nBuf - iBuf);
+				damage = MIN(damage, iBuf);
 			}
 			break;
 		case KEY_UP:
-			if(curHistory)
+			if(curHistory > history_first())
 			{
-				if(curHistory == nextHistory)
+				if(curHistory == endHistory)
 				{
 					memcpy(saveBuf, buf, nBuf);
 					saveBuf[nBuf] = 0;
 				}
-				curHistory -= 2;
-				while(curHistory && history[curHistory])
-					curHistory--;
-				if(curHistory)
-					curHistory++;
-				strcpy(buf, history + curHistory);
-				iBuf = nBuf = strlen(buf);
+				curHistory--;
+				iBuf = nBuf = history_get(curHistory, buf);
+				damage = 0;
 			}
 			break;
 		case KEY_DOWN:
-		{
-			U32 l = 0;
-
-			l = strlen(history + curHistory);
-			if(l)
+			if(curHistory < endHistory)
 			{
-				curHistory += l + 1;
-				l = strlen(history + curHistory);
-				if(l)
+				curHistory++;
+				if(curHistory == endHistory)
 				{
-					strcpy(buf, history + curHistory);
-					iBuf = nBuf = l;
-					break;
+					iBuf = nBuf = strlen(saveBuf);
+					memcpy(buf, saveBuf, nBuf);
 				}
+				else
+					iBuf = nBuf = history_get(curHistory, buf);
+				damage = 0;
 			}
-			iBuf = nBuf = strlen(saveBuf);
-			memcpy(buf, saveBuf, nBuf);
+			break;
+		case '\t':
+			damage = MIN(damage, completeword(input, &iBuf, &nBuf));
+			curHistory = endHistory;
+			break;
+		case KEY_CTRL('R'):
+		{
+			U64 found;
+
+			if(curHistory == endHistory)
+			{
+				memcpy(saveBuf, buf, nBuf);
+				saveBuf[nBuf] = 0;
+			}
+			found = searchhistory(input, &nBuf, isUtf8);
+			// up and down continue from the entry that was found
+			if(found != endHistory)
+				curHistory = found;
+			iBuf = nBuf;
+			damage = 0;
 			break;
 		}
 		}
@@ -211,27 +502,13 @@ getinput(struct input *input, bool isUtf8)
 	buf[nBuf] = 0;
 	if(!input->nTokens)
 		return ERR;
-	lastHistory = curHistory;
-	if(curHistory)
-	{
-		lastHistory -= 2;
-		while(lastHistory && history[lastHistory])
-			lastHistory--;
-		if(lastHistory)
-			lastHistory++;
-	}
-	if(!curHistory || strcmp(history + lastHistory, buf))
-	{
-		overflowHistory = nextHistory - sizeof(input->history) + nBuf + 1 + 1; // +1 for null terminator and +1 for extra space needed by the next history cursor
-		if(overflowHistory > 0)
-		{
-			const U32 l = overflowHistory + strlen(history + overflowHistory) + 1;
-			nextHistory -= l;
-			memmove(history, history + l, nextHistory);
-		}
-		memcpy(history + nextHistory, buf, nBuf + 1);
-		nextHistory += nBuf + 1;
-	}
-	input->nextHistory = nextHistory;
+	// while the accounts are encrypted a command with a string is left out of
+	// the history file, the string may be a value
+	for(U32 i = 0; cryptActive && i < input->nTokens; i++)
+		if(input->tokens[i].type == TSTRING)
+			return tokErr;
+	// repeating the latest command does not add it a second time
+	if(history_get(endHistory - 1, saveBuf) != nBuf || memcmp(saveBuf, buf, nBuf))
+		history_add(buf, nBuf);
 	return tokErr;
 }
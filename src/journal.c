@@ -0,0 +1,1034 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <stddef.h>
+#include "pwmgr.h"
+
+// backup layout
+// [header][entries...]
+// entries are
+// [magic][length][crc][payload]
+// the payload is [id][time][fields...] where each field is [length][data];
+// the crc covers the length and the payload, the magic lets a reader find
+// the next entry after a corrupt one;
+// while the accounts are encrypted the fields of an entry are written as one
+// blob sealed with the id and time as associated data, the id then has
+// ENTRY_SEALED set
+#define JOURNAL_MAGIC "PWJRNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_ENTRY_MAGIC 0x454A5750
+
+struct journal_header {
+	char magic[6];
+	U16 version;
+};
+
+struct entry_header {
+	U32 magic;
+	U32 length;
+	U32 crc;
+};
+
+#define PAYLOAD_MIN (1 + sizeof(I64))
+#define ENTRY_SEALED 0x80
+
+// the index is a sidecar file holding the offset of every entry so any entry,
+// most importantly the last applied one, can be reached in O(1)
+// [header][offsets...]
+// entries at or after nApplied were undone and can be redone,
+// entries before nCheckpoint belong to the snapshot of the last compaction
+#define INDEX_MAGIC "PWJIDX"
+#define INDEX_VERSION 2
+
+struct index_header {
+	char magic[6];
+	U16 version;
+	U32 reserved;
+	U64 nApplied;
+	// size of the backup file the index describes
+	U64 size;
+	U64 nCheckpoint;
+};
+
+// open backup file
+int fdBackup = ERR;
+// group commit policy, the backup is synced after this many entries
+// or when the oldest unsynced entry is this many milliseconds old,
+// 0 disables either rule
+U32 syncEntries = 32;
+U32 syncInterval = 1000;
+// the backup is compacted when this many entries were written since the last checkpoint,
+// 0 disables automatic compaction
+U32 compactEntries = 10000;
+
+static char *entry;
+static size_t nEntry, capEntry;
+// offset of the length of the last field
+static size_t lastField;
+static int fdIndex = ERR;
+static U64 nEntries, nApplied, nCheckpoint;
+static char *backupPath;
+static char *readBuf;
+static size_t capReadBuf;
+// reader of journal_read, it keeps the decrypted fields until the next call
+static struct journal reader;
+static U32 nUnsynced;
+static struct timespec firstUnsynced;
+
+static int decode(struct journal *j, size_t off, struct journal_entry *e);
+
+// entries hold values, so a buffer is wiped before it's given back
+static int
+reserve(size_t n)
+{
+	const size_t cap = MAX(capEntry * 2, nEntry + n + 256);
+	char *newEntry;
+
+	if(nEntry + n <= capEntry)
+		return OK;
+	newEntry = malloc(cap);
+	if(!newEntry)
+		return ERR;
+	memcpy(newEntry, entry, nEntry);
+	explicit_bzero(entry, capEntry);
+	free(entry);
+	entry = newEntry;
+	capEntry = cap;
+	return OK;
+}
+
+static U64
+millisince(const struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000 + (now.tv_nsec - ts->tv_nsec) / 1000000;
+}
+
+static void
+begin(U8 id, I64 time)
+{
+	// an entry that was never written
+	explicit_bzero(entry, nEntry);
+	nEntry = 0;
+	if(reserve(sizeof(struct entry_header) + PAYLOAD_MIN))
+		return;
+	nEntry = sizeof(struct entry_header);
+	entry[nEntry++] = id;
+	memcpy(entry + nEntry, &time, sizeof(time));
+	nEntry += sizeof(time);
+}
+
+// replaces the fields of the entry with a blob sealed with the current key
+static int
+sealentry(void)
+{
+	const size_t at = sizeof(struct entry_header) + PAYLOAD_MIN;
+	char *blob;
+	size_t nBlob;
+	int r;
+
+	entry[sizeof(struct entry_header)] |= ENTRY_SEALED;
+	r = crypt_encrypt(entry + sizeof(struct entry_header), PAYLOAD_MIN,
+			&(struct iovec) { entry + at, nEntry - at }, 1, &blob, &nBlob);
+	explicit_bzero(entry + at, nEntry - at);
+	nEntry = at;
+	if(r)
+		return ERR;
+	if(!reserve(nBlob))
+	{
+		memcpy(entry + at, blob, nBlob);
+		nEntry += nBlob;
+	}
+	else
+		r = ERR;
+	free(blob);
+	return r;
+}
+
+static int
+writeentry(int fd)
+{
+	struct entry_header hdr;
+	ssize_t n;
+
+	if(!entry)
+	{
+		errno = ENOMEM;
+		return ERR;
+	}
+	if(cryptActive && !(entry[sizeof(hdr)] & ENTRY_SEALED) && sealentry())
+		return ERR;
+	hdr.magic = JOURNAL_ENTRY_MAGIC;
+	hdr.length = nEntry - sizeof(hdr);
+	hdr.crc = crc32c(crc32c(0, &hdr.length, sizeof(hdr.length)), entry + sizeof(hdr), hdr.length);
+	memcpy(entry, &hdr, sizeof(hdr));
+	// the entry reaches the file as a whole or not at all
+	n = write(fd, entry, nEntry);
+	explicit_bzero(entry, nEntry);
+	if(n != (ssize_t) nEntry)
+	{
+		if(n > 0)
+			ftruncate(fd, lseek(fd, 0, SEEK_END) - n);
+		else if(!n)
+			errno = EIO;
+		return ERR;
+	}
+	return OK;
+}
+
+void
+journal_begin(U8 id)
+{
+	begin(id, time(NULL));
+}
+
+void
+journal_field(const void *data, size_t nData)
+{
+	const U32 n = nData;
+
+	if(reserve(sizeof(n) + nData))
+		return;
+	lastField = nEntry;
+	memcpy(entry + nEntry, &n, sizeof(n));
+	nEntry += sizeof(n);
+	memcpy(entry + nEntry, data, nData);
+	nEntry += nData;
+}
+
+void
+journal_append(const void *data, size_t nData)
+{
+	U32 n;
+
+	if(reserve(nData))
+		return;
+	memcpy(&n, entry + lastField, sizeof(n));
+	n += nData;
+	memcpy(entry + lastField, &n, sizeof(n));
+	memcpy(entry + nEntry, data, nData);
+	nEntry += nData;
+}
+
+static int
+writeindexheader(U64 size)
+{
+	struct index_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.version = INDEX_VERSION;
+	hdr.nApplied = nApplied;
+	hdr.size = size;
+	hdr.nCheckpoint = nCheckpoint;
+	return pwrite(fdIndex, &hdr, sizeof(hdr), 0) == sizeof(hdr) ? OK : ERR;
+}
+
+static int
+entryoffset(U64 i, U64 *off)
+{
+	return pread(fdIndex, off, sizeof(*off), sizeof(struct index_header) + sizeof(*off) * i)
+		== sizeof(*off) ? OK : ERR;
+}
+
+// new entries replace the entries that were undone
+static int
+dropundone(void)
+{
+	U64 off;
+
+	if(nApplied == nEntries)
+		return OK;
+	if(entryoffset(nApplied, &off) ||
+			ftruncate(fdBackup, off) ||
+			ftruncate(fdIndex, sizeof(struct index_header) + sizeof(off) * nApplied))
+		return ERR;
+	nEntries = nApplied;
+	return writeindexheader(off);
+}
+
+int
+journal_commit(void)
+{
+	off_t off;
+
+	if(fdBackup == ERR)
+	{
+		errno = EBADF;
+		return ERR;
+	}
+	if(fdIndex != ERR && dropundone())
+		return ERR;
+	off = lseek(fdBackup, 0, SEEK_END);
+	if(off < 0 || writeentry(fdBackup))
+		return ERR;
+	if(fdIndex != ERR)
+	{
+		const U64 off64 = off;
+
+		if(pwrite(fdIndex, &off64, sizeof(off64),
+					sizeof(struct index_header) + sizeof(off64) * nEntries) != sizeof(off64))
+		{
+			close(fdIndex);
+			fdIndex = ERR;
+		}
+		else
+		{
+			nEntries++;
+			nApplied++;
+			writeindexheader(off + nEntry);
+		}
+	}
+	if(!nUnsynced++)
+		clock_gettime(CLOCK_MONOTONIC, &firstUnsynced);
+	if((syncEntries && nUnsynced >= syncEntries) ||
+			(syncInterval && millisince(&firstUnsynced) >= syncInterval))
+		return journal_sync();
+	return OK;
+}
+
+int
+journal_sync(void)
+{
+	if(!nUnsynced)
+		return OK;
+	nUnsynced = 0;
+	return fdatasync(fdBackup);
+}
+
+int
+journal_idle(void)
+{
+	U64 elapsed;
+
+	if(!nUnsynced || !syncInterval)
+		return -1;
+	elapsed = millisince(&firstUnsynced);
+	if(elapsed < syncInterval)
+		return syncInterval - elapsed;
+	journal_sync();
+	return -1;
+}
+
+static int
+writeheader(int fd)
+{
+	const struct journal_header hdr = { JOURNAL_MAGIC, JOURNAL_VERSION };
+
+	return write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) ? OK : ERR;
+}
+
+// rewrites a backup of the old format
+// [id][time][field][0]...
+// in the current format
+static int
+upgrade(const char *path, int fd)
+{
+	char tmpPath[strlen(path) + 5];
+	int fdTmp;
+	struct journal j;
+	struct journal_entry e;
+	int r;
+
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+	fdTmp = open(tmpPath, O_CREAT | O_TRUNC | O_APPEND | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fdTmp == ERR)
+		return ERR;
+	if(writeheader(fdTmp))
+		goto err;
+	fdBackup = fd;
+	r = journal_map(&j);
+	fdBackup = ERR;
+	if(r)
+		goto err;
+	while((r = journal_next(&j, &e)) > 0)
+	{
+		begin(e.id, e.time);
+		for(U32 i = 0; i < e.nFields; i++)
+			journal_field(e.fields[i].data, e.fields[i].nData);
+		if(writeentry(fdTmp))
+			break;
+	}
+	journal_unmap(&j);
+	if(r)
+	{
+		if(r == ERR)
+			errno = EILSEQ;
+		goto err;
+	}
+	if(fsync(fdTmp) || rename(tmpPath, path))
+		goto err;
+	close(fd);
+	return fdTmp;
+err:
+	close(fdTmp);
+	remove(tmpPath);
+	return ERR;
+}
+
+static int
+rebuildindex(const struct index_header *old)
+{
+	struct journal j;
+	struct journal_entry e;
+	U64 *offsets = NULL;
+	U64 capOffsets = 0;
+	int r;
+
+	if(journal_map(&j))
+		return ERR;
+	// only the offsets are needed
+	j.raw = true;
+	nEntries = 0;
+	nCheckpoint = 0;
+	while((r = journal_next(&j, &e)))
+	{
+		if(r == ERR)
+		{
+			if(!journal_recover(&j))
+				break;
+			continue;
+		}
+		if(nEntries == capOffsets)
+		{
+			U64 *newOffsets;
+
+			capOffsets = MAX(capOffsets * 2, 1024);
+			newOffsets = realloc(offsets, sizeof(*offsets) * capOffsets);
+			if(!newOffsets)
+			{
+				free(offsets);
+				journal_unmap(&j);
+				return ERR;
+			}
+			offsets = newOffsets;
+		}
+		offsets[nEntries++] = e.off;
+		if(e.id == BACKUP_ENTRY_CHECKPOINT)
+			nCheckpoint = nEntries;
+	}
+	journal_unmap(&j);
+	nApplied = old ? MAX(MIN(old->nApplied, nEntries), nCheckpoint) : nEntries;
+	r = ftruncate(fdIndex, sizeof(struct index_header)) ||
+		pwrite(fdIndex, offsets, sizeof(*offsets) * nEntries, sizeof(struct index_header))
+			!= (ssize_t) (sizeof(*offsets) * nEntries) ||
+		writeindexheader(j.nData) ? ERR : OK;
+	free(offsets);
+	return r;
+}
+
+static int
+openindex(const char *path)
+{
+	char idxPath[strlen(path) + 5];
+	struct stat st, stIdx;
+	struct index_header hdr;
+	bool valid;
+
+	if(fdIndex != ERR)
+		close(fdIndex);
+	strcpy(idxPath, path);
+	strcat(idxPath, ".idx");
+	fdIndex = open(idxPath, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fdIndex == ERR)
+		return ERR;
+	if(fstat(fdBackup, &st) || fstat(fdIndex, &stIdx))
+		goto err;
+	valid = pread(fdIndex, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		!memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) &&
+		hdr.version == INDEX_VERSION;
+	if(valid && hdr.size == (U64) st.st_size &&
+			!((stIdx.st_size - sizeof(hdr)) % sizeof(U64)))
+	{
+		nEntries = (stIdx.st_size - sizeof(hdr)) / sizeof(U64);
+		nCheckpoint = MIN(hdr.nCheckpoint, nEntries);
+		nApplied = MAX(MIN(hdr.nApplied, nEntries), nCheckpoint);
+		return OK;
+	}
+	// the index is missing or out of date (for instance after a crash between
+	// writing an entry and its offset)
+	if(rebuildindex(valid ? &hdr : NULL))
+		goto err;
+	return OK;
+err:
+	close(fdIndex);
+	fdIndex = ERR;
+	return ERR;
+}
+
+int
+journal_open(const char *path)
+{
+	int fd;
+	struct stat st;
+	struct journal_header hdr;
+
+	if(fdBackup != ERR)
+	{
+		journal_sync();
+		close(fdBackup);
+		fdBackup = ERR;
+	}
+	fd = open(path, O_CREAT | O_APPEND | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	if(fstat(fd, &st))
+		goto err;
+	if(!st.st_size)
+	{
+		if(writeheader(fd))
+			goto err;
+	}
+	else if(st.st_size < (off_t) sizeof(hdr) ||
+			pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+			memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic)))
+	{
+		fd = upgrade(path, fd);
+		if(fd == ERR)
+			return ERR;
+	}
+	else if(hdr.version != JOURNAL_VERSION)
+	{
+		errno = EPROTO;
+		goto err;
+	}
+	fdBackup = fd;
+	free(backupPath);
+	backupPath = strdup(path);
+	// the backup is still usable without an index, there is just no undo
+	openindex(path);
+	return OK;
+err:
+	close(fd);
+	return ERR;
+}
+
+U64
+journal_entries(void)
+{
+	return fdIndex == ERR ? 0 : nEntries;
+}
+
+U64
+journal_applied(void)
+{
+	return fdIndex == ERR ? 0 : nApplied;
+}
+
+U64
+journal_checkpoint(void)
+{
+	return fdIndex == ERR ? 0 : nCheckpoint;
+}
+
+int
+journal_setapplied(U64 n)
+{
+	U64 size;
+
+	if(fdIndex == ERR || n > nEntries)
+	{
+		errno = EINVAL;
+		return ERR;
+	}
+	nApplied = n;
+	size = lseek(fdBackup, 0, SEEK_END);
+	return writeindexheader(size);
+}
+
+// overwrites a file with zeroes, the backup itself is opened for appending only
+static void
+wipefile(const char *path)
+{
+	static const char zeroes[4096];
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if(fd == ERR)
+		return;
+	if(!fstat(fd, &st))
+	{
+		for(off_t off = 0; off < st.st_size; )
+		{
+			const ssize_t n = write(fd, zeroes, MIN((off_t) sizeof(zeroes), st.st_size - off));
+
+			if(n <= 0)
+				break;
+			off += n;
+		}
+		fdatasync(fd);
+	}
+	close(fd);
+}
+
+struct compaction {
+	int fd;
+	U64 nAccounts;
+	int r;
+};
+
+static int
+snapshotaccount(const char *name, U32 nName, void *arg)
+{
+	struct compaction *const c = arg;
+	struct account acc;
+
+	if(account_open(name, nName, &acc))
+	{
+		c->r = ERR;
+		return 1;
+	}
+	journal_begin(BACKUP_ENTRY_SNAPSHOT);
+	journal_field(name, nName);
+	journal_field(acc.data, acc.nData);
+	account_close(&acc);
+	if(writeentry(c->fd))
+	{
+		c->r = ERR;
+		return 1;
+	}
+	c->nAccounts++;
+	return 0;
+}
+
+static int
+compact(const char *path)
+{
+	char tmpPath[strlen(path) + 5];
+	struct compaction c = { .r = OK };
+	struct journal_entry e;
+	const U64 nUndone = journal_entries() - journal_applied();
+
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+	c.fd = open(tmpPath, O_CREAT | O_TRUNC | O_APPEND | O_RDWR, S_IRUSR | S_IWUSR);
+	if(c.fd == ERR)
+		return ERR;
+	if(writeheader(c.fd) || account_foreach(snapshotaccount, &c) || c.r)
+		goto err;
+	journal_begin(BACKUP_ENTRY_CHECKPOINT);
+	journal_field(&c.nAccounts, sizeof(c.nAccounts));
+	if(writeentry(c.fd))
+		goto err;
+	// undone entries are kept so they can still be redone, an entry that isn't
+	// sealed yet is written again so it is when the accounts are encrypted
+	for(U64 i = journal_applied(); i < journal_entries(); i++)
+	{
+		if(journal_read(i, &e))
+			goto err;
+		if(e.sealed)
+		{
+			if(write(c.fd, readBuf, e.size) != (ssize_t) e.size)
+				goto err;
+			continue;
+		}
+		begin(e.id, e.time);
+		for(U32 f = 0; f < e.nFields; f++)
+			journal_field(e.fields[f].data, e.fields[f].nData);
+		if(writeentry(c.fd))
+			goto err;
+	}
+	// like account_write, swap the files so there is always a complete backup
+	if(fsync(c.fd) || renameat2(AT_FDCWD, tmpPath, AT_FDCWD, path, RENAME_EXCHANGE))
+		goto err;
+	// the old backup may hold values from before the accounts were encrypted
+	if(cryptActive)
+		wipefile(tmpPath);
+	remove(tmpPath);
+	close(fdBackup);
+	fdBackup = c.fd;
+	if(fdIndex != ERR)
+	{
+		struct index_header hdr;
+
+		hdr.nApplied = c.nAccounts + 1;
+		if(rebuildindex(&hdr) || nEntries != hdr.nApplied + nUndone)
+		{
+			close(fdIndex);
+			fdIndex = ERR;
+		}
+	}
+	return OK;
+err:
+	close(c.fd);
+	remove(tmpPath);
+	return ERR;
+}
+
+int
+journal_compact(void)
+{
+	if(fdBackup == ERR || !backupPath)
+	{
+		errno = EBADF;
+		return ERR;
+	}
+	if(journal_sync())
+		return ERR;
+	return compact(backupPath);
+}
+
+int
+journal_reseal(void)
+{
+	char tmpPath[backupPath ? strlen(backupPath) + 5 : 1];
+	int fd;
+	struct journal j;
+	struct journal_entry e;
+	struct index_header hdr;
+	int r;
+
+	if(fdBackup == ERR || !backupPath)
+	{
+		errno = EBADF;
+		return ERR;
+	}
+	if(journal_sync() || journal_map(&j))
+		return ERR;
+	j.raw = true;
+	strcpy(tmpPath, backupPath);
+	strcat(tmpPath, ".tmp");
+	fd = open(tmpPath, O_CREAT | O_TRUNC | O_APPEND | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+	{
+		journal_unmap(&j);
+		return ERR;
+	}
+	if(writeheader(fd))
+		goto err;
+	// corrupt spans are left out, the entries keep their order
+	while((r = journal_next(&j, &e)))
+	{
+		char *blob;
+		size_t nBlob;
+
+		if(r == ERR)
+		{
+			if(!journal_recover(&j))
+				break;
+			continue;
+		}
+		if(!e.sealed)
+		{
+			if(write(fd, j.data + e.off, e.size) != (ssize_t) e.size)
+				goto err;
+			continue;
+		}
+		// the id and time right after the entry header are the associated data
+		r = crypt_reseal(j.data + e.off + sizeof(struct entry_header), PAYLOAD_MIN,
+				e.fields[0].data, e.fields[0].nData, &blob, &nBlob);
+		if(r == ERR)
+			goto err;
+		// an interrupted rotation already got to this one
+		if(r)
+		{
+			if(write(fd, j.data + e.off, e.size) != (ssize_t) e.size)
+				goto err;
+			continue;
+		}
+		begin(e.id | ENTRY_SEALED, e.time);
+		r = reserve(nBlob);
+		if(!r)
+		{
+			memcpy(entry + nEntry, blob, nBlob);
+			nEntry += nBlob;
+		}
+		free(blob);
+		if(r || writeentry(fd))
+			goto err;
+	}
+	journal_unmap(&j);
+	if(fsync(fd) || renameat2(AT_FDCWD, tmpPath, AT_FDCWD, backupPath, RENAME_EXCHANGE))
+		goto err;
+	remove(tmpPath);
+	close(fdBackup);
+	fdBackup = fd;
+	if(fdIndex != ERR)
+	{
+		hdr.nApplied = nApplied;
+		if(rebuildindex(&hdr))
+		{
+			close(fdIndex);
+			fdIndex = ERR;
+		}
+	}
+	return OK;
+err:
+	journal_unmap(&j);
+	close(fd);
+	remove(tmpPath);
+	return ERR;
+}
+
+int
+journal_read(U64 i, struct journal_entry *e)
+{
+	U64 off;
+	struct entry_header hdr;
+
+	if(fdIndex == ERR || i >= nEntries)
+	{
+		errno = EINVAL;
+		return ERR;
+	}
+	if(entryoffset(i, &off) ||
+			pread(fdBackup, &hdr, sizeof(hdr), off) != sizeof(hdr))
+		return ERR;
+	if(capReadBuf < sizeof(hdr) + hdr.length)
+	{
+		char *newBuf;
+
+		newBuf = malloc(sizeof(hdr) + hdr.length);
+		if(!newBuf)
+			return ERR;
+		explicit_bzero(readBuf, capReadBuf);
+		free(readBuf);
+		readBuf = newBuf;
+		capReadBuf = sizeof(hdr) + hdr.length;
+	}
+	if(pread(fdBackup, readBuf, sizeof(hdr) + hdr.length, off) != (ssize_t) (sizeof(hdr) + hdr.length))
+		return ERR;
+	reader.data = readBuf;
+	reader.nData = sizeof(hdr) + hdr.length;
+	if(decode(&reader, 0, e))
+		return ERR;
+	e->off = off;
+	return OK;
+}
+
+int
+journal_map(struct journal *j)
+{
+	struct stat st;
+	void *map;
+
+	memset(j, 0, sizeof(*j));
+	if(fstat(fdBackup, &st))
+		return ERR;
+	j->data = "";
+	if(!st.st_size)
+		return OK;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fdBackup, 0);
+	if(map == MAP_FAILED)
+		return ERR;
+	j->map = map;
+	j->data = map;
+	j->nData = st.st_size;
+	if(j->nData >= sizeof(struct journal_header) &&
+			!memcmp(j->data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1))
+		j->pos = sizeof(struct journal_header);
+	else
+		j->legacy = true;
+	return OK;
+}
+
+void
+journal_unmap(struct journal *j)
+{
+	if(j->map)
+		munmap(j->map, j->nData);
+	j->map = NULL;
+	if(j->plain)
+		explicit_bzero(j->plain, j->nPlain);
+	free(j->plain);
+	j->plain = NULL;
+}
+
+static int
+nextlegacy(struct journal *j, struct journal_entry *e)
+{
+	const char *ptr, *end, *nul;
+	U32 nFields;
+	time_t time;
+
+	ptr = j->data + j->pos;
+	end = j->data + j->nData;
+	if((size_t) (end - ptr) < 1 + sizeof(time_t))
+		return ERR;
+	e->off = j->pos;
+	e->sealed = false;
+	e->id = *(ptr++);
+	memcpy(&time, ptr, sizeof(time));
+	e->time = time;
+	ptr += sizeof(time_t);
+	switch(e->id)
+	{
+	case BACKUP_ENTRY_ADDACCOUNT:
+	case BACKUP_ENTRY_REMOVEACCOUNT:
+		nFields = 1;
+		break;
+	case BACKUP_ENTRY_ADDPROPERTY:
+		nFields = 3;
+		break;
+	case BACKUP_ENTRY_REMOVEPROPERTY:
+		nFields = 2;
+		break;
+	default:
+		return ERR;
+	}
+	for(e->nFields = 0; e->nFields < nFields; e->nFields++)
+	{
+		nul = memchr(ptr, 0, end - ptr);
+		if(!nul)
+			return ERR;
+		e->fields[e->nFields].data = ptr;
+		e->fields[e->nFields].nData = nul - ptr;
+		ptr = nul + 1;
+	}
+	e->size = ptr - j->data - j->pos;
+	j->pos += e->size;
+	return 1;
+}
+
+static int
+parsefields(struct journal_entry *e, const char *ptr, const char *end)
+{
+	for(e->nFields = 0; ptr != end; e->nFields++)
+	{
+		U32 n;
+
+		if(e->nFields == JOURNAL_MAX_FIELDS || (size_t) (end - ptr) < sizeof(n))
+			return ERR;
+		memcpy(&n, ptr, sizeof(n));
+		ptr += sizeof(n);
+		if(n > (size_t) (end - ptr))
+			return ERR;
+		e->fields[e->nFields].data = ptr;
+		e->fields[e->nFields].nData = n;
+		ptr += n;
+	}
+	return OK;
+}
+
+// decodes the entry at the given offset without moving the reader,
+// the fields of a sealed entry are decrypted into the reader
+static int
+decode(struct journal *j, size_t off, struct journal_entry *e)
+{
+	struct entry_header hdr;
+	const char *ptr, *end;
+
+	errno = EILSEQ;
+	if(j->nData - off < sizeof(hdr))
+		return ERR;
+	memcpy(&hdr, j->data + off, sizeof(hdr));
+	if(hdr.magic != JOURNAL_ENTRY_MAGIC || hdr.length < PAYLOAD_MIN ||
+			hdr.length > j->nData - off - sizeof(hdr))
+		return ERR;
+	ptr = j->data + off + sizeof(hdr);
+	end = ptr + hdr.length;
+	if(crc32c(crc32c(0, &hdr.length, sizeof(hdr.length)), ptr, hdr.length) != hdr.crc)
+		return ERR;
+	e->off = off;
+	e->size = sizeof(hdr) + hdr.length;
+	e->id = *ptr & ~ENTRY_SEALED;
+	e->sealed = !!(*ptr & ENTRY_SEALED);
+	memcpy(&e->time, ptr + 1, sizeof(e->time));
+	if(!e->sealed)
+		return parsefields(e, ptr + PAYLOAD_MIN, end);
+	if(j->raw)
+	{
+		e->nFields = 1;
+		e->fields[0].data = ptr + PAYLOAD_MIN;
+		e->fields[0].nData = end - ptr - PAYLOAD_MIN;
+		return OK;
+	}
+	if(j->plain)
+		explicit_bzero(j->plain, j->nPlain);
+	free(j->plain);
+	j->plain = NULL;
+	if(crypt_decryptcopy(ptr, PAYLOAD_MIN, ptr + PAYLOAD_MIN, end - ptr - PAYLOAD_MIN,
+				&j->plain, &j->nPlain))
+		return ERR;
+	errno = EILSEQ;
+	return parsefields(e, j->plain, j->plain + j->nPlain);
+}
+
+int
+journal_next(struct journal *j, struct journal_entry *e)
+{
+	if(j->pos == j->nData)
+		return 0;
+	if(j->legacy)
+		return nextlegacy(j, e);
+	if(decode(j, j->pos, e))
+		return ERR;
+	j->pos += e->size;
+	return 1;
+}
+
+int
+journal_recover(struct journal *j)
+{
+	struct journal_entry e;
+	const U32 magic = JOURNAL_ENTRY_MAGIC;
+	const char *ptr;
+
+	// the old format has no way to find the start of an entry
+	if(j->legacy)
+		return 0;
+	for(size_t off = j->pos + 1; off < j->nData; off = ptr - j->data + 1)
+	{
+		ptr = memmem(j->data + off, j->nData - off, &magic, sizeof(magic));
+		if(!ptr)
+			break;
+		if(!decode(j, ptr - j->data, &e))
+		{
+			j->pos = ptr - j->data;
+			return 1;
+		}
+	}
+	j->pos = j->nData;
+	return 0;
+}
+
+int
+journal_check(bool repair, struct journal_check *check)
+{
+	struct journal j;
+	struct journal_entry e;
+	size_t lastOff = 0, lastSize = 0;
+	int r;
+
+	memset(check, 0, sizeof(*check));
+	if(journal_sync() || journal_map(&j))
+		return ERR;
+	// the crc covers a sealed entry as it is stored
+	j.raw = true;
+	while((r = journal_next(&j, &e)))
+	{
+		if(r == 1)
+		{
+			check->nEntries++;
+			continue;
+		}
+		lastOff = j.pos;
+		if(!journal_recover(&j))
+			j.pos = j.nData;
+		lastSize = j.pos - lastOff;
+		if(check->nSpans < ARRLEN(check->spans))
+		{
+			check->spans[check->nSpans].off = lastOff;
+			check->spans[check->nSpans].size = lastSize;
+		}
+		check->nSpans++;
+	}
+	journal_unmap(&j);
+	// only a span that runs to the end of the file is cut off
+	if(!repair || !check->nSpans || lastOff + lastSize != j.nData)
+		return OK;
+	if(ftruncate(fdBackup, lastOff))
+		return ERR;
+	check->nCut = lastSize;
+	// the index still has the old size of the backup and is built again
+	return openindex(backupPath);
+}
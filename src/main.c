@@ -3,9 +3,12 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <dirent.h>
 #include <errno.h>
 #include <locale.h>
+#include <pthread.h>
+#include <time.h>
 #include "pwmgr.h"
 
 #define VERSION "Unstable Version 1"
@@ -16,8 +19,6 @@ const char *realPath;
 // 1 + sizeof(time_t) + 2 * MAX_NAME + 2
 // bytes large
 char path[1024];
-// open backup file
-int fdBackup;
 // output window
 WINDOW *out;
 int iPage;
@@ -44,7 +45,7 @@ setoutpage(int page)
 	prefresh(out, MAX(sx, 0), 0, 0, 0, outSize, COLS);
 }
 
-static void
+void
 appendrealpath(const char *app, U32 nApp)
 {
 	U32 at;
@@ -57,6 +58,66 @@ appendrealpath(const char *app, U32 nApp)
 	path[at] = 0;
 }
 
+static void
+commitbackup(void)
+{
+	if(journal_commit())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to write the backup entry (%s)", strerror(errno));
+	}
+	else if(compactEntries && journal_entries() - journal_checkpoint() >= compactEntries &&
+			journal_compact())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to compact the backup (%s)", strerror(errno));
+	}
+}
+
+int
+set_area(struct variable *var, U32 value)
+{
+	WINDOW *newOut;
+
+	area = value;
+	if(!out)
+		return OK;
+	if(area / COLS <= LINES)
+		area = COLS * LINES;
+	newOut = newpad(area / COLS, COLS);
+	overwrite(out, newOut);
+	delwin(out);
+	out = newOut;
+	scrollok(out, true);
+	return OK;
+}
+
+int
+set_inputheight(struct variable *var, U32 value)
+{
+	if(!value)
+	{
+		errno = ERANGE;
+		return ERR;
+	}
+	if(!out)
+	{
+		inputHeight = value;
+		return OK;
+	}
+	inputHeight = MIN(value, (U32) MAX(LINES / 2, 1));
+	input.win = newwin(inputHeight, COLS, LINES - inputHeight, 0);
+	keypad(input.win, true);
+	return OK;
+}
+
+int
+set_sync(struct variable *var, U32 value)
+{
+	*var->number = value;
+	return journal_sync();
+}
+
 void
 set(const struct branch *branch, struct value *values)
 {
@@ -65,7 +126,6 @@ set(const struct branch *branch, struct value *values)
 	char *value;
 	U32 nValue;
 	struct variable *var;
-	I64 iVal;
 
 	name = values[0].word;
 	nName = values[0].nWord;
@@ -74,51 +134,29 @@ set(const struct branch *branch, struct value *values)
 	var = getvariable(name, nName);
 	if(!var)
 	{
-		wattrset(out, ATTR_LOG);
-		wprintw(out, "\nVariable '%.*s' doesn't exist, do you want to create it? [yn]", nName, name);
-		setoutpage(0);
-		if(wgetch(out) != 'y')
+		outattr(ATTR_LOG);
+		outprintf("\nVariable '%.*s' doesn't exist, do you want to create it? [yn]", nName, name);
+		if(outask() != 'y')
 		{
-			wattrset(out, ATTR_LOG);
-			waddstr(out, "\nCreation of variable cancelled");
+			outattr(ATTR_LOG);
+			outstr("\nCreation of variable cancelled");
 			return;
 		}
-		addvariable(&(struct variable) { strndup(name, nName), strndup(value, nValue) });
-		attrset(ATTR_LOG);
-		wprintw(out, "\nVariable '%.*s' created!", nName, name);
-		return;
-	}
-	if(var->value)
-	{
-		free(var->value);
-		var->value = strndup(value, nValue);
-	}
-	else if(!strcmp(var->name, "area"))
-	{
-		WINDOW *newOut;
-
-		iVal = strtoll(value, NULL, 0);
-		area = iVal;
-		if(area / COLS <= LINES)
-			area = COLS * LINES;
-		newOut = newpad(area / COLS, COLS);
-		overwrite(out, newOut);
-		delwin(out);
-		out = newOut;
-		scrollok(out, true);
-	}
-	else if(!strcmp(var->name, "inputHeight"))
-	{
-		iVal = strtoll(value, NULL, 0);
-		if(!iVal)
+		if(!addvariable(name, nName, value, nValue))
 		{
-			wattrset(out, ATTR_ERROR);
-			wprintw(out, "\nThe input height can't be 0");
+			outattr(ATTR_ERROR);
+			outprintf("\nUnable to create variable '%.*s' (%s)", nName, name, strerror(errno));
 			return;
 		}
-		inputHeight = MIN(iVal, MAX(LINES / 2, 1));
-		input.win = newwin(inputHeight, COLS, LINES - inputHeight, 0);
-		keypad(input.win, true);
+		outattr(ATTR_LOG);
+		outprintf("\nVariable '%.*s' created!", nName, name);
+		return;
+	}
+	if(setvariable(var, value, nValue))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to set variable '%.*s' to '%.*s' (%s)", nName, name, nValue, value,
+				errno == EINVAL ? "the value must be a number" : strerror(errno));
 	}
 }
 
@@ -127,31 +165,26 @@ add_account(const struct branch *branch, struct value *values)
 {
 	char *name;
 	U32 nName;
-	int fd;
 
 	name = values[0].word;
 	nName = values[0].nWord;
-	appendrealpath(name, nName);
-	if(!access(path, F_OK))
-	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nAccount '%.*s' already exists", nName, name);
-		return;
-	}
-	fd = open(path, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
-	if(fd == ERR)
+	if(account_create(name, nName, NULL, 0))
 	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nUnable to create file inside '%s' (%s)", realPath, strerror(errno));
+		outattr(ATTR_ERROR);
+		if(errno == EEXIST)
+			outprintf("\nAccount '%.*s' already exists", nName, name);
+		else
+			outprintf("\nUnable to create account inside '%s' (%s)", realPath, strerror(errno));
 		return;
 	}
-	close(fd);
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nCreated new account inside '%s'", path);
-	write(fdBackup, &(char) { BACKUP_ENTRY_ADDACCOUNT }, 1);
-	write(fdBackup, &(time_t) { time(NULL) }, sizeof(time_t));
-	write(fdBackup, name, nName);
-	write(fdBackup, &(char) { 0 }, 1);
+	outattr(ATTR_LOG);
+	if(fdVault != ERR)
+		outprintf("\nCreated new account inside the vault");
+	else
+		outprintf("\nCreated new account inside '%s'", path);
+	journal_begin(BACKUP_ENTRY_ADDACCOUNT);
+	journal_field(name, nName);
+	commitbackup();
 }
 
 void
@@ -161,87 +194,29 @@ add_property(const struct branch *branch, struct value *values)
 	U32 nPropName;
 	char *accName;
 	U32 nAccName;
-	int fd;
-	ssize_t nRead;
 
 	propName = values[0].word;
 	nPropName = values[0].nWord;
 	accName = values[1].word;
 	nAccName = values[1].nWord;
-	appendrealpath(accName, nAccName);
-	fd = open(path, O_RDWR | O_APPEND);
-	if(fd == ERR)
+	if(property_add(accName, nAccName, propName, nPropName, values[2].string, values[2].nString))
 	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nUnable to access '%s' (%s)", path, strerror(errno));
+		outattr(ATTR_ERROR);
+		if(errno == EEXIST)
+			outprintf("\nProperty '%.*s' already exists", nPropName, propName);
+		else if(errno == EILSEQ)
+			outprintf("\nFile '%s/%.*s' is corrupt", realPath, nAccName, accName);
+		else
+			outprintf("\nUnable to write account '%.*s' (%s)", nAccName, accName, strerror(errno));
 		return;
 	}
-	path[sizeof(path) - 1] = 0;
-	nRead = read(fd, path, sizeof(path) - 1);
-	while(nRead > 0)
-	{
-		char *name;
-		U32 nName;
-		U32 nValue;
-
-		name = path;
-		nName = strlen(path);
-		if(nName > nRead)
-		{
-			wattrset(out, ATTR_ERROR);
-			wprintw(out, "\nFile '%s/%.*s' is corrupt (state: 0)", realPath, nAccName, accName);
-			close(fd);
-			return;
-		}
-		if(nName == nPropName && !memcmp(name, propName, nPropName))
-		{
-			wattrset(out, ATTR_ERROR);
-			wprintw(out, "\nProperty '%.*s' already exists", nPropName, propName);
-			close(fd);
-			return;
-		}
-		nRead -= nName + 1;
-		memcpy(path, path + nName + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-		if(!nRead)
-		{
-			wattrset(out, ATTR_ERROR);
-			wprintw(out, "\nFile '%s/%.*s' is corrupt (state: 1)", realPath, nAccName, accName);
-			close(fd);
-			return;
-		}
-		nValue = strlen(path);
-		while(nValue == sizeof(path) - 1)
-		{
-			nRead = read(fd, path, sizeof(path) - 1);
-			nValue = strlen(path);
-			if(nValue > nRead)
-			{
-				wattrset(out, ATTR_ERROR);
-				wprintw(out, "\nFile '%s/%.*s' is corrupt (state: 2)", realPath, nAccName, accName);
-				close(fd);
-				return;
-			}
-		}
-		nRead -= nValue + 1;
-		memcpy(path, path + nValue + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-	}
-	write(fd, propName, nPropName);
-	write(fd, &(char) { 0 }, 1);
-	write(fd, values[2].string, values[2].nString);
-	write(fd, &(char) { 0 }, 1);
-	close(fd);
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nWritten '%.*s' to account '%.*s'", values[2].nString, values[2].string, nAccName, accName);
-	write(fdBackup, &(char) { BACKUP_ENTRY_ADDPROPERTY }, 1);
-	write(fdBackup, &(time_t) { time(NULL) }, sizeof(time_t));
-	write(fdBackup, propName, nPropName);
-	write(fdBackup, &(char) { 0 }, 1);
-	write(fdBackup, accName, nAccName);
-	write(fdBackup, &(char) { 0 }, 1);
-	write(fdBackup, values[2].string, values[2].nString);
-	write(fdBackup, &(char) { 0 }, 1);
+	outattr(ATTR_LOG);
+	outprintf("\nWritten '%.*s' to account '%.*s'", values[2].nString, values[2].string, nAccName, accName);
+	journal_begin(BACKUP_ENTRY_ADDPROPERTY);
+	journal_field(propName, nPropName);
+	journal_field(accName, nAccName);
+	journal_field(values[2].string, values[2].nString);
+	commitbackup();
 }
 
 void
@@ -251,110 +226,35 @@ remove_property(const struct branch *branch, struct value *values)
 	U32 nPropName;
 	char *accName;
 	U32 nAccName;
-	int fd;
-	ssize_t nRead;
-	int fdTmp;
-	bool removed = false;
-	char tmpPath[sizeof(path)];
+	char *oldValue;
+	size_t nOldValue;
 
 	propName = values[0].word;
 	nPropName = values[0].nWord;
 	accName = values[1].word;
 	nAccName = values[1].nWord;
-	appendrealpath(accName, nAccName);
-	fd = open(path, O_RDONLY);
-	if(fd == ERR)
-	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nUnable to open account '%.*s' (%s)", nAccName, accName, strerror(errno));
-		return;
-	}
-	appendrealpath(".tmp", 4);
-	fdTmp = open(path, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
-	if(fdTmp == ERR)
+	if(property_remove(accName, nAccName, propName, nPropName, &oldValue, &nOldValue))
 	{
-		wattrset(out, ATTR_FATAL);
-		wprintw(out, "\nUnable to create temporary file (%s)", strerror(errno));
-		close(fd);
+		outattr(ATTR_ERROR);
+		if(errno == ENOENT)
+			outprintf("\nProperty '%.*s' doesn't exist", nPropName, propName);
+		else if(errno == EILSEQ)
+			outprintf("\nFile '%s/%.*s' is corrupt", realPath, nAccName, accName);
+		else if(errno == ESTALE)
+			outprintf("\nAccount '%.*s' was changed while reading it, try again", nAccName, accName);
+		else
+			outprintf("\nUnable to remove the property from account '%.*s' (%s)", nAccName, accName, strerror(errno));
 		return;
 	}
-	strcpy(tmpPath, path);
-
-	// write all properties besides the property which should be removed
-	path[sizeof(path) - 1] = 0;
-	nRead = read(fd, path, sizeof(path) - 1);
-	while(nRead > 0)
-	{
-		char *name;
-		U32 nName;
-		U32 nValue;
-		bool ignoreWrite = false;
-
-		name = path;
-		nName = strlen(path);
-		if(nName > nRead)
-			goto corrupt;
-		if(nName == nPropName && !memcmp(name, propName, nPropName))
-		{
-			wattrset(out, ATTR_ERROR);
-			removed = true;
-			ignoreWrite = true;	
-		}
-		if(!ignoreWrite)
-			write(fdTmp, name, nName + 1);
-		nRead -= nName + 1;
-		memcpy(path, path + nName + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-		if(!nRead)
-			goto corrupt;
-		nValue = strlen(path);
-		if(!ignoreWrite)
-			write(fdTmp, path, nValue);
-		while(nValue == sizeof(path) - 1)
-		{
-			nRead = read(fd, path, sizeof(path) - 1);
-			nValue = strlen(path);
-			if(nValue > nRead)
-				goto corrupt;
-			if(!ignoreWrite)
-				write(fdTmp, path, nValue);
-		}
-		if(!ignoreWrite)
-			write(fdTmp, &(char) { 0 }, 1);
-		nRead -= nValue + 1;
-		memcpy(path, path + nValue + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-	}
-	close(fd);
-	if(!removed)
-	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nProperty '%.*s' doesn't exist", nPropName, propName);
-		return;
-	}
-	appendrealpath(accName, nAccName);
-	if(renameat2(AT_FDCWD, tmpPath, AT_FDCWD, path, RENAME_EXCHANGE))
-	{
-		wattrset(out, ATTR_FATAL);
-		wprintw(out, "\nFailed atomically swapping temporary file and new file (%s)", strerror(errno));
-	}
-	close(fdTmp);
-	remove(tmpPath);
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nRemoved property '%.*s' from account '%.*s'", nPropName, propName, nAccName, accName);
-	write(fdBackup, &(char) { BACKUP_ENTRY_REMOVEPROPERTY }, 1);
-	write(fdBackup, &(time_t) { time(NULL) }, sizeof(time_t));
-	write(fdBackup, propName, nPropName);
-	write(fdBackup, &(char) { 0 }, 1);
-	write(fdBackup, accName, nAccName);
-	write(fdBackup, &(char) { 0 }, 1);
-	return;
-corrupt:
-	close(fdTmp);
-	remove(tmpPath);
-	close(fd);
-	wattrset(out, ATTR_FATAL);
-	wprintw(out, "\nFile '%s/%.*s' is corrupt", realPath, nAccName, accName);
+	outattr(ATTR_LOG);
+	outprintf("\nRemoved property '%.*s' from account '%.*s'", nPropName, propName, nAccName, accName);
+	// the old value is recorded so the removal can be undone
+	journal_begin(BACKUP_ENTRY_REMOVEPROPERTY);
+	journal_field(propName, nPropName);
+	journal_field(accName, nAccName);
+	journal_field(oldValue, nOldValue);
+	commitbackup();
+	secure_free(oldValue, nOldValue + 1);
 }
 
 void
@@ -362,24 +262,49 @@ remove_account(const struct branch *branch, struct value *values)
 {
 	char *name;
 	U32 nName;
+	struct account acc;
+	char *copy = NULL;
 
 	name = values[0].word;
 	nName = values[0].nWord;
-	appendrealpath(name, nName);
-	if(remove(path))
+	// the mapping outlives the account so its data can be recorded in the backup
+	if(account_open(name, nName, &acc))
 	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nCouldn't remove account '%.*s'", nName, name);
+		outattr(ATTR_ERROR);
+		outprintf("\nCouldn't remove account '%.*s' (%s)", nName, name, strerror(errno));
+		return;
 	}
-	else
+	// except a vault record, vault_remove zeroes it and the mapping shows that
+	if(fdVault != ERR && !acc.plain)
+	{
+		copy = secure_alloc(MAX(acc.nData, 1));
+		if(!copy)
+		{
+			outattr(ATTR_ERROR);
+			outprintf("\nCouldn't remove account '%.*s' (%s)", nName, name, strerror(errno));
+			account_close(&acc);
+			return;
+		}
+		memcpy(copy, acc.data, acc.nData);
+	}
+	if(account_delete(name, nName))
 	{
-		wattrset(out, ATTR_LOG);
-		wprintw(out, "\nSuccessfully removed account '%.*s'", nName, name);
-		write(fdBackup, &(char) { BACKUP_ENTRY_REMOVEACCOUNT }, 1);
-		write(fdBackup, &(time_t) { time(NULL) }, sizeof(time_t));
-		write(fdBackup, name, nName);
-		write(fdBackup, &(char) { 0 }, 1);
+		outattr(ATTR_ERROR);
+		outprintf("\nCouldn't remove account '%.*s' (%s)", nName, name, strerror(errno));
+		if(copy)
+			secure_free(copy, MAX(acc.nData, 1));
+		account_close(&acc);
+		return;
 	}
+	outattr(ATTR_LOG);
+	outprintf("\nSuccessfully removed account '%.*s'", nName, name);
+	journal_begin(BACKUP_ENTRY_REMOVEACCOUNT);
+	journal_field(name, nName);
+	journal_field(copy ? copy : acc.data, acc.nData);
+	commitbackup();
+	if(copy)
+		secure_free(copy, MAX(acc.nData, 1));
+	account_close(&acc);
 }
 
 void
@@ -387,24 +312,30 @@ remove_backup(const struct branch *branch, struct value *values)
 {
 	int ans;
 
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nAre you sure you want to remove the backup? [Yn]");
-	wgetch(out);
+	outattr(ATTR_LOG);
+	outprintf("\nAre you sure you want to remove the backup? [Yn]");
+	ans = outask();
 	if(ans != 'Y')
 	{
-		wprintw(out, "\nCancelled removal of backup");
+		outprintf("\nCancelled removal of backup");
 		return;
 	}
 	appendrealpath(".backup", sizeof(".backup") - 1);
 	if(remove(path))
 	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nFailed to remove backup (%s)", strerror(errno));
+		outattr(ATTR_ERROR);
+		outprintf("\nFailed to remove backup (%s)", strerror(errno));
 	}
 	else
 	{
-		wattrset(out, ATTR_LOG);
-		wprintw(out, "\nBackup was removed");
+		outattr(ATTR_LOG);
+		outprintf("\nBackup was removed");
+		// start a new backup right away so later entries don't go into the removed file
+		if(journal_open(path))
+		{
+			outattr(ATTR_FATAL);
+			outprintf("\nUnable to create a new backup file (%s)", strerror(errno));
+		}
 	}
 }
 
@@ -413,150 +344,473 @@ info_account(const struct branch *branch, struct value *values)
 {
 	char *accName;
 	U32 nAccName;
-	int fd;
-	ssize_t nRead;
+	struct account acc;
+	struct record rec;
+	int r;
 
 	accName = values[0].word;
 	nAccName = values[0].nWord;
-	appendrealpath(accName, nAccName);
-	fd = open(path, O_RDONLY);
-	if(fd == ERR)
+	if(account_open(accName, nAccName, &acc))
 	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nCouldn't open account '%.*s' ('%s')", nAccName, accName, strerror(errno));
+		outattr(ATTR_ERROR);
+		outprintf("\nCouldn't open account '%.*s' ('%s')", nAccName, accName, strerror(errno));
 		return;
 	}
-	wattrset(out, ATTR_LOG);
-	path[sizeof(path) - 1] = 0;
-	nRead = read(fd, path, sizeof(path) - 1);
-	while(nRead > 0)
+	outattr(ATTR_LOG);
+	while((r = account_next(&acc, &rec)) > 0)
 	{
-		char *name;
-		U32 nName;
-		U32 nValue;
-
-		name = path;
-		nName = strlen(path);
-		if(nName > nRead)
-			goto corrupt;
-		wprintw(out, "\n%.*s = ", nName, name);
-		nRead -= nName + 1;
-		memcpy(path, path + nName + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-		if(!nRead)
-			goto corrupt;
-		nValue = strlen(path);
-		wprintw(out, "%.*s", nValue, path);
-		while(nValue == sizeof(path) - 1)
-		{
-			nRead = read(fd, path, sizeof(path) - 1);
-			nValue = strlen(path);
-			if(nValue > nRead)
-				goto corrupt;
-			wprintw(out, "%.*s", nValue, path);
-		}
-		nRead -= nValue + 1;
-		memcpy(path, path + nValue + 1, nRead);
-		nRead += read(fd, path + nRead, sizeof(path) - 1 - nRead);
-	}
-	close(fd);
-	return;
-corrupt:
-	close(fd);
-	wattrset(out, ATTR_ERROR);
-	wprintw(out, "\nFile '%s/%.*s' is corrupt", realPath, nAccName, accName);
-}
-
-void info_backup(const struct branch *branch, struct value *values)
-{
-	ssize_t nRead;
-	char *ptr;
+		const struct field fields[] = {
+			{ "account", accName, nAccName },
+			{ "name", rec.name, rec.nName },
+			{ "value", rec.value, rec.nValue },
+		};
+
+		if(outrecord("property", fields, ARRLEN(fields)))
+			continue;
+		outprintf("\n%.*s = ", rec.nName, rec.name);
+		outwrite(rec.value, rec.nValue);
+	}
+	if(r == ERR)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nFile '%s/%.*s' is corrupt (offset: %zu)", realPath, nAccName, accName, acc.pos);
+	}
+	account_close(&acc);
+}
+
+static void
+printentry(const struct journal_entry *e)
+{
+	struct tm *tm;
+	char strTime[100];
+
+	switch(e->id)
+	{
+	case BACKUP_ENTRY_ADDACCOUNT:
+		outattr(ATTR_ADD);
+		outprintf("Added account '%.*s'", e->fields[0].nData, e->fields[0].data);
+		break;
+	case BACKUP_ENTRY_REMOVEACCOUNT:
+		outattr(ATTR_SUB);
+		outprintf("Removed account '%.*s'", e->fields[0].nData, e->fields[0].data);
+		break;
+	case BACKUP_ENTRY_ADDPROPERTY:
+		outattr(ATTR_ADD);
+		outprintf("Added property '%.*s' to account '%.*s' with value '",
+				e->fields[0].nData, e->fields[0].data, e->fields[1].nData, e->fields[1].data);
+		outwrite(e->fields[2].data, e->fields[2].nData);
+		outstr("'");
+		break;
+	case BACKUP_ENTRY_REMOVEPROPERTY:
+		outattr(ATTR_SUB);
+		outprintf("Removed property '%.*s' from account '%.*s'",
+				e->fields[0].nData, e->fields[0].data, e->fields[1].nData, e->fields[1].data);
+		break;
+	case BACKUP_ENTRY_SNAPSHOT:
+		outattr(ATTR_LOG);
+		outprintf("Snapshot of account '%.*s'", e->fields[0].nData, e->fields[0].data);
+		break;
+	case BACKUP_ENTRY_CHECKPOINT:
+	{
+		U64 nAccounts;
+
+		memcpy(&nAccounts, e->fields[0].data, sizeof(nAccounts));
+		outattr(ATTR_LOG);
+		outprintf("Checkpoint after %lu accounts", nAccounts);
+		break;
+	}
+	case BACKUP_ENTRY_IMPORT:
+		outattr(ATTR_ADD);
+		outprintf("Imported %u accounts", import_count(e->fields[0].data, e->fields[0].nData));
+		break;
+	default:
+		outattr(ATTR_ERROR);
+		outprintf("Unknown entry (%u)", e->id);
+	}
+	outattr(ATTR_LOG);
+	tm = localtime(&e->time);
+	strftime(strTime, sizeof(strTime), "%F %r", tm);
+	outprintf("\t%s", strTime);
+}
+
+static bool
+hasfields(const struct journal_entry *e)
+{
+	switch(e->id)
+	{
+	case BACKUP_ENTRY_ADDACCOUNT:
+	case BACKUP_ENTRY_REMOVEACCOUNT:
+		return e->nFields >= 1;
+	case BACKUP_ENTRY_ADDPROPERTY:
+		return e->nFields >= 3;
+	case BACKUP_ENTRY_REMOVEPROPERTY:
+	case BACKUP_ENTRY_SNAPSHOT:
+		return e->nFields >= 2;
+	case BACKUP_ENTRY_CHECKPOINT:
+		return e->nFields >= 1 && e->fields[0].nData == sizeof(U64);
+	case BACKUP_ENTRY_IMPORT:
+		return e->nFields >= 1;
+	}
+	return true;
+}
+
+// writes the entry as a record when the sink takes records
+static bool
+recordentry(const struct journal_entry *e, U32 iEvent, bool undone)
+{
+	static const char *const operations[] = {
+		[BACKUP_ENTRY_ADDACCOUNT] = "add account",
+		[BACKUP_ENTRY_REMOVEACCOUNT] = "remove account",
+		[BACKUP_ENTRY_ADDPROPERTY] = "add property",
+		[BACKUP_ENTRY_REMOVEPROPERTY] = "remove property",
+		[BACKUP_ENTRY_SNAPSHOT] = "snapshot",
+		[BACKUP_ENTRY_CHECKPOINT] = "checkpoint",
+		[BACKUP_ENTRY_IMPORT] = "import",
+	};
+	char strIndex[12], strTime[24], strCount[24];
+	struct field fields[7];
+	U32 nFields = 0;
+	const char *op;
+
+	if(!sink->record)
+		return false;
+	op = e->id < ARRLEN(operations) && operations[e->id] ? operations[e->id] : "unknown";
+	fields[nFields++] = (struct field) { "index", strIndex,
+		snprintf(strIndex, sizeof(strIndex), "%u", iEvent), true };
+	fields[nFields++] = (struct field) { "operation", op, strlen(op) };
+	fields[nFields++] = (struct field) { "time", strTime,
+		snprintf(strTime, sizeof(strTime), "%lld", (long long) e->time), true };
+	fields[nFields++] = undone ? (struct field) { "undone", "true", 4, true } :
+		(struct field) { "undone", "false", 5, true };
+	switch(e->id)
+	{
+	case BACKUP_ENTRY_ADDPROPERTY:
+		fields[nFields++] = (struct field) { "value", e->fields[2].data, e->fields[2].nData };
+		/* fall through */
+	case BACKUP_ENTRY_REMOVEPROPERTY:
+		fields[nFields++] = (struct field) { "name", e->fields[0].data, e->fields[0].nData };
+		fields[nFields++] = (struct field) { "account", e->fields[1].data, e->fields[1].nData };
+		break;
+	case BACKUP_ENTRY_ADDACCOUNT:
+	case BACKUP_ENTRY_REMOVEACCOUNT:
+	case BACKUP_ENTRY_SNAPSHOT:
+		fields[nFields++] = (struct field) { "account", e->fields[0].data, e->fields[0].nData };
+		break;
+	case BACKUP_ENTRY_CHECKPOINT:
+	{
+		U64 nAccounts;
+
+		memcpy(&nAccounts, e->fields[0].data, sizeof(nAccounts));
+		fields[nFields++] = (struct field) { "accounts", strCount,
+			snprintf(strCount, sizeof(strCount), "%lu", nAccounts), true };
+		break;
+	}
+	case BACKUP_ENTRY_IMPORT:
+		fields[nFields++] = (struct field) { "accounts", strCount, snprintf(strCount, sizeof(strCount),
+				"%u", import_count(e->fields[0].data, e->fields[0].nData)), true };
+		break;
+	}
+	return outrecord("entry", fields, nFields);
+}
+
+// prints all entries by reading through the backup, used when there is no index
+static void
+dumpbackup(void)
+{
+	struct journal j;
+	struct journal_entry e;
+	int r;
 	U32 iEvent = 1;
+	const U64 nApplied = journal_applied();
 
-	if(lseek(fdBackup, 0, SEEK_SET))
-	{
-		wattrset(out, ATTR_ERROR);
-		wprintw(out, "\nUnable to read backup file (%s)", strerror(errno));
-		return;
-	}
-	path[sizeof(path) - 1] = 0;
-	nRead = read(fdBackup, path, sizeof(path) - 1);
-	while(nRead > 0)
-	{
-		U32 l;
-		U8 id;
-		time_t time;
-		struct tm *tm;
-		char strTime[100];
-
-		ptr = path;
-		id = *(ptr++);
-		time = *(time_t*) ptr;
-		ptr += sizeof(time_t);
-		nRead -= sizeof(time_t) + 1;
-		l = strlen(ptr);
-		if(l >= nRead)
-			goto corrupt;
-		wattrset(out, ATTR_LOG);
-		wprintw(out, "\n%u - ", iEvent++);
-		l++;
-		nRead -= l;
-		switch(id)
-		{
-		case BACKUP_ENTRY_ADDACCOUNT:
-			wattrset(out, ATTR_ADD);
-			wprintw(out, "Added account '%s'", ptr);
-			ptr += l;
-			break;
-		case BACKUP_ENTRY_REMOVEACCOUNT:
-			wattrset(out, ATTR_SUB);
-			wprintw(out, "Removed account '%s'", ptr);
-			ptr += l;
-			break;
-		case BACKUP_ENTRY_ADDPROPERTY:
-			wattrset(out, ATTR_ADD);
-			wprintw(out, "Added property '%s'", ptr);
-			ptr += l;
-			wprintw(out, " to account '%s'", ptr);
-			l = strlen(ptr) + 1;
-			nRead -= l;
-			ptr += l;
-			waddstr(out, " with value '");
-			memmove(path, ptr, nRead);
-			nRead += read(fdBackup, path + nRead, sizeof(path) - 1 - nRead);
-			waddstr(out, path);
-			while(strlen(path) == sizeof(path) - 1)
+	if(journal_map(&j))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to read backup file (%s)", strerror(errno));
+		return;
+	}
+	while((r = journal_next(&j, &e)))
+	{
+		if(r == ERR || !hasfields(&e))
+		{
+			const size_t off = r == ERR ? j.pos : e.off;
+
+			outattr(ATTR_ERROR);
+			if(r == ERR && !journal_recover(&j))
 			{
-				nRead = read(fdBackup, path, sizeof(path) - 1);
-				if(strlen(path) > nRead)
-					goto corrupt;
-				waddstr(out, path);
+				outprintf("\nCorrupt backup entry at offset %zu, there are no valid entries after it", off);
+				break;
 			}
-			l = strlen(path) + 1;
-			nRead -= l;
-			ptr = path + l;
+			outprintf("\nCorrupt backup entry at offset %zu, skipped %zu bytes", off, j.pos - off);
+			continue;
+		}
+		if(!recordentry(&e, iEvent, iEvent > nApplied && journal_entries()))
+		{
+			outattr(ATTR_LOG);
+			outprintf("\n%u - ", iEvent);
+			if(iEvent > nApplied && journal_entries())
+				outstr("(undone) ");
+			printentry(&e);
+		}
+		iEvent++;
+	}
+	journal_unmap(&j);
+}
+
+// renders the entries [top, top + number of rows - 1) and a status line below them,
+// only the visible entries are read from the backup
+static void
+drawbackup(WINDOW *win, U64 top)
+{
+	const int nRows = getmaxy(win) - 1;
+	const U64 nEntries = journal_entries();
+	const U64 nApplied = journal_applied();
+	struct journal_entry e;
+	int r;
+
+	werase(win);
+	for(r = 0; r < nRows && top + r < nEntries; r++)
+	{
+		const U64 i = top + r;
+
+		// an entry that is too long for a line is cut off by the next one
+		wmove(win, r, 0);
+		wattrset(win, ATTR_LOG);
+		wprintw(win, "%lu - ", i + 1);
+		if(i >= nApplied)
+			waddstr(win, "(undone) ");
+		if(journal_read(i, &e))
+		{
+			wattrset(win, ATTR_ERROR);
+			wprintw(win, "Unable to read the entry (%s)", strerror(errno));
+		}
+		else if(!hasfields(&e))
+		{
+			wattrset(win, ATTR_ERROR);
+			waddstr(win, "Corrupt backup entry");
+		}
+		else
+		{
+			// the curses sink draws into out
+			WINDOW *const pad = out;
+
+			out = win;
+			printentry(&e);
+			out = pad;
+		}
+		wclrtoeol(win);
+	}
+	wmove(win, nRows, 0);
+	wclrtoeol(win);
+	wattrset(win, ATTR_HIGHLIGHT);
+	wprintw(win, "Entries %lu-%lu of %lu", top + 1, top + r, nEntries);
+	wattrset(win, ATTR_DEFAULT);
+	waddstr(win, "  arrows, page up/down, home/end scroll, g goes to an entry, q quits");
+	wrefresh(win);
+}
+
+void
+info_backup(const struct branch *branch, struct value *values)
+{
+	const U64 nEntries = journal_entries();
+	WINDOW *win;
+	U64 top, maxTop;
+	int nRows;
+	int ch;
+
+	if(!nEntries || sink != &cursesSink)
+	{
+		dumpbackup();
+		return;
+	}
+	win = newwin(LINES - inputHeight, COLS, 0, 0);
+	keypad(win, true);
+	nRows = MAX(getmaxy(win) - 1, 1);
+	maxTop = nEntries > (U64) nRows ? nEntries - nRows : 0;
+	// start with the latest entries
+	top = maxTop;
+	while(1)
+	{
+		drawbackup(win, top);
+		ch = wgetch(win);
+		switch(ch)
+		{
+		case KEY_UP:
+			if(top)
+				top--;
+			break;
+		case KEY_DOWN:
+			top = MIN(top + 1, maxTop);
+			break;
+		case KEY_PPAGE:
+			top = top > (U64) nRows ? top - nRows : 0;
+			break;
+		case KEY_NPAGE:
+			top = MIN(top + nRows, maxTop);
 			break;
-		case BACKUP_ENTRY_REMOVEPROPERTY:
-			wattrset(out, ATTR_SUB);
-			wprintw(out, "Removed property '%s'", ptr);
-			ptr += l;
-			wprintw(out, " from account '%s'", ptr);
-			l = strlen(ptr) + 1;
-			nRead -= l;
-			ptr += l;
+		case KEY_HOME:
+			top = 0;
+			break;
+		case KEY_END:
+			top = maxTop;
+			break;
+		case 'g':
+		{
+			char num[24];
+			U64 i;
+
+			wmove(win, nRows, 0);
+			wclrtoeol(win);
+			wattrset(win, ATTR_HIGHLIGHT);
+			waddstr(win, "Go to entry: ");
+			echo();
+			ch = wgetnstr(win, num, sizeof(num) - 1);
+			noecho();
+			if(ch == ERR)
+				break;
+			i = strtoull(num, NULL, 10);
+			if(i)
+				top = MIN(i - 1, maxTop);
 			break;
 		}
-		wattrset(out, ATTR_LOG);
-		tm = localtime(&time);
-		strftime(strTime, sizeof(strTime), "%F %r", tm);
-		wprintw(out, "\t%s", strTime);
-		memmove(path, ptr, nRead);
-		nRead += read(fdBackup, path + nRead, sizeof(path) - 1 - nRead);
+		case 'q':
+		case '\n':
+		case 0x1B:
+			delwin(win);
+			// the output pad has to be drawn again over the viewer
+			touchwin(out);
+			return;
+		}
+	}
+}
+
+// applies an entry to the accounts again or reverts it
+static int
+replay(const struct journal_entry *e, bool undo)
+{
+	const char *accName, *propName;
+	U32 nAccName, nPropName;
+	struct account acc;
+
+	if(!hasfields(e))
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	switch(e->id)
+	{
+	case BACKUP_ENTRY_ADDACCOUNT:
+	case BACKUP_ENTRY_REMOVEACCOUNT:
+		accName = e->fields[0].data;
+		nAccName = e->fields[0].nData;
+		if(undo == (e->id == BACKUP_ENTRY_REMOVEACCOUNT))
+			return account_create(accName, nAccName,
+					e->nFields > 1 ? e->fields[1].data : NULL,
+					e->nFields > 1 ? e->fields[1].nData : 0);
+		// never throw away properties that have no entry to restore them from
+		if(e->id == BACKUP_ENTRY_ADDACCOUNT)
+		{
+			if(account_open(accName, nAccName, &acc))
+				return ERR;
+			account_close(&acc);
+			if(acc.nData)
+			{
+				errno = ENOTEMPTY;
+				return ERR;
+			}
+		}
+		return account_delete(accName, nAccName);
+	case BACKUP_ENTRY_ADDPROPERTY:
+	case BACKUP_ENTRY_REMOVEPROPERTY:
+		propName = e->fields[0].data;
+		nPropName = e->fields[0].nData;
+		accName = e->fields[1].data;
+		nAccName = e->fields[1].nData;
+		if(undo == (e->id == BACKUP_ENTRY_REMOVEPROPERTY))
+		{
+			if(e->nFields < 3)
+			{
+				errno = ENODATA;
+				return ERR;
+			}
+			return property_add(accName, nAccName, propName, nPropName,
+					e->fields[2].data, e->fields[2].nData);
+		}
+		return property_remove(accName, nAccName, propName, nPropName, NULL, NULL);
+	case BACKUP_ENTRY_IMPORT:
+		return undo ? import_undo(e->fields[0].data, e->fields[0].nData) :
+			import_redo(e->fields[0].data, e->fields[0].nData);
+	}
+	errno = EINVAL;
+	return ERR;
+}
+
+static void
+backup_step(bool undo)
+{
+	const U64 nApplied = journal_applied();
+	const U64 i = undo ? nApplied - 1 : nApplied;
+	struct journal_entry e;
+
+	if(undo ? !nApplied : nApplied == journal_entries())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nThere is nothing to %s", undo ? "undo" : "redo");
+		return;
+	}
+	if(undo && nApplied <= journal_checkpoint())
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThere is nothing to undo, older entries were compacted into a snapshot");
+		return;
+	}
+	if(journal_read(i, &e))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to read backup entry %lu (%s)", i + 1, strerror(errno));
+		return;
+	}
+	if(replay(&e, undo))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to %s entry %lu (%s)", undo ? "undo" : "redo", i + 1, strerror(errno));
+		return;
+	}
+	if(journal_setapplied(undo ? i : i + 1))
+	{
+		outattr(ATTR_FATAL);
+		outprintf("\nUnable to update the backup index (%s)", strerror(errno));
+	}
+	outattr(ATTR_LOG);
+	outprintf("\n%s: ", undo ? "Undone" : "Redone");
+	printentry(&e);
+}
+
+void
+backup_undo(const struct branch *branch, struct value *values)
+{
+	backup_step(true);
+}
+
+void
+backup_redo(const struct branch *branch, struct value *values)
+{
+	backup_step(false);
+}
+
+void
+backup_compact(const struct branch *branch, struct value *values)
+{
+	if(journal_compact())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to compact the backup (%s)", strerror(errno));
+		return;
 	}
-	return;
-corrupt:
-	wattrset(out, ATTR_ERROR);
-	waddstr(out, "\nCorrupt backup file, you must manually fix it ('help backup fix' for more info)");
+	outattr(ATTR_LOG);
+	outstr("\nCompacted the backup");
+	if(journal_checkpoint())
+		outprintf(" into a snapshot of %lu accounts", journal_checkpoint() - 1);
 }
 
 void
@@ -569,7 +823,11 @@ help(const struct branch *helpBranch, struct input *input)
 		{ "variables", "variables can be set using the 'set' command. Availabe variables are:"
 			"\n\tarea\t\tArea of the output window"
 			"\n\tinputHeight\tHeight of the input window"
-	   		"\nYou may also set your own variables using 'set'" },
+			"\n\tsyncEntries\tSync the backup after this many entries (0 disables)"
+			"\n\tsyncInterval\tSync the backup after this many milliseconds (0 disables)"
+			"\n\tcompactEntries\tCompact the backup after this many entries (0 disables)"
+	   		"\nYou may also set your own variables using 'set'"
+			"\nWriting $name inside a command inserts the value of a variable" },
 		{ "accounts", "accounts are combinations of data like password username, dob that make up an online presence" },
 		{ "backups", "backups are local files that store all actions you perform" },
 		{ "tree", "shows a tree view of all commands" },
@@ -589,8 +847,8 @@ help(const struct branch *helpBranch, struct input *input)
 			if(!strncmp(general_infos[i].name, value.word, value.nWord) &&
 					!general_infos[i].name[value.nWord])
 			{
-				wattrset(out, ATTR_LOG);
-				wprintw(out, "\n%s", general_infos[i].info);
+				outattr(ATTR_LOG);
+				outprintf("\n%s", general_infos[i].info);
 				return;
 			}
 	}
@@ -600,27 +858,27 @@ help(const struct branch *helpBranch, struct input *input)
 	{
 		if(!branch->description)
 		{ // this means we stayed in root
-			wattrset(out, ATTR_LOG);
-			waddstr(out, "\nPassword manager " VERSION);
-			wattrset(out, ATTR_DEFAULT);
-			waddstr(out, "\nUse this as a manager for your accounts; you can do that by entering commands like help."
+			outattr(ATTR_LOG);
+			outstr("\nPassword manager " VERSION);
+			outattr(ATTR_DEFAULT);
+			outstr("\nUse this as a manager for your accounts; you can do that by entering commands like help."
 					" Commands are based on a 'branch' system, meaning a series of commands follows a specific branch; type 'tree' to visualize the available command tree."
 					" Some commands also expect tokens right after it, for instance 'account' needs a name(word) argument."
 					"\nFor more information put any of these words afer 'help'"
 				);
 			for(U32 i = 0; i < ARRLEN(general_infos); i++)
 			{
-				wattrset(out, ATTR_DEFAULT);
-				waddstr(out, "\n\thelp ");
-				wattrset(out, ATTR_HIGHLIGHT);
-				waddstr(out, general_infos[i].name);
+				outattr(ATTR_DEFAULT);
+				outstr("\n\thelp ");
+				outattr(ATTR_HIGHLIGHT);
+				outstr(general_infos[i].name);
 			}
 
 		}
 		else
 		{
-			wattrset(out, ATTR_LOG);
-			wprintw(out, "\n%s", branch->description);
+			outattr(ATTR_LOG);
+			outprintf("\n%s", branch->description);
 		}
 	}
 }
@@ -631,26 +889,22 @@ tree_print(const struct branch *branch, U32 depth)
 	for(const struct branch *s = branch->subnodes, *e = s + branch->nSubnodes; s != e; s++)
 	{
 		if(branch->nSubnodes == 1)
-			wprintw(out, " ");
+			outprintf(" ");
 		else
 		{
-			wprintw(out, "\n");
+			outprintf("\n");
 			for(U32 i = 0; i < depth; i++)
-				wprintw(out, " |");
+				outprintf(" |");
 		}
-		wattrset(out, ATTR_HIGHLIGHT);
-		wprintw(out, "%s", s->name);
-		for(U32 i = 0; i < ARRLEN(dependencies); i++)
-			if(!strcmp(dependencies[i].name, s->name))
-			{
-				wprintw(out, " [%s]", dependencies[i].description);
-				break;
-			}
-		wattrset(out, ATTR_DEFAULT);
+		outattr(ATTR_HIGHLIGHT);
+		outprintf("%s", s->name);
+		if(s->dependency)
+			outprintf(" [%s]", s->dependency->description);
+		outattr(ATTR_DEFAULT);
 		if(!IS_EXEC_BRANCH(s))
 			tree_print(s, depth + 1);
 		else
-			wprintw(out, " %s", s->description);
+			outprintf(" %s", s->description);
 	}
 }
 
@@ -660,189 +914,1066 @@ tree(const struct branch *branch, struct value *values)
 	tree_print(root, 0);
 }
 
-void
-list_account(const struct branch *branch, struct value *values)
+static void
+printaccount(const char *name, U32 nName)
 {
-	DIR *dir;
-	struct dirent *dirent;
-
-	dir = opendir(realPath);
-	if(!dir)
-		return;
-	wattrset(out, ATTR_LOG);
-	while((dirent = readdir(dir)))
-		if(dirent->d_type == DT_REG && !strchr(dirent->d_name, '.'))
-			wprintw(out, "\n\t%s", dirent->d_name);
-	closedir(dir);
+	if(!outrecord("account", &(struct field) { "name", name, nName }, 1))
+		outprintf("\n\t%.*s", nName, name);
 }
 
-void
-cmd_quit(const struct branch *branch, struct value *values)
+static int
+list_one_account(const char *name, U32 nName, void *arg)
 {
-	int fd;
-
-	close(fdBackup);
-	appendrealpath(".history", 8);
-	fd = open(path, O_WRONLY | O_CREAT, S_IWUSR | S_IRUSR);
-	write(fd, &input.nextHistory, sizeof(input.nextHistory));
-	write(fd, input.history, sizeof(input.history));
-	close(fd);
-	endwin();
-	exit(0);
+	printaccount(name, nName);
+	return 0;
 }
 
 void
-cmd_clear(const struct branch *branch, struct value *values)
+list_account(const struct branch *branch, struct value *values)
 {
-	wclear(out);
+	outattr(ATTR_LOG);
+	if(names_foreach(list_one_account, NULL))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to list the accounts (%s)", strerror(errno));
+	}
 }
 
-int
-main(void)
+static int
+search_one(const char *accName, U32 nAccName, const char *name, U32 nName, void *arg)
 {
-	bool isUtf8;
-	char *locale;
-	const char * const homePath = getenv("HOME");
-	int fd;
-
-	locale = setlocale(LC_ALL, "");
+	const struct field fields[] = {
+		{ "account", accName, nAccName },
+		{ "name", name, nName },
+	};
 
-	initscr();
-	raw();
-	noecho();
-	
-	input.win = newwin(inputHeight, COLS, LINES - inputHeight, 0);
-	keypad(input.win, true);
-	input.buf = malloc(MAX_INPUT);
+	(*(U32*) arg)++;
+	if(outrecord("property", fields, ARRLEN(fields)))
+		return 0;
+	outprintf("\n\t%.*s", nAccName, accName);
+	outattr(ATTR_DEFAULT);
+	outprintf(" %.*s", nName, name);
+	outattr(ATTR_LOG);
+	return 0;
+}
 
-	out = newpad(area / COLS, COLS);
-	scrollok(out, true);
+void
+search_properties(const struct branch *branch, struct value *values)
+{
+	U32 nFound = 0;
 
-	waddstr(out, "Doing setup...");
-	waddstr(out, "\nChecking for color support...");
-	if(has_colors())
+	outattr(ATTR_LOG);
+	if(search_query(values[0].word, values[0].nWord, search_one, &nFound))
 	{
-		start_color();
-		init_pair(1, COLOR_GREEN, COLOR_BLACK);
-		init_pair(2, COLOR_MAGENTA, COLOR_BLACK);
+		outattr(ATTR_ERROR);
+		if(errno == EINVAL)
+			outprintf("\n'%.*s' has nothing to search for", values[0].nWord, values[0].word);
+		else
+			outprintf("\nUnable to search the accounts (%s)", strerror(errno));
+		return;
+	}
+	if(!nFound)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nNo property contains '%.*s'", values[0].nWord, values[0].word);
+	}
+}
+
+// number of accounts find shows at most
+#define MAX_FOUND 20
+
+void
+find_account(const struct branch *branch, struct value *values)
+{
+	U32 found[MAX_FOUND];
+	U32 nFound;
+
+	if(names_load())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to list the accounts (%s)", strerror(errno));
+		return;
+	}
+	nFound = names_find(values[0].word, values[0].nWord, found, ARRLEN(found));
+	if(!nFound)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nNo account matches '%.*s'", values[0].nWord, values[0].word);
+		return;
+	}
+	outattr(ATTR_LOG);
+	for(U32 i = 0; i < nFound; i++)
+	{
+		const char *name;
+		U32 nName;
+
+		name = names_get(found[i], &nName);
+		printaccount(name, nName);
+	}
+}
+
+void
+import_accounts(const struct branch *branch, struct value *values)
+{
+	char filePath[PATH_MAX];
+	struct import imp;
+	int r;
+
+	if(values[0].nString >= sizeof(filePath))
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThe path is too long");
+		return;
+	}
+	memcpy(filePath, values[0].string, values[0].nString);
+	filePath[values[0].nString] = 0;
+	r = import_file(filePath, &imp);
+	// whatever was created is undone as one
+	if(imp.nAccounts)
+		commitbackup();
+	if(r)
+	{
+		outattr(ATTR_ERROR);
+		if(imp.errLine)
+			outprintf("\nNothing was imported, line %u of '%s' is invalid (%s)", imp.errLine, filePath,
+					errno == EINVAL ? "names must be words" :
+					errno == EEXIST ? "the property appears twice" :
+					errno == ENODATA ? "an account and a property are needed" :
+					errno == EILSEQ ? "malformed" : strerror(errno));
+		else if(imp.nErrAccount)
+			outprintf("\nUnable to create account '%.*s' (%s), stopped after %u accounts",
+					imp.nErrAccount, imp.errAccount, strerror(errno), imp.nAccounts);
+		else
+			outprintf("\nUnable to import '%s' (%s)", filePath,
+					errno == ENOKEY ? "the archive is encrypted, unlock the accounts first" :
+					errno == EBADMSG ? "the archive was encrypted with another passphrase" :
+					errno == EILSEQ ? "the file is cut off" : strerror(errno));
+		return;
+	}
+	outattr(ATTR_LOG);
+	outprintf("\nImported %u properties into %u new accounts", imp.nProperties, imp.nAccounts);
+	if(imp.nSkipped)
+		outprintf(", %u accounts already existed and were left as they are", imp.nSkipped);
+}
+
+void
+export_accounts(const struct branch *branch, struct value *values)
+{
+	char filePath[PATH_MAX];
+	struct export exp;
+	const int format = !strcmp(branch->name, "csv") ? EXPORT_CSV :
+		!strcmp(branch->name, "json") ? EXPORT_JSON : EXPORT_ARCHIVE;
+
+	if(values[0].nString >= sizeof(filePath))
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThe path is too long");
+		return;
+	}
+	memcpy(filePath, values[0].string, values[0].nString);
+	filePath[values[0].nString] = 0;
+	if(export_file(filePath, format, &exp))
+	{
+		outattr(ATTR_ERROR);
+		if(exp.nErrAccount)
+			outprintf("\nUnable to read account '%.*s' (%s), nothing was exported",
+					exp.nErrAccount, exp.errAccount, strerror(errno));
+		else
+			outprintf("\nUnable to write '%s' (%s)", filePath, strerror(errno));
+		return;
+	}
+	outattr(ATTR_LOG);
+	outprintf("\nExported %u properties of %u accounts to '%s'", exp.nProperties, exp.nAccounts, filePath);
+	if(format == EXPORT_ARCHIVE && cryptActive)
+		outstr(", the archive is encrypted");
+	if(exp.nLeftOut)
+		outprintf(", %u accounts without properties were left out", exp.nLeftOut);
+}
+
+void
+vault_migrate(const struct branch *branch, struct value *values)
+{
+	if(fdVault != ERR)
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThe accounts are already stored inside a vault");
+		return;
+	}
+	appendrealpath(".vault", sizeof(".vault") - 1);
+	if(vault_convert(realPath, path))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to move the accounts into '%s' (%s)", path, strerror(errno));
+		return;
+	}
+	// the vault is written without being closed, which needs other events
+	watch_open(realPath);
+	outattr(ATTR_LOG);
+	outprintf("\nMoved all accounts into '%s'", path);
+}
+
+static int
+encrypt_one(const char *name, U32 nName, void *arg)
+{
+	struct account acc;
+	int r;
+
+	if(account_open(name, nName, &acc))
+		r = ERR;
+	else
+	{
+		// writing the data again encrypts it
+		r = account_write(name, nName, &(struct iovec) { (void*) acc.data, acc.nData }, 1);
+		account_close(&acc);
+	}
+	if(r)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to encrypt account '%.*s' (%s)", nName, name, strerror(errno));
+		outattr(ATTR_LOG);
+		return 0;
+	}
+	(*(U32*) arg)++;
+	return 0;
+}
+
+void
+vault_encrypt(const struct branch *branch, struct value *values)
+{
+	char pass[MAX_INPUT], again[MAX_INPUT];
+	int nPass, nAgain;
+	U32 nEncrypted = 0;
+	int r;
+
+	if(cryptActive)
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThe accounts are already encrypted");
+		return;
+	}
+	outattr(ATTR_LOG);
+	outstr("\nNew passphrase: ");
+	nPass = outsecret(pass, sizeof(pass));
+	outstr("\nRepeat the passphrase: ");
+	nAgain = outsecret(again, sizeof(again));
+	r = nPass == nAgain && !memcmp(pass, again, MAX(nPass, 0));
+	explicit_bzero(again, sizeof(again));
+	if(nPass <= 0 || !r)
+	{
+		explicit_bzero(pass, sizeof(pass));
+		outattr(ATTR_ERROR);
+		outstr(nPass <= 0 ? "\nThe passphrase can't be empty" : "\nThe passphrases don't match");
+		return;
+	}
+	appendrealpath(".crypt", sizeof(".crypt") - 1);
+	r = crypt_create(path, pass, nPass);
+	explicit_bzero(pass, sizeof(pass));
+	if(r)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to create the key file '%s' (%s)", path, strerror(errno));
+		return;
+	}
+	// the search index holds values and is only kept in memory from now on
+	search_invalidate();
+	outattr(ATTR_LOG);
+	if(names_foreach(encrypt_one, &nEncrypted))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to list the accounts (%s)", strerror(errno));
+		return;
+	}
+	outprintf("\nEncrypted %u accounts, new accounts are encrypted as well", nEncrypted);
+	// nothing of the plaintext may stay behind in the vault or the backup
+	if(vault_compact())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to compact the vault (%s)", strerror(errno));
+	}
+	if(journal_compact())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to encrypt the backup (%s), run 'backup compact' to try again", strerror(errno));
+	}
+}
+
+// the workers of a key rotation take the next account from an atomic counter
+struct rekey {
+	U32 first, nNames;
+	U32 next;
+	U32 nDone, nSkipped, nFailed;
+	U32 nRunning;
+};
+
+static void *
+rekey_worker(void *arg)
+{
+	struct rekey *const rk = arg;
+	U32 i;
+
+	while((i = __atomic_fetch_add(&rk->next, 1, __ATOMIC_RELAXED)) < rk->nNames)
+	{
+		const char *name;
+		U32 nName;
+		char *blob, *newBlob;
+		size_t nBlob, nNewBlob;
+		int r;
+
+		name = names_get(rk->first + i, &nName);
+		if(account_readraw(name, nName, &blob, &nBlob))
+			r = ERR;
+		else
+		{
+			r = crypt_reseal(name, nName, blob, nBlob, &newBlob, &nNewBlob);
+			free(blob);
+			if(!r)
+			{
+				r = account_rewrite(name, nName, newBlob, nNewBlob);
+				free(newBlob);
+			}
+		}
+		__atomic_fetch_add(r == ERR ? &rk->nFailed : r ? &rk->nSkipped : &rk->nDone,
+				1, __ATOMIC_RELAXED);
+	}
+	crypt_threadexit();
+	__atomic_fetch_sub(&rk->nRunning, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void
+vault_rekey(const struct branch *branch, struct value *values)
+{
+	char keyPath[sizeof(path)], nextPath[sizeof(path)];
+	char pass[MAX_INPUT], again[MAX_INPUT];
+	int nPass, nAgain;
+	bool resumed;
+	struct rekey rk = { 0 };
+	pthread_t threads[64];
+	U32 nThreads;
+	int r;
+
+	if(!cryptActive)
+	{
+		outattr(ATTR_ERROR);
+		outstr("\nThe accounts are not encrypted, use 'vault encrypt' first");
+		return;
+	}
+	// an account missing from the names would keep the old key
+	if(names_load())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to list the accounts (%s)", strerror(errno));
+		return;
+	}
+	appendrealpath(".crypt", sizeof(".crypt") - 1);
+	strcpy(keyPath, path);
+	appendrealpath(".crypt.new", sizeof(".crypt.new") - 1);
+	strcpy(nextPath, path);
+	outattr(ATTR_LOG);
+	resumed = !access(nextPath, F_OK);
+	if(resumed)
+		outstr("\nResuming the interrupted key rotation");
+	outstr("\nNew passphrase: ");
+	nPass = outsecret(pass, sizeof(pass));
+	// a resumed rotation checks the passphrase against the key file it already made
+	if(!resumed)
+	{
+		outstr("\nRepeat the passphrase: ");
+		nAgain = outsecret(again, sizeof(again));
+		r = nPass == nAgain && !memcmp(pass, again, MAX(nPass, 0));
+		explicit_bzero(again, sizeof(again));
+		if(nPass <= 0 || !r)
+		{
+			explicit_bzero(pass, sizeof(pass));
+			outattr(ATTR_ERROR);
+			outstr(nPass <= 0 ? "\nThe passphrase can't be empty" : "\nThe passphrases don't match");
+			return;
+		}
+	}
+	r = nPass <= 0 ? ERR : crypt_rekeybegin(nextPath, pass, nPass, &resumed);
+	explicit_bzero(pass, sizeof(pass));
+	if(r)
+	{
+		outattr(ATTR_ERROR);
+		if(nPass > 0 && errno == EACCES)
+			outstr("\nThe passphrase is not the one the rotation was started with");
+		else
+			outprintf("\nUnable to create the key file '%s' (%s)", nextPath,
+					nPass <= 0 ? "no passphrase" : strerror(errno));
+		return;
+	}
+	rk.nNames = names_prefix("", 0, &rk.first);
+	// every account is independent, so the work is spread over all cores
+	nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	nThreads = MIN(nThreads, MIN(rk.nNames, (U32) ARRLEN(threads)));
+	nThreads = MAX(nThreads, 1);
+	rk.nRunning = nThreads;
+	for(U32 i = 0; i < nThreads; i++)
+		if(pthread_create(threads + i, NULL, rekey_worker, &rk))
+		{
+			// the threads that did start finish the work
+			__atomic_fetch_sub(&rk.nRunning, nThreads - i, __ATOMIC_RELAXED);
+			nThreads = i;
+			break;
+		}
+	if(!nThreads)
+		rekey_worker(&rk);
+	while(__atomic_load_n(&rk.nRunning, __ATOMIC_ACQUIRE))
+	{
+		if(out)
+		{
+			outprintf("\rRe-encrypted %u of %u accounts",
+					__atomic_load_n(&rk.nDone, __ATOMIC_RELAXED) +
+					__atomic_load_n(&rk.nSkipped, __ATOMIC_RELAXED), rk.nNames);
+			setoutpage(0);
+		}
+		nanosleep(&(struct timespec) { .tv_nsec = 50000000 }, NULL);
+	}
+	for(U32 i = 0; i < nThreads; i++)
+		pthread_join(threads[i], NULL);
+	if(out)
+		outstr("\r");
+	if(rk.nFailed)
+	{
+		// the next key file stays so the rotation can be finished later
+		crypt_rekeyabort();
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to re-encrypt %u of %u accounts, run 'vault rekey' again"
+				" with the same passphrase to finish", rk.nFailed, rk.nNames);
+		return;
+	}
+	if(journal_reseal())
+	{
+		crypt_rekeyabort();
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to re-encrypt the backup (%s), run 'vault rekey' again"
+				" with the same passphrase to finish", strerror(errno));
+		return;
+	}
+	if(crypt_rekeyend(keyPath, nextPath))
+	{
+		crypt_rekeyabort();
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to replace the key file '%s' (%s)", keyPath, strerror(errno));
+		return;
+	}
+	outattr(ATTR_LOG);
+	outprintf("\nRe-encrypted %u accounts with the new passphrase using %u threads", rk.nNames, MAX(nThreads, 1));
+	if(rk.nSkipped)
+		outprintf(" (%u were already done)", rk.nSkipped);
+	// the records sealed with the old key are dropped
+	if(vault_compact())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to compact the vault (%s)", strerror(errno));
+	}
+}
+
+struct check {
+	U32 first, nNames;
+	U32 next;
+	bool repair;
+	U32 nRunning;
+	U32 nChecked;
+	// the accounts with problems, in the order they were found
+	pthread_mutex_t lock;
+	struct checked {
+		U32 i;
+		int r;
+		struct damage d;
+	} *found;
+	U32 nFound, capFound;
+	// problems that couldn't be noted for lack of memory
+	U32 nLost;
+};
+
+static void *
+check_worker(void *arg)
+{
+	struct check *const c = arg;
+	U32 i;
+
+	while((i = __atomic_fetch_add(&c->next, 1, __ATOMIC_RELAXED)) < c->nNames)
+	{
+		const char *name;
+		U32 nName;
+		struct damage d;
+		int r;
+
+		name = names_get(c->first + i, &nName);
+		r = check_account(name, nName, c->repair, &d);
+		if(r)
+		{
+			pthread_mutex_lock(&c->lock);
+			if(c->nFound == c->capFound)
+			{
+				const U32 cap = MAX(c->capFound * 2, 16);
+				struct checked *const found = realloc(c->found, sizeof(*found) * cap);
+
+				if(found)
+				{
+					c->found = found;
+					c->capFound = cap;
+				}
+			}
+			if(c->nFound < c->capFound)
+				c->found[c->nFound++] = (struct checked) { i, r, d };
+			else
+				c->nLost++;
+			pthread_mutex_unlock(&c->lock);
+		}
+		__atomic_fetch_add(&c->nChecked, 1, __ATOMIC_RELAXED);
+	}
+	crypt_threadexit();
+	__atomic_fetch_sub(&c->nRunning, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int
+comparechecked(const void *a, const void *b)
+{
+	const struct checked *const ca = a, *const cb = b;
+
+	return (ca->i > cb->i) - (ca->i < cb->i);
+}
+
+void
+check_vault(const struct branch *branch, struct value *values)
+{
+	struct check c = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	struct journal_check jc;
+	pthread_t threads[64];
+	U32 nThreads, nRepaired = 0;
+	int jr;
+
+	c.repair = !strcmp(branch->name, "repair");
+	if(names_load())
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to list the accounts (%s)", strerror(errno));
+		return;
+	}
+	c.nNames = names_prefix("", 0, &c.first);
+	// every account is independent, so the work is spread over all cores
+	// while this thread goes through the backup
+	nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	nThreads = MIN(nThreads, MIN(c.nNames, (U32) ARRLEN(threads)));
+	nThreads = MAX(nThreads, 1);
+	c.nRunning = nThreads;
+	for(U32 i = 0; i < nThreads; i++)
+		if(pthread_create(threads + i, NULL, check_worker, &c))
+		{
+			__atomic_fetch_sub(&c.nRunning, nThreads - i, __ATOMIC_RELAXED);
+			nThreads = i;
+			break;
+		}
+	jr = journal_check(c.repair, &jc);
+	if(!nThreads)
+		check_worker(&c);
+	while(__atomic_load_n(&c.nRunning, __ATOMIC_ACQUIRE))
+	{
+		if(out)
+		{
+			outprintf("\rChecked %u of %u accounts", __atomic_load_n(&c.nChecked, __ATOMIC_RELAXED), c.nNames);
+			setoutpage(0);
+		}
+		nanosleep(&(struct timespec) { .tv_nsec = 50000000 }, NULL);
+	}
+	for(U32 i = 0; i < nThreads; i++)
+		pthread_join(threads[i], NULL);
+	if(out)
+		outstr("\r");
+	qsort(c.found, c.nFound, sizeof(*c.found), comparechecked);
+	for(U32 i = 0; i < c.nFound; i++)
+	{
+		const struct checked *const f = c.found + i;
+		const struct damage *const d = &f->d;
+		U32 nName;
+		const char *const name = names_get(c.first + f->i, &nName);
+
+		outattr(ATTR_ERROR);
+		if(f->r == ERR)
+			outprintf("\nUnable to read account '%.*s' (%s)", nName, name, strerror(d->err));
+		else if(d->err == EBADMSG)
+			outprintf("\nAccount '%.*s' can't be decrypted, its data was changed", nName, name);
+		else
+		{
+			outprintf("\nAccount '%.*s' is corrupt at byte %zu of %zu%s", nName, name,
+					d->off, d->nData, d->encrypted ? " (decrypted)" : "");
+			if(d->repaired)
+			{
+				outattr(ATTR_ADD);
+				outstr(", cut off after the last valid record");
+				property_invalidate(name, nName);
+				nRepaired++;
+			}
+			else if(c.repair)
+				outstr(", unable to repair it");
+		}
+	}
+	if(c.nLost)
+		outprintf("\n%u more accounts have problems", c.nLost);
+	if(jr)
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nUnable to check the backup (%s)", strerror(errno));
+	}
+	else
+	{
+		for(U32 i = 0; i < MIN(jc.nSpans, (U32) ARRLEN(jc.spans)); i++)
+		{
+			outattr(ATTR_ERROR);
+			outprintf("\nThe backup is corrupt from byte %zu to %zu",
+					jc.spans[i].off, jc.spans[i].off + jc.spans[i].size);
+		}
+		if(jc.nSpans > ARRLEN(jc.spans))
+			outprintf("\n%u more parts of the backup are corrupt", jc.nSpans - (U32) ARRLEN(jc.spans));
+		if(jc.nCut)
+		{
+			outattr(ATTR_ADD);
+			outprintf("\nCut %zu bytes off the end of the backup", jc.nCut);
+		}
+	}
+	// the values of the repaired accounts may be gone from the search
+	if(nRepaired)
+		search_invalidate();
+	outattr(ATTR_LOG);
+	outprintf("\nChecked %u accounts and %llu backup entries using %u threads", c.nNames,
+			jr ? 0ULL : (unsigned long long) jc.nEntries, MAX(nThreads, 1));
+	if(!c.nFound && !c.nLost && !jr && !jc.nSpans)
+		outstr(", everything is fine");
+	else if(c.repair)
+		outprintf(", repaired %u accounts", nRepaired);
+	free(c.found);
+}
+
+// asks for the passphrase until it is right, in batch mode it's the first line of the input
+static int
+unlock(const char *keyPath)
+{
+	char pass[MAX_INPUT];
+	int nPass;
+	int r;
+
+	for(U32 i = 0; i < 3; i++)
+	{
+		outattr(ATTR_LOG);
+		outstr("\nPassphrase: ");
+		nPass = outsecret(pass, sizeof(pass));
+		if(nPass == ERR)
+			break;
+		r = crypt_unlock(keyPath, pass, nPass);
+		explicit_bzero(pass, sizeof(pass));
+		if(!r)
+		{
+			outattr(ATTR_ADD);
+			outstr(" SUCCESS");
+			return OK;
+		}
+		if(errno != EACCES)
+		{
+			outattr(ATTR_FATAL);
+			outprintf("\nSetup failed: Could not derive the key (%s)", strerror(errno));
+			return ERR;
+		}
+		outattr(ATTR_ERROR);
+		outstr(" Wrong passphrase");
+	}
+	outattr(ATTR_FATAL);
+	outstr("\nSetup failed: The accounts are encrypted and no valid passphrase was given");
+	return ERR;
+}
+
+void
+cmd_quit(const struct branch *branch, struct value *values)
+{
+	journal_sync();
+	close(fdBackup);
+	watch_close();
+	search_close();
+	vault_close();
+	crypt_close();
+	if(!out)
+	{
+		outend();
+		exit(0);
+	}
+	history_close();
+	putp("\033[?2004l");
+	endwin();
+	exit(0);
+}
+
+void
+cmd_clear(const struct branch *branch, struct value *values)
+{
+	if(out)
+		wclear(out);
+}
+
+// runs the command that was tokenized into input
+static void
+execute(void)
+{
+	TOKEN *tok;
+	const struct branch *branch;
+	struct value value;
+	struct value values[10];
+	U32 nValues = 0;
+
+	// other processes may have changed accounts since the last command
+	watch_update();
+	branch = root;
+	while(1)
+	{
+		if(!hasnexttoken(&input))
+		{
+			outattr(ATTR_ERROR);
+			outprintf("\nBranch '%s' needs more options", branch->name);
+			printoptions(branch);
+			break;
+		}
+		if(!(branch = nextbranch(branch, &input)))
+			break;
+		// check if the branch has a dependency and get it
+		if(branch->dependency)
+		{
+			const struct dependency *const dep = branch->dependency;
+
+			tok = nexttoken(&input, &value);
+			if(tok && tok->type == TVARIABLE)
+			{
+				outattr(ATTR_ERROR);
+				outprintf("\nVariable '%.*s' doesn't exist", value.nWord - 1, value.word + 1);
+				return;
+			}
+			if(!tok || (tok->type != dep->token && dep->token))
+			{
+				outattr(ATTR_ERROR);
+				outprintf("\nExpected %s after '%s'", dep->description, branch->name);
+				return;
+			}
+			values[nValues++] = value;
+		}
+		if(IS_EXEC_BRANCH(branch))
+		{
+			if(branch->nSubnodes)
+				branch->special(branch, &input);
+			else
+				branch->proc(branch, values);
+			break;
+		}
+	}
+}
+
+// wipes everything the command may have left a secret in
+static void
+endcommand(void)
+{
+	explicit_bzero(input.buf, MAX_INPUT);
+	secure_reset();
+}
+
+// runs the line inside the input
+static void
+runline(U32 nLine)
+{
+	input.nBuf = nLine;
+	if(tokenize(&input))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nInvalid input at column %u", input.errPos + 1);
+	}
+	else if(input.nTokens)
+		execute();
+	endcommand();
+}
+
+static void
+toolong(void)
+{
+	outattr(ATTR_ERROR);
+	outprintf("\nCommand is too long (the limit is %u bytes)", MAX_INPUT - 1);
+}
+
+// runs the commands from a stream line by line without rendering anything,
+// lines are read straight into the input so they are never copied elsewhere
+static void
+runbatch(FILE *fp)
+{
+	U32 nLine;
+	int ch;
+
+	while(fgets(input.buf, MAX_INPUT, fp))
+	{
+		nLine = strlen(input.buf);
+		if(nLine && input.buf[nLine - 1] == '\n')
+			input.buf[--nLine] = 0;
+		else if((ch = getc(fp)) != '\n' && ch != EOF)
+		{
+			while((ch = getc(fp)) != '\n' && ch != EOF);
+			endcommand();
+			toolong();
+			continue;
+		}
+		runline(nLine);
+	}
+}
+
+// runs the commands given with -c, they are wiped from the arguments
+// since they might contain secrets
+static void
+runcommands(char **commands, U32 nCommands)
+{
+	for(U32 i = 0; i < nCommands; i++)
+	{
+		const size_t nCommand = strlen(commands[i]);
+
+		if(nCommand >= MAX_INPUT)
+			toolong();
+		else
+		{
+			memcpy(input.buf, commands[i], nCommand + 1);
+			runline(nCommand);
+		}
+		explicit_bzero(commands[i], nCommand);
+	}
+}
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-j] [-c command]... | [-f script]\n"
+			"  -j          write the output as NDJSON, one object per line\n"
+			"  -c command  run the command and quit, can be given multiple times\n"
+			"  -f script   run the commands of the file line by line and quit\n"
+			"without options the commands are read from stdin when it's not a terminal,\n"
+			"passphrases are always read from stdin\n",
+			program);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool isUtf8;
+	char *locale;
+	const char * const homePath = getenv("HOME");
+	int opt;
+	char *commands[argc];
+	U32 nCommands = 0;
+	FILE *script = NULL;
+	bool json = false;
+
+	while((opt = getopt(argc, argv, "c:f:j")) != -1)
+		switch(opt)
+		{
+		case 'c':
+			commands[nCommands++] = optarg;
+			break;
+		case 'f':
+			if(script)
+				usage(argv[0]);
+			script = strcmp(optarg, "-") ? fopen(optarg, "r") : stdin;
+			if(!script)
+			{
+				fprintf(stderr, "%s: could not open '%s' (%s)\n", argv[0], optarg, strerror(errno));
+				return 1;
+			}
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	if(optind != argc || (nCommands && script))
+		usage(argv[0]);
+
+	locale = setlocale(LC_ALL, "");
+
+	input.buf = secure_keep(MAX_INPUT);
+	// stdio keeps the lines it reads in its buffer, passphrases included
+	setvbuf(stdin, secure_keep(BUFSIZ), _IOFBF, BUFSIZ);
+	if(script && script != stdin)
+		setvbuf(script, secure_keep(BUFSIZ), _IOFBF, BUFSIZ);
+	if(!nCommands && !script && !json && isatty(STDIN_FILENO))
+	{
+		initscr();
+		raw();
+		noecho();
+		// bracketed paste, the terminal surrounds pasted text with these sequences
+		define_key("\033[200~", KEY_PASTE_BEGIN);
+		define_key("\033[201~", KEY_PASTE_END);
+		putp("\033[?2004h");
+
+		input.win = newwin(inputHeight, COLS, LINES - inputHeight, 0);
+		keypad(input.win, true);
+
+		out = newpad(area / COLS, COLS);
+		scrollok(out, true);
+	}
+	else
+	{
+		// commands come from the command line, a script, a pipe or a file,
+		// nothing is rendered and the setup only reports failures;
+		// the output is written in large blocks no matter where it goes
+		setvbuf(stdout, NULL, _IOFBF, 0x10000);
+		sink = &setupSink;
+	}
+
+	outstr("Doing setup...");
+	outstr("\nChecking for color support...");
+	if(out && has_colors())
+	{
+		start_color();
+		init_pair(1, COLOR_GREEN, COLOR_BLACK);
+		init_pair(2, COLOR_MAGENTA, COLOR_BLACK);
 		init_pair(3, COLOR_RED, COLOR_BLACK);
 		init_pair(4, COLOR_CYAN, COLOR_BLACK);
 		init_pair(5, COLOR_YELLOW, COLOR_BLACK);
 		init_pair(6, COLOR_GREEN, COLOR_BLACK);
 		init_pair(7, COLOR_RED, COLOR_BLACK);
-		wattrset(out, ATTR_ADD);
-		waddstr(out, " SUCCESS");
+		outattr(ATTR_ADD);
+		outstr(" SUCCESS");
 	}
 	else
 	{
-		waddstr(out, " FAILED");
+		outstr(" FAILED");
 	}
 	if(!homePath)
 	{
-		wattrset(out, ATTR_FATAL);
-		waddstr(out, "\nSetup failed: Enviroment variable HOME is not set!");
+		outattr(ATTR_FATAL);
+		outstr("\nSetup failed: Enviroment variable HOME is not set!");
 		goto err;
 	}
-	wattrset(out, ATTR_LOG);
-	wprintw(out, "\nHome path is '%s'", homePath);
+	outattr(ATTR_LOG);
+	outprintf("\nHome path is '%s'", homePath);
 	strcpy(path, homePath);
 	strcat(path, "/Passwords");
 	realPath = realpath(path, NULL);
-	wprintw(out, "\nThe real path is '%s'", realPath);
+	outprintf("\nThe real path is '%s'", realPath);
 	if(mkdir(realPath, 0700))
 	{
 		if(errno != EEXIST)
 		{
-			wattrset(out, ATTR_FATAL);
-			wprintw(out, "\nSetup failed: Could not create real path directory (%s)", strerror(errno));
+			outattr(ATTR_FATAL);
+			outprintf("\nSetup failed: Could not create real path directory (%s)", strerror(errno));
+			goto err;
+		}
+	}
+	appendrealpath(".vault", sizeof(".vault") - 1);
+	if(!access(path, F_OK))
+	{
+		outprintf("\nOpening vault file '%s'...", path);
+		if(vault_open(path))
+		{
+			outattr(ATTR_FATAL);
+			outprintf("\nSetup failed: Could not open the vault (%s)", strerror(errno));
 			goto err;
 		}
+		outattr(ATTR_ADD);
+		outstr(" SUCCESS");
+		outattr(ATTR_LOG);
 	}
-	appendrealpath(".history", sizeof(".history") - 1);
-	fd = open(path, O_RDONLY);
-	if(fd != ERR)
+	appendrealpath(".crypt", sizeof(".crypt") - 1);
+	if(!crypt_open(path))
 	{
-		read(fd, &input.nextHistory, sizeof(input.nextHistory));
-		read(fd, input.history, sizeof(input.history));
-		close(fd);
+		outprintf("\nThe accounts are encrypted with the key file '%s'", path);
+		if(unlock(path))
+			goto err;
+		outattr(ATTR_LOG);
+		appendrealpath(".crypt.new", sizeof(".crypt.new") - 1);
+		if(!access(path, F_OK))
+		{
+			outattr(ATTR_ERROR);
+			outstr("\nA key rotation was interrupted, run 'vault rekey' with the new passphrase to finish it");
+			outattr(ATTR_LOG);
+		}
+	}
+	else if(errno != ENOENT)
+	{
+		outattr(ATTR_FATAL);
+		outprintf("\nSetup failed: Could not read the key file '%s' (%s)", path,
+				errno == EILSEQ ? "the file is corrupt" : strerror(errno));
+		goto err;
+	}
+	// the history is only used by the interactive input
+	if(out)
+	{
+		appendrealpath(".history", sizeof(".history") - 1);
+		if(history_open(path))
+		{
+			outattr(ATTR_ERROR);
+			outprintf("\nCould not open the history file '%s' (%s), the history is not saved", path, strerror(errno));
+			outattr(ATTR_LOG);
+		}
 	}
 	appendrealpath(".backup", sizeof(".backup") - 1);
-	wprintw(out, "\nOpening backup file '%s'...", path);
-	fdBackup = open(path, O_CREAT | O_APPEND | O_RDWR, S_IWUSR | S_IRUSR); 
-	if(fdBackup == ERR)
+	outprintf("\nOpening backup file '%s'...", path);
+	if(journal_open(path))
 	{
-		wattrset(out, ATTR_FATAL);
-		waddstr(out, " FAILED!");
-		wattrset(out, ATTR_LOG);
+		outattr(ATTR_FATAL);
+		outprintf(" FAILED! (%s)", errno == EILSEQ ?
+				"Corrupt backup file, you must manually fix it" : strerror(errno));
+		outattr(ATTR_LOG);
 	}
 	else
 	{
-		wattrset(out, ATTR_ADD);
-		waddstr(out, " SUCCESS");
-		wattrset(out, ATTR_LOG);
+		outattr(ATTR_ADD);
+		outstr(" SUCCESS");
+		outattr(ATTR_LOG);
+	}
+	appendrealpath(".search", sizeof(".search") - 1);
+	if(search_open(path))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nCould not open the search index '%s' (%s)", path, strerror(errno));
+		outattr(ATTR_LOG);
 	}
-	waddstr(out, "\nChecking for UTF-8 support...");
+	if(watch_open(realPath))
+	{
+		outattr(ATTR_ERROR);
+		outprintf("\nCould not watch '%s' (%s), changes of other processes may not be seen", realPath, strerror(errno));
+		outattr(ATTR_LOG);
+	}
+	outstr("\nChecking for UTF-8 support...");
 	isUtf8 = locale && strstr(locale, "UTF-8");
-	wattrset(out, isUtf8 ? ATTR_ADD : ATTR_SUB);
-	wprintw(out, " UTF-8 is %ssupported", isUtf8 ? "" : "not ");
-	wattrset(out, ATTR_ADD);
-	waddstr(out, "\nSetup complete!"
+	outattr(isUtf8 ? ATTR_ADD : ATTR_SUB);
+	outprintf(" UTF-8 is %ssupported", isUtf8 ? "" : "not ");
+	outattr(ATTR_ADD);
+	outstr("\nSetup complete!"
 			"\n\nPassword manager" VERSION);
+	// nothing the setup read stays around
+	secure_reset();
+	if(!out)
+	{
+		sink = json ? &jsonSink : &plainSink;
+		if(nCommands)
+			runcommands(commands, nCommands);
+		else
+			runbatch(script ? script : stdin);
+		cmd_quit(NULL, NULL);
+	}
 	list_account(NULL, NULL);
-get_input: // while(1) IN GOTO WE TRUST
+	while(1)
 	{
-		int y, x, sx;
-		int pageSize, iPage;
-		TOKEN *tok;
-		const struct branch *branch;
-		struct value value;
-		struct value values[10];
-		U32 nValues = 0;
-
 		// render out
 		setoutpage(0);
-		if(getinput(&input, isUtf8))
-			goto get_input;
-		branch = root;
-		while(1)
-		{
-			if(!hasnexttoken(&input))
-			{
-				wattrset(out, ATTR_ERROR);
-				wprintw(out, "\nBranch '%s' needs more options", branch->name);
-				printoptions(branch);
-				break;
-			}
-			if(!(branch = nextbranch(branch, &input)))
-				break;
-			// check if the branch has any dependencies and get them
-			for(U32 i = 0; i < ARRLEN(dependencies); i++)
-				if(!strcmp(dependencies[i].name, branch->name))
-				{
-					if(!(tok = nexttoken(&input, &value)) || (tok->type != dependencies[i].token && dependencies[i].token))
-					{
-						wattrset(out, ATTR_ERROR);
-						wprintw(out, "\nExpected %s after '%s'", dependencies[i].description, branch->name);
-						goto get_input;
-					}
-					values[nValues++] = value;
-					break;
-				}
-			if(IS_EXEC_BRANCH(branch))
-			{
-				if(branch->nSubnodes)
-					branch->special(branch, &input);
-				else
-					branch->proc(branch, values);
-				break;
-			}
-		}
-		goto get_input;
+		if(!getinput(&input, isUtf8))
+			execute();
+		endcommand();
 	}
 err:
-	wattrset(out, ATTR_FATAL);
-	waddstr(out, "\nAn unexpected error occured, press any key to exit...");
+	outattr(ATTR_FATAL);
+	if(!out)
+	{
+		fputc('\n', stderr);
+		return ERR;
+	}
+	outstr("\nAn unexpected error occured, press any key to exit...");
 	wgetch(out);
+	putp("\033[?2004l");
 	endwin();
 	return ERR;
 }
@@ -0,0 +1,291 @@
+#include "pwmgr.h"
+
+// all account names sorted by their bytes, the index is built on first use
+// and kept in sync by account_create and account_delete;
+// the characters of a name are also kept as a set so the fuzzy search can
+// skip names that miss a character of the pattern without looking at them
+struct accname {
+	U64 chars;
+	U32 nName;
+	char *name;
+};
+
+static struct accname *names;
+static U32 nNames, capNames;
+static bool loaded;
+
+static U64
+charset(const char *str, U32 nStr)
+{
+	U64 set = 0;
+
+	for(U32 i = 0; i < nStr; i++)
+		set |= (U64) 1 << (tolower((U8) str[i]) & 0x3F);
+	return set;
+}
+
+static int
+compare(const char *a, U32 nA, const char *b, U32 nB)
+{
+	const int c = memcmp(a, b, MIN(nA, nB));
+
+	return c ? c : (nA > nB) - (nA < nB);
+}
+
+// index of the first name that is not below the given one
+static U32
+lowerbound(const char *name, U32 nName)
+{
+	U32 lo = 0, hi = nNames;
+
+	while(lo < hi)
+	{
+		const U32 mid = lo + (hi - lo) / 2;
+
+		if(compare(names[mid].name, names[mid].nName, name, nName) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int
+comparenames(const void *a, const void *b)
+{
+	const struct accname *const na = a, *const nb = b;
+
+	return compare(na->name, na->nName, nb->name, nb->nName);
+}
+
+static int
+reserve(void)
+{
+	struct accname *n;
+	U32 cap;
+
+	if(nNames < capNames)
+		return OK;
+	cap = MAX(capNames * 2, 64);
+	n = realloc(names, sizeof(*names) * cap);
+	if(!n)
+		return ERR;
+	names = n;
+	capNames = cap;
+	return OK;
+}
+
+static int
+fill(struct accname *n, const char *name, U32 nName)
+{
+	n->name = malloc(MAX(nName, 1));
+	if(!n->name)
+		return ERR;
+	memcpy(n->name, name, nName);
+	n->nName = nName;
+	n->chars = charset(name, nName);
+	return OK;
+}
+
+static int
+insert(const char *name, U32 nName)
+{
+	const U32 i = lowerbound(name, nName);
+	struct accname *n;
+
+	if(i < nNames && !compare(names[i].name, names[i].nName, name, nName))
+		return OK;
+	if(reserve())
+		return ERR;
+	n = names + i;
+	memmove(n + 1, n, sizeof(*n) * (nNames - i));
+	if(fill(n, name, nName))
+	{
+		memmove(n, n + 1, sizeof(*n) * (nNames - i));
+		return ERR;
+	}
+	nNames++;
+	return OK;
+}
+
+// the names are sorted once at the end, inserting every one at its place
+// would move half the index each time
+static int
+loadone(const char *name, U32 nName, void *arg)
+{
+	if(reserve() || fill(names + nNames, name, nName))
+	{
+		*(bool*) arg = true;
+		return 1;
+	}
+	nNames++;
+	return 0;
+}
+
+static void
+clearnames(void)
+{
+	for(U32 i = 0; i < nNames; i++)
+		free(names[i].name);
+	nNames = 0;
+	loaded = false;
+}
+
+int
+names_load(void)
+{
+	bool failed = false;
+
+	if(loaded)
+		return OK;
+	if(account_foreach(loadone, &failed) || failed)
+	{
+		clearnames();
+		return ERR;
+	}
+	qsort(names, nNames, sizeof(*names), comparenames);
+	loaded = true;
+	return OK;
+}
+
+void
+names_added(const char *name, U32 nName)
+{
+	if(loaded && insert(name, nName))
+		clearnames();
+}
+
+void
+names_removed(const char *name, U32 nName)
+{
+	U32 i;
+
+	if(!loaded)
+		return;
+	i = lowerbound(name, nName);
+	if(i == nNames || compare(names[i].name, names[i].nName, name, nName))
+		return;
+	free(names[i].name);
+	nNames--;
+	memmove(names + i, names + i + 1, sizeof(*names) * (nNames - i));
+}
+
+void
+names_invalidate(void)
+{
+	clearnames();
+}
+
+const char *
+names_get(U32 i, U32 *nName)
+{
+	*nName = names[i].nName;
+	return names[i].name;
+}
+
+int
+names_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg)
+{
+	if(names_load())
+		return ERR;
+	for(U32 i = 0; i < nNames; i++)
+		if(proc(names[i].name, names[i].nName, arg))
+			break;
+	return OK;
+}
+
+U32
+names_prefix(const char *prefix, U32 nPrefix, U32 *first)
+{
+	U32 lo, hi;
+
+	if(names_load())
+		return 0;
+	// the names with the prefix follow each other, so only the end of the range is searched
+	*first = lo = lowerbound(prefix, nPrefix);
+	hi = nNames;
+	while(lo < hi)
+	{
+		const U32 mid = lo + (hi - lo) / 2;
+
+		if(names[mid].nName >= nPrefix && !memcmp(names[mid].name, prefix, nPrefix))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - *first;
+}
+
+static bool
+wordstart(const char *name, U32 i)
+{
+	return !i || name[i - 1] == '_' ||
+		(islower((U8) name[i - 1]) && isupper((U8) name[i])) ||
+		(isalpha((U8) name[i - 1]) != isalpha((U8) name[i]));
+}
+
+// the pattern has to appear in the name in order but not necessarily in one
+// piece; characters that follow each other or start a word count more and
+// gaps count against the name, returns INT32_MIN when it doesn't match
+static I32
+fuzzyscore(const struct accname *n, const char *pattern, U32 nPattern)
+{
+	I32 score = 0;
+	U32 j = 0;
+	I64 prev = -1;
+
+	for(U32 i = 0; i < nPattern; i++)
+	{
+		const int ch = tolower((U8) pattern[i]);
+
+		while(j < n->nName && tolower((U8) n->name[j]) != ch)
+			j++;
+		if(j == n->nName)
+			return INT32_MIN;
+		score += 16;
+		if((I64) j == prev + 1)
+			score += 24;
+		else
+			score -= MIN(j - prev - 1, 8);
+		if(wordstart(n->name, j))
+			score += 12;
+		if(n->name[j] == pattern[i])
+			score += 1;
+		prev = j++;
+	}
+	// of otherwise equal names the shorter one is closer
+	return score - (I32) (n->nName - nPattern);
+}
+
+U32
+names_find(const char *pattern, U32 nPattern, U32 *found, U32 maxFound)
+{
+	U64 chars;
+	I32 scores[maxFound];
+	U32 nFound = 0;
+
+	if(!maxFound || names_load())
+		return 0;
+	chars = charset(pattern, nPattern);
+	for(U32 i = 0; i < nNames; i++)
+	{
+		I32 score;
+		U32 at;
+
+		if((names[i].chars & chars) != chars)
+			continue;
+		score = fuzzyscore(names + i, pattern, nPattern);
+		if(score == INT32_MIN)
+			continue;
+		// keep the best names ordered by their score, equal scores stay in name order
+		for(at = nFound; at && scores[at - 1] < score; at--);
+		if(at == maxFound)
+			continue;
+		nFound = MIN(nFound + 1, maxFound);
+		memmove(scores + at + 1, scores + at, sizeof(*scores) * (nFound - 1 - at));
+		memmove(found + at + 1, found + at, sizeof(*found) * (nFound - 1 - at));
+		scores[at] = score;
+		found[at] = i;
+	}
+	return nFound;
+}
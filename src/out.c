@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <termios.h>
+#include "pwmgr.h"
+
+const struct sink *sink = &cursesSink;
+
+static int plainAttr;
+static char *fmtBuf;
+static size_t capFmtBuf;
+
+static void
+curses_attr(int attr)
+{
+	wattrset(out, attr);
+}
+
+static void
+curses_write(const char *str, size_t nStr)
+{
+	waddnstr(out, str, nStr);
+}
+
+static int
+curses_ask(void)
+{
+	setoutpage(0);
+	return wgetch(out);
+}
+
+static int
+curses_secret(char *buf, U32 capBuf)
+{
+	U32 n = 0;
+	int ch;
+
+	setoutpage(0);
+	while((ch = wgetch(out)) != '\n' && ch != '\r')
+	{
+		if(ch == ERR)
+			continue;
+		if(ch == KEY_BACKSPACE || ch == 0x7F || ch == '\b')
+		{
+			if(n)
+				n--;
+		}
+		else if(ch >= 0x20 && ch <= 0xFF && n + 1 < capBuf)
+			buf[n++] = ch;
+	}
+	return n;
+}
+
+const struct sink cursesSink = {
+	.attr = curses_attr,
+	.write = curses_write,
+	.ask = curses_ask,
+	.secret = curses_secret,
+};
+
+static void
+plain_attr(int attr)
+{
+	plainAttr = attr;
+}
+
+static void
+plain_write(const char *str, size_t nStr)
+{
+	fwrite(str, 1, nStr, stdout);
+}
+
+// the answer is the next line of the input
+static int
+plain_ask(void)
+{
+	int ch, first;
+
+	fflush(stdout);
+	first = ch = getchar();
+	while(ch != EOF && ch != '\n')
+		ch = getchar();
+	return first;
+}
+
+// the secret is the next line of the input, a terminal doesn't echo it
+static int
+plain_secret(char *buf, U32 capBuf)
+{
+	struct termios old, quiet;
+	bool isTty;
+	U32 n = 0;
+	int ch;
+
+	fflush(stdout);
+	isTty = !tcgetattr(STDIN_FILENO, &old);
+	if(isTty)
+	{
+		quiet = old;
+		quiet.c_lflag &= ~ECHO;
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+	}
+	while((ch = getchar()) != EOF && ch != '\n')
+		if(n + 1 < capBuf)
+			buf[n++] = ch;
+	if(isTty)
+	{
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &old);
+		fputc('\n', stderr);
+	}
+	return ch == EOF && !n ? ERR : (int) n;
+}
+
+static void
+plain_end(void)
+{
+	// end the last line of the output
+	putchar('\n');
+}
+
+const struct sink plainSink = {
+	.attr = plain_attr,
+	.write = plain_write,
+	.ask = plain_ask,
+	.secret = plain_secret,
+	.end = plain_end,
+};
+
+// everything is escaped straight into the buffer of stdout, so nothing is
+// allocated per field; a message stays open until its line ends
+static bool inMessage;
+
+// length of the UTF-8 sequence at str, 0 when it isn't a valid one
+// (overlong forms, surrogates and code points above U+10FFFF are not)
+static U32
+utf8len(const U8 *str, size_t nStr)
+{
+	U8 lo = 0x80, hi = 0xBF;
+	U32 n;
+
+	if(str[0] >= 0xC2 && str[0] <= 0xDF)
+		n = 2;
+	else if(str[0] >= 0xE0 && str[0] <= 0xEF)
+	{
+		n = 3;
+		if(str[0] == 0xE0)
+			lo = 0xA0;
+		else if(str[0] == 0xED)
+			hi = 0x9F;
+	}
+	else if(str[0] >= 0xF0 && str[0] <= 0xF4)
+	{
+		n = 4;
+		if(str[0] == 0xF0)
+			lo = 0x90;
+		else if(str[0] == 0xF4)
+			hi = 0x8F;
+	}
+	else
+		return 0;
+	if(nStr < n || str[1] < lo || str[1] > hi)
+		return 0;
+	for(U32 i = 2; i < n; i++)
+		if(str[i] < 0x80 || str[i] > 0xBF)
+			return 0;
+	return n;
+}
+
+static void
+json_escape(const char *str, size_t nStr)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t run = 0;
+
+	for(size_t i = 0; i < nStr; i++)
+	{
+		const U8 ch = str[i];
+
+		if(ch >= 0x80)
+		{
+			const U32 n = utf8len((const U8*) str + i, nStr - i);
+
+			if(n)
+			{
+				i += n - 1;
+				continue;
+			}
+			// JSON is UTF-8, a byte that isn't part of a valid sequence
+			// becomes the replacement character
+			fwrite_unlocked(str + run, 1, i - run, stdout);
+			run = i + 1;
+			fputs_unlocked("\\ufffd", stdout);
+			continue;
+		}
+		if(ch >= 0x20 && ch != '"' && ch != '\\')
+			continue;
+		// the bytes that don't need escaping are written in one piece
+		fwrite_unlocked(str + run, 1, i - run, stdout);
+		run = i + 1;
+		putchar_unlocked('\\');
+		switch(ch)
+		{
+		case '"': putchar_unlocked('"'); break;
+		case '\\': putchar_unlocked('\\'); break;
+		case '\n': putchar_unlocked('n'); break;
+		case '\t': putchar_unlocked('t'); break;
+		case '\r': putchar_unlocked('r'); break;
+		default:
+			fputs_unlocked("u00", stdout);
+			putchar_unlocked(hex[ch >> 4]);
+			putchar_unlocked(hex[ch & 0xF]);
+		}
+	}
+	fwrite_unlocked(str + run, 1, nStr - run, stdout);
+}
+
+static void
+json_endmessage(void)
+{
+	if(!inMessage)
+		return;
+	fputs_unlocked("\"}\n", stdout);
+	inMessage = false;
+}
+
+static const char *
+json_level(void)
+{
+	switch(plainAttr)
+	{
+	case ATTR_ERROR: return "error";
+	case ATTR_FATAL: return "fatal";
+	case ATTR_ADD: return "added";
+	case ATTR_SUB: return "removed";
+	}
+	return "log";
+}
+
+static void
+json_write(const char *str, size_t nStr)
+{
+	while(nStr)
+	{
+		const char *const nl = memchr(str, '\n', nStr);
+		const size_t n = nl ? (size_t) (nl - str) : nStr;
+
+		if(n)
+		{
+			// the attribute at the start of a line decides the type of its message
+			if(!inMessage)
+			{
+				fputs_unlocked("{\"type\":\"", stdout);
+				fputs_unlocked(json_level(), stdout);
+				fputs_unlocked("\",\"text\":\"", stdout);
+				inMessage = true;
+			}
+			json_escape(str, n);
+		}
+		if(!nl)
+			break;
+		json_endmessage();
+		str = nl + 1;
+		nStr -= n + 1;
+	}
+}
+
+static int
+json_ask(void)
+{
+	json_endmessage();
+	return plain_ask();
+}
+
+static int
+json_secret(char *buf, U32 capBuf)
+{
+	json_endmessage();
+	return plain_secret(buf, capBuf);
+}
+
+static void
+json_record(const char *type, const struct field *fields, U32 nFields)
+{
+	json_endmessage();
+	fputs_unlocked("{\"type\":\"", stdout);
+	fputs_unlocked(type, stdout);
+	putchar_unlocked('"');
+	for(U32 i = 0; i < nFields; i++)
+	{
+		putchar_unlocked(',');
+		putchar_unlocked('"');
+		fputs_unlocked(fields[i].name, stdout);
+		fputs_unlocked("\":", stdout);
+		if(fields[i].raw)
+			fwrite_unlocked(fields[i].value, 1, fields[i].nValue, stdout);
+		else
+		{
+			putchar_unlocked('"');
+			json_escape(fields[i].value, fields[i].nValue);
+			putchar_unlocked('"');
+		}
+	}
+	fputs_unlocked("}\n", stdout);
+}
+
+const struct sink jsonSink = {
+	.attr = plain_attr,
+	.write = json_write,
+	.ask = json_ask,
+	.secret = json_secret,
+	.record = json_record,
+	.end = json_endmessage,
+};
+
+static void
+setup_write(const char *str, size_t nStr)
+{
+	if(plainAttr == ATTR_FATAL)
+		fwrite(str, 1, nStr, stderr);
+}
+
+// the setup only asks for the passphrase, the prompt is otherwise swallowed
+// when the commands come from the command line and a person is typing
+static int
+setup_secret(char *buf, U32 capBuf)
+{
+	if(isatty(STDIN_FILENO))
+		fputs("Passphrase: ", stderr);
+	return plain_secret(buf, capBuf);
+}
+
+const struct sink setupSink = {
+	.attr = plain_attr,
+	.write = setup_write,
+	.ask = plain_ask,
+	.secret = setup_secret,
+};
+
+void
+outattr(int attr)
+{
+	sink->attr(attr);
+}
+
+void
+outwrite(const char *str, size_t nStr)
+{
+	sink->write(str, nStr);
+}
+
+void
+outstr(const char *str)
+{
+	sink->write(str, strlen(str));
+}
+
+void
+outprintf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(fmtBuf, capFmtBuf, fmt, ap);
+	va_end(ap);
+	if(n < 0)
+		return;
+	if((size_t) n >= capFmtBuf)
+	{
+		char *newBuf;
+
+		// the old buffer is wiped instead of realloc leaving a copy behind
+		newBuf = malloc(n + 1);
+		explicit_bzero(fmtBuf, capFmtBuf);
+		if(!newBuf)
+			return;
+		free(fmtBuf);
+		fmtBuf = newBuf;
+		capFmtBuf = n + 1;
+		va_start(ap, fmt);
+		vsnprintf(fmtBuf, capFmtBuf, fmt, ap);
+		va_end(ap);
+	}
+	sink->write(fmtBuf, n);
+	// the text often holds a value
+	explicit_bzero(fmtBuf, n);
+}
+
+int
+outask(void)
+{
+	return sink->ask();
+}
+
+int
+outsecret(char *buf, U32 capBuf)
+{
+	return sink->secret(buf, capBuf);
+}
+
+bool
+outrecord(const char *type, const struct field *fields, U32 nFields)
+{
+	if(!sink->record)
+		return false;
+	sink->record(type, fields, nFields);
+	return true;
+}
+
+void
+outend(void)
+{
+	if(sink->end)
+		sink->end();
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// indexes are cached per account and built on first access,
+// the cache is dropped as a whole when it grows too large
+#define MAX_CACHED_INDEXES 256
+
+static struct propindex **indexes;
+static U32 capIndexes;
+static U32 nIndexes;
+
+// a stamp identifies the state of the data an index was built from;
+// account files are identified by their inode, size and modification time,
+// accounts inside the vault by the position and size of their record along
+// with the modification time of the vault, which also covers another process
+// writing a record of the same size at the same position (after a compaction)
+static int
+getstamp(const char *accName, U32 nAccName, struct propstamp *stamp)
+{
+	struct stat st;
+
+	memset(stamp, 0, sizeof(*stamp));
+	if(fdVault != ERR)
+	{
+		U32 nData;
+
+		if(fstat(fdVault, &st) ||
+				vault_find(accName, nAccName, &stamp->off, &nData))
+			return ERR;
+		stamp->dev = st.st_dev;
+		stamp->ino = st.st_ino;
+		stamp->size = nData;
+		stamp->mtime = st.st_mtim;
+		return OK;
+	}
+	appendrealpath(accName, nAccName);
+	if(stat(path, &st))
+		return ERR;
+	stamp->dev = st.st_dev;
+	stamp->ino = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->mtime = st.st_mtim;
+	return OK;
+}
+
+static bool
+samestamp(const struct propstamp *a, const struct propstamp *b)
+{
+	return a->dev == b->dev && a->ino == b->ino &&
+		a->size == b->size && a->off == b->off &&
+		a->mtime.tv_sec == b->mtime.tv_sec &&
+		a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static void
+freeindex(struct propindex *idx)
+{
+	for(U32 i = 0; i < idx->capProperties; i++)
+		free(idx->properties[i].name);
+	free(idx->properties);
+	free(idx);
+}
+
+static struct property *
+slotof(struct propindex *idx, const char *name, U32 nName, U32 hash)
+{
+	const U32 mask = idx->capProperties - 1;
+	struct property *prop;
+
+	for(U32 i = hash & mask; ; i = (i + 1) & mask)
+	{
+		prop = idx->properties + i;
+		if(!prop->name || (prop->hash == hash && prop->nName == nName &&
+					!memcmp(prop->name, name, nName)))
+			return prop;
+	}
+}
+
+static int
+insert(struct propindex *idx, const char *name, U32 nName, size_t off, size_t len)
+{
+	struct property *prop;
+	U32 hash;
+
+	// keep the load factor below one half
+	if((idx->nProperties + 1) * 2 > idx->capProperties)
+	{
+		struct propindex old = *idx;
+
+		idx->capProperties = MAX(old.capProperties * 2, 16);
+		idx->properties = calloc(idx->capProperties, sizeof(*idx->properties));
+		if(!idx->properties)
+		{
+			*idx = old;
+			return ERR;
+		}
+		for(U32 i = 0; i < old.capProperties; i++)
+			if(old.properties[i].name)
+				*slotof(idx, old.properties[i].name, old.properties[i].nName,
+						old.properties[i].hash) = old.properties[i];
+		free(old.properties);
+	}
+	hash = hashname(name, nName);
+	prop = slotof(idx, name, nName, hash);
+	prop->name = malloc(MAX(nName, 1));
+	if(!prop->name)
+		return ERR;
+	memcpy(prop->name, name, nName);
+	prop->hash = hash;
+	prop->nName = nName;
+	prop->off = off;
+	prop->len = len;
+	idx->nProperties++;
+	return OK;
+}
+
+static struct propindex *
+build(const char *accName, U32 nAccName, const struct propstamp *stamp)
+{
+	struct propindex *idx;
+	struct account acc;
+	struct record rec;
+	size_t at = 0;
+	int r;
+
+	idx = calloc(1, sizeof(*idx) + nAccName);
+	if(!idx)
+		return NULL;
+	if(account_open(accName, nAccName, &acc))
+	{
+		free(idx);
+		return NULL;
+	}
+	while((r = account_next(&acc, &rec)) > 0)
+	{
+		if(insert(idx, rec.name, rec.nName, at, acc.pos - at))
+			break;
+		at = acc.pos;
+	}
+	if(r)
+	{
+		if(r == ERR)
+			errno = EILSEQ;
+		account_close(&acc);
+		freeindex(idx);
+		return NULL;
+	}
+	idx->nData = acc.nData;
+	account_close(&acc);
+	idx->stamp = *stamp;
+	idx->nAccName = nAccName;
+	memcpy(idx->accName, accName, nAccName);
+	return idx;
+}
+
+static struct propindex **
+cacheslot(const char *accName, U32 nAccName)
+{
+	const U32 mask = capIndexes - 1;
+	struct propindex **slot;
+
+	for(U32 i = hashname(accName, nAccName) & mask; ; i = (i + 1) & mask)
+	{
+		slot = indexes + i;
+		if(!*slot || ((*slot)->nAccName == nAccName &&
+					!memcmp((*slot)->accName, accName, nAccName)))
+			return slot;
+	}
+}
+
+static void
+clearcache(void)
+{
+	for(U32 i = 0; i < capIndexes; i++)
+		if(indexes[i])
+			freeindex(indexes[i]);
+	memset(indexes, 0, sizeof(*indexes) * capIndexes);
+	nIndexes = 0;
+}
+
+struct propindex *
+property_index(const char *accName, U32 nAccName)
+{
+	struct propstamp stamp;
+	struct propindex **slot;
+
+	if(!indexes)
+	{
+		capIndexes = MAX_CACHED_INDEXES * 2;
+		indexes = calloc(capIndexes, sizeof(*indexes));
+		if(!indexes)
+			return NULL;
+	}
+	if(getstamp(accName, nAccName, &stamp))
+		return NULL;
+	slot = cacheslot(accName, nAccName);
+	if(*slot)
+	{
+		if(samestamp(&(*slot)->stamp, &stamp))
+			return *slot;
+		// the account was changed by something else
+		property_invalidate(accName, nAccName);
+	}
+	if(nIndexes == MAX_CACHED_INDEXES)
+		clearcache();
+	slot = cacheslot(accName, nAccName);
+	*slot = build(accName, nAccName, &stamp);
+	if(!*slot)
+		return NULL;
+	nIndexes++;
+	return *slot;
+}
+
+struct property *
+property_find(struct propindex *idx, const char *name, U32 nName)
+{
+	struct property *prop;
+
+	if(!idx->nProperties)
+		return NULL;
+	prop = slotof(idx, name, nName, hashname(name, nName));
+	return prop->name ? prop : NULL;
+}
+
+void
+property_added(struct propindex *idx, const char *name, U32 nName, size_t len)
+{
+	idx->nData += len;
+	if(insert(idx, name, nName, idx->nData - len, len) ||
+			getstamp(idx->accName, idx->nAccName, &idx->stamp))
+		property_invalidate(idx->accName, idx->nAccName);
+}
+
+void
+property_removed(struct propindex *idx, struct property *prop)
+{
+	const U32 mask = idx->capProperties - 1;
+	const size_t off = prop->off, len = prop->len;
+	U32 i, j;
+
+	// backward shift deletion keeps the probe sequences intact
+	free(prop->name);
+	prop->name = NULL;
+	idx->nProperties--;
+	i = prop - idx->properties;
+	for(j = (i + 1) & mask; idx->properties[j].name; j = (j + 1) & mask)
+	{
+		const U32 home = idx->properties[j].hash & mask;
+
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			idx->properties[i] = idx->properties[j];
+			idx->properties[j].name = NULL;
+			i = j;
+		}
+	}
+	for(i = 0; i < idx->capProperties; i++)
+		if(idx->properties[i].name && idx->properties[i].off > off)
+			idx->properties[i].off -= len;
+	idx->nData -= len;
+	if(getstamp(idx->accName, idx->nAccName, &idx->stamp))
+		property_invalidate(idx->accName, idx->nAccName);
+}
+
+void
+property_invalidate(const char *accName, U32 nAccName)
+{
+	const U32 mask = capIndexes - 1;
+	struct propindex **slot;
+	U32 i, j;
+
+	if(!indexes)
+		return;
+	slot = cacheslot(accName, nAccName);
+	if(!*slot)
+		return;
+	freeindex(*slot);
+	*slot = NULL;
+	nIndexes--;
+	i = slot - indexes;
+	for(j = (i + 1) & mask; indexes[j]; j = (j + 1) & mask)
+	{
+		const U32 home = hashname(indexes[j]->accName, indexes[j]->nAccName) & mask;
+
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			indexes[i] = indexes[j];
+			indexes[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+int
+property_add(const char *accName, U32 nAccName, const char *name, U32 nName,
+		const char *value, size_t nValue)
+{
+	struct propindex *idx;
+
+	idx = property_index(accName, nAccName);
+	if(!idx)
+		return ERR;
+	if(property_find(idx, name, nName))
+	{
+		errno = EEXIST;
+		return ERR;
+	}
+	if(account_append(accName, nAccName, (struct iovec[]) {
+			{ (void*) name, nName }, { "", 1 },
+			{ (void*) value, nValue }, { "", 1 },
+		}, 4))
+	{
+		property_invalidate(accName, nAccName);
+		return ERR;
+	}
+	property_added(idx, name, nName, nName + 1 + nValue + 1);
+	search_added(accName, nAccName, name, nName, value, nValue);
+	return OK;
+}
+
+int
+property_remove(const char *accName, U32 nAccName, const char *name, U32 nName,
+		char **oldValue, size_t *nOldValue)
+{
+	struct propindex *idx;
+	struct property *prop;
+	struct account acc;
+	int r;
+
+	idx = property_index(accName, nAccName);
+	if(!idx)
+		return ERR;
+	prop = property_find(idx, name, nName);
+	if(!prop)
+	{
+		errno = ENOENT;
+		return ERR;
+	}
+	if(account_open(accName, nAccName, &acc))
+		return ERR;
+	if(acc.nData != idx->nData || memcmp(acc.data + prop->off, name, nName))
+	{
+		// the account changed between building the index and mapping it
+		account_close(&acc);
+		property_invalidate(accName, nAccName);
+		errno = ESTALE;
+		return ERR;
+	}
+	if(oldValue)
+	{
+		*nOldValue = prop->len - nName - 2;
+		*oldValue = secure_alloc(*nOldValue + 1);
+		if(!*oldValue)
+		{
+			account_close(&acc);
+			return ERR;
+		}
+		memcpy(*oldValue, acc.data + prop->off + nName + 1, *nOldValue + 1);
+	}
+	// write all properties besides the property which should be removed
+	r = account_write(accName, nAccName, (struct iovec[]) {
+			{ (void*) acc.data, prop->off },
+			{ (void*) (acc.data + prop->off + prop->len), acc.nData - prop->off - prop->len },
+		}, 2);
+	account_close(&acc);
+	if(r)
+	{
+		property_invalidate(accName, nAccName);
+		if(oldValue)
+			secure_free(*oldValue, *nOldValue + 1);
+		return ERR;
+	}
+	property_removed(idx, prop);
+	search_removed(accName, nAccName, name, nName);
+	return OK;
+}
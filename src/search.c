@@ -0,0 +1,799 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// search index layout
+// [header][records...]
+// records are
+// [length][crc][payload]
+// the payload is [type][account] followed by [property][terms...] when a
+// property was added and by [property] when one was removed; the account,
+// the property and every term are [length byte][bytes]; the crc covers the
+// length and the payload
+//
+// the file is a log of the changes, it's replayed into memory on the first
+// search and appended to by every change after that; once it mostly
+// describes properties that are gone, it's written again from memory
+//
+// while the accounts are encrypted there is no file and values aren't
+// indexed, the index only lives in memory and holds the names
+#define SEARCH_MAGIC "PWSRCH"
+#define SEARCH_VERSION 1
+#define MAX_TERM 64
+// the log is compacted when it holds this many removed properties and more
+// removed ones than present ones
+#define COMPACT_MIN 1024
+
+enum {
+	SEARCH_ADD,
+	SEARCH_REMOVE,
+	SEARCH_REMOVEACCOUNT,
+};
+
+struct search_header {
+	char magic[6];
+	U16 version;
+};
+
+struct record_header {
+	U32 length;
+	U32 crc;
+};
+
+// a doc is a property of an account, data is the payload of the record that
+// added it without the type
+struct doc {
+	char *data;
+	U32 nData;
+	U32 hash;
+	bool alive;
+};
+
+// the docs containing a term in ascending order
+struct term {
+	char *str;
+	U32 nStr;
+	U32 hash;
+	U32 *docs;
+	U32 nDocs, capDocs;
+};
+
+static char *searchPath;
+static int fdSearch = ERR;
+static bool loaded;
+
+static struct doc *docs;
+static U32 nDocs, capDocs, nDead;
+// doc index + 1 of every doc by account and property, removed docs stay in it
+static U32 *docSlots;
+static U32 capDocSlots;
+static struct term *terms;
+static U32 nTerms, capTerms;
+
+static char *rec;
+static size_t nRec, capRec;
+// set when the record being built didn't fit into memory
+static bool recFailed;
+
+// values of properties with one of these words anywhere in their name are
+// never indexed, like "pass" in "mail_password" or "pin" in "cardpin";
+// a name that only looks like one leaves out a value that could be searched
+static const char *const secretWords[] = {
+	"pass", "pin", "secret", "key", "token", "otp", "cvv", "cvc",
+};
+
+bool
+search_secret(const char *name, U32 nName)
+{
+	for(U32 i = 0; i < ARRLEN(secretWords); i++)
+	{
+		const U32 n = strlen(secretWords[i]);
+
+		for(U32 at = 0; at + n <= nName; at++)
+			if(!strncasecmp(name + at, secretWords[i], n))
+				return true;
+	}
+	return false;
+}
+
+static int
+reserve(size_t n)
+{
+	char *newRec;
+
+	if(nRec + n <= capRec)
+		return OK;
+	capRec = MAX(capRec * 2, nRec + n);
+	newRec = realloc(rec, capRec);
+	if(!newRec)
+	{
+		recFailed = true;
+		return ERR;
+	}
+	rec = newRec;
+	return OK;
+}
+
+static int
+putbytes(const char *str, U32 nStr)
+{
+	nStr = MIN(nStr, 0xFFU);
+	if(recFailed || reserve(1 + nStr))
+		return ERR;
+	rec[nRec++] = nStr;
+	memcpy(rec + nRec, str, nStr);
+	nRec += nStr;
+	return OK;
+}
+
+static bool
+istermchar(U8 ch)
+{
+	return isalnum(ch) || ch >= 0x80;
+}
+
+// terms are the runs of letters and digits of at least two bytes, lowercased
+// and cut off after MAX_TERM bytes
+static int
+putterms(const char *str, size_t nStr)
+{
+	char term[MAX_TERM];
+
+	for(size_t i = 0; i < nStr; )
+	{
+		U32 n = 0;
+
+		if(!istermchar(str[i]))
+		{
+			i++;
+			continue;
+		}
+		for(; i < nStr && istermchar(str[i]); i++)
+			if(n < MAX_TERM)
+				term[n++] = tolower((U8) str[i]);
+		if(n >= 2 && putbytes(term, n))
+			return ERR;
+	}
+	return OK;
+}
+
+// starts a record, the header is filled in by endrecord
+static void
+beginrecord(U8 type, const char *accName, U32 nAccName)
+{
+	nRec = 0;
+	recFailed = false;
+	if(reserve(sizeof(struct record_header) + 1))
+		return;
+	nRec = sizeof(struct record_header);
+	rec[nRec++] = type;
+	putbytes(accName, nAccName);
+}
+
+static void
+endrecord(void)
+{
+	struct record_header hdr;
+
+	hdr.length = nRec - sizeof(hdr);
+	hdr.crc = crc32c(0, &hdr.length, sizeof(hdr.length));
+	hdr.crc = crc32c(hdr.crc, rec + sizeof(hdr), hdr.length);
+	memcpy(rec, &hdr, sizeof(hdr));
+}
+
+static U32
+dochash(const char *data)
+{
+	const U8 nAcc = data[0];
+	const U8 nProp = data[1 + nAcc];
+
+	return hashname(data + 1, nAcc) * 31 ^ hashname(data + 2 + nAcc, nProp);
+}
+
+// the account and property of a doc are the start of its data
+static U32
+keylength(const char *data)
+{
+	return 2 + (U8) data[0] + (U8) data[1 + (U8) data[0]];
+}
+
+static U32 *
+docslot(const char *key, U32 hash)
+{
+	const U32 mask = capDocSlots - 1;
+	const U32 nKey = keylength(key);
+
+	for(U32 i = hash & mask; ; i = (i + 1) & mask)
+	{
+		const struct doc *doc;
+
+		if(!docSlots[i])
+			return docSlots + i;
+		doc = docs + docSlots[i] - 1;
+		if(doc->alive && doc->hash == hash && keylength(doc->data) == nKey &&
+				!memcmp(doc->data, key, nKey))
+			return docSlots + i;
+	}
+}
+
+static struct term *
+termslot(struct term *table, U32 cap, const char *str, U32 nStr, U32 hash)
+{
+	const U32 mask = cap - 1;
+
+	for(U32 i = hash & mask; ; i = (i + 1) & mask)
+		if(!table[i].str || (table[i].hash == hash && table[i].nStr == nStr &&
+					!memcmp(table[i].str, str, nStr)))
+			return table + i;
+}
+
+static int
+addterm(const char *str, U32 nStr, U32 doc)
+{
+	struct term *term;
+	U32 hash;
+
+	// keep the load factor below one half
+	if((nTerms + 1) * 2 > capTerms)
+	{
+		const U32 cap = MAX(capTerms * 2, 1024);
+		struct term *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return ERR;
+		for(U32 i = 0; i < capTerms; i++)
+			if(terms[i].str)
+				*termslot(table, cap, terms[i].str, terms[i].nStr, terms[i].hash) = terms[i];
+		free(terms);
+		terms = table;
+		capTerms = cap;
+	}
+	hash = hashname(str, nStr);
+	term = termslot(terms, capTerms, str, nStr, hash);
+	if(!term->str)
+	{
+		term->str = malloc(nStr);
+		if(!term->str)
+			return ERR;
+		memcpy(term->str, str, nStr);
+		term->nStr = nStr;
+		term->hash = hash;
+		nTerms++;
+	}
+	// a term that appears multiple times in a property is listed once
+	if(term->nDocs && term->docs[term->nDocs - 1] == doc)
+		return OK;
+	if(term->nDocs == term->capDocs)
+	{
+		const U32 cap = MAX(term->capDocs * 2, 4);
+		U32 *const newDocs = realloc(term->docs, sizeof(*newDocs) * cap);
+
+		if(!newDocs)
+			return ERR;
+		term->docs = newDocs;
+		term->capDocs = cap;
+	}
+	term->docs[term->nDocs++] = doc;
+	return OK;
+}
+
+static void
+removedoc(U32 *slot)
+{
+	docs[*slot - 1].alive = false;
+	nDead++;
+}
+
+// adds the doc described by the payload of an add record without its type
+static int
+adddoc(const char *data, U32 nData)
+{
+	struct doc *doc;
+	U32 *slot;
+	U32 hash;
+	U32 i;
+
+	if(nData < 2 || (U8) data[0] + 2U > nData || keylength(data) > nData)
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	// the slot table counts removed docs as well
+	if((nDocs + 1) * 2 > capDocSlots)
+	{
+		const U32 cap = MAX(capDocSlots * 2, 1024);
+		U32 *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return ERR;
+		free(docSlots);
+		docSlots = table;
+		capDocSlots = cap;
+		for(i = 0; i < nDocs; i++)
+			if(docs[i].alive)
+				*docslot(docs[i].data, docs[i].hash) = i + 1;
+	}
+	if(nDocs == capDocs)
+	{
+		const U32 cap = MAX(capDocs * 2, 64);
+
+		doc = realloc(docs, sizeof(*docs) * cap);
+		if(!doc)
+			return ERR;
+		docs = doc;
+		capDocs = cap;
+	}
+	hash = dochash(data);
+	slot = docslot(data, hash);
+	if(*slot)
+		removedoc(slot);
+	doc = docs + nDocs;
+	doc->data = malloc(nData);
+	if(!doc->data)
+		return ERR;
+	memcpy(doc->data, data, nData);
+	doc->nData = nData;
+	doc->hash = hash;
+	doc->alive = true;
+	*slot = ++nDocs;
+	for(i = keylength(data); i < nData; i += 1 + (U8) data[i])
+	{
+		if(i + 1 + (U8) data[i] > nData)
+		{
+			errno = EILSEQ;
+			return ERR;
+		}
+		if(addterm(data + i + 1, (U8) data[i], nDocs - 1))
+			return ERR;
+	}
+	return OK;
+}
+
+static void
+removeaccount(const char *accName, U32 nAccName)
+{
+	for(U32 i = 0; i < nDocs; i++)
+		if(docs[i].alive && (U8) docs[i].data[0] == nAccName &&
+				!memcmp(docs[i].data + 1, accName, nAccName))
+		{
+			docs[i].alive = false;
+			nDead++;
+		}
+}
+
+// applies the payload of a record to the index in memory
+static int
+apply(const char *payload, U32 nPayload)
+{
+	U32 *slot;
+
+	if(nPayload < 2 || (U8) payload[1] + 2U > nPayload)
+	{
+		errno = EILSEQ;
+		return ERR;
+	}
+	switch(payload[0])
+	{
+	case SEARCH_ADD:
+		return adddoc(payload + 1, nPayload - 1);
+	case SEARCH_REMOVE:
+		if((U8) payload[1] + 3U > nPayload || keylength(payload + 1) != nPayload - 1)
+		{
+			errno = EILSEQ;
+			return ERR;
+		}
+		if(!capDocSlots)
+			break;
+		slot = docslot(payload + 1, dochash(payload + 1));
+		if(*slot)
+			removedoc(slot);
+		break;
+	case SEARCH_REMOVEACCOUNT:
+		removeaccount(payload + 2, (U8) payload[1]);
+		break;
+	default:
+		errno = EILSEQ;
+		return ERR;
+	}
+	return OK;
+}
+
+static void
+clearindex(void)
+{
+	for(U32 i = 0; i < nDocs; i++)
+		free(docs[i].data);
+	free(docs);
+	docs = NULL;
+	nDocs = capDocs = nDead = 0;
+	free(docSlots);
+	docSlots = NULL;
+	capDocSlots = 0;
+	for(U32 i = 0; i < capTerms; i++)
+	{
+		free(terms[i].str);
+		free(terms[i].docs);
+	}
+	free(terms);
+	terms = NULL;
+	nTerms = capTerms = 0;
+	loaded = false;
+}
+
+// the index can't be trusted anymore, it's built again by the next search
+static void
+dropfile(void)
+{
+	if(fdSearch != ERR)
+		close(fdSearch);
+	fdSearch = ERR;
+	if(searchPath)
+		remove(searchPath);
+	clearindex();
+}
+
+static void
+appendrecord(void)
+{
+	if(recFailed)
+	{
+		// the change can't be recorded
+		dropfile();
+		return;
+	}
+	endrecord();
+	if(loaded && apply(rec + sizeof(struct record_header), nRec - sizeof(struct record_header)))
+	{
+		dropfile();
+		return;
+	}
+	if(fdSearch != ERR && write(fdSearch, rec, nRec) != (ssize_t) nRec)
+		dropfile();
+}
+
+static int
+writeheader(int fd)
+{
+	struct search_header hdr;
+
+	memcpy(hdr.magic, SEARCH_MAGIC, sizeof(hdr.magic));
+	hdr.version = SEARCH_VERSION;
+	return write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) ? OK : ERR;
+}
+
+// writes the docs that are present into a new file that replaces the log
+static int
+writeindex(void)
+{
+	char tmpPath[strlen(searchPath) + 5];
+	int fd;
+
+	sprintf(tmpPath, "%s.tmp", searchPath);
+	fd = open(tmpPath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	if(writeheader(fd))
+		goto err;
+	for(U32 i = 0; i < nDocs; i++)
+	{
+		if(!docs[i].alive)
+			continue;
+		nRec = 0;
+		if(reserve(sizeof(struct record_header) + 1 + docs[i].nData))
+			goto err;
+		nRec = sizeof(struct record_header);
+		rec[nRec++] = SEARCH_ADD;
+		memcpy(rec + nRec, docs[i].data, docs[i].nData);
+		nRec += docs[i].nData;
+		endrecord();
+		if(write(fd, rec, nRec) != (ssize_t) nRec)
+			goto err;
+	}
+	if(fsync(fd) || rename(tmpPath, searchPath))
+		goto err;
+	close(fd);
+	if(fdSearch != ERR)
+		close(fdSearch);
+	fdSearch = open(searchPath, O_WRONLY | O_APPEND);
+	return fdSearch == ERR ? ERR : OK;
+err:
+	close(fd);
+	remove(tmpPath);
+	return ERR;
+}
+
+static int
+indexaccount(const char *name, U32 nName, void *arg)
+{
+	struct account acc;
+	struct record r;
+	int n;
+
+	if(account_open(name, nName, &acc))
+		return 0;
+	while((n = account_next(&acc, &r)) > 0)
+	{
+		beginrecord(SEARCH_ADD, name, nName);
+		putbytes(r.name, r.nName);
+		putterms(r.name, r.nName);
+		if(!cryptActive && !search_secret(r.name, r.nName))
+			putterms(r.value, r.nValue);
+		if(recFailed || adddoc(rec + sizeof(struct record_header) + 1, nRec - sizeof(struct record_header) - 1))
+		{
+			*(int*) arg = ERR;
+			break;
+		}
+	}
+	account_close(&acc);
+	return *(int*) arg;
+}
+
+// builds the index from all accounts, this is the only time the accounts are read
+static int
+build(void)
+{
+	int r = OK;
+
+	if(account_foreach(indexaccount, &r) || r || (!cryptActive && writeindex()))
+	{
+		clearindex();
+		return ERR;
+	}
+	return OK;
+}
+
+static void
+compactifneeded(void)
+{
+	if(nDead < COMPACT_MIN || nDead <= nDocs - nDead)
+		return;
+	// the next search builds the index again
+	if(cryptActive)
+	{
+		clearindex();
+		return;
+	}
+	// keep the present docs, writeindex only looks at those
+	if(writeindex())
+	{
+		dropfile();
+		return;
+	}
+	clearindex();
+}
+
+static int
+load(void)
+{
+	struct stat st;
+	char *map;
+	size_t off;
+
+	if(loaded)
+		return OK;
+	if(fdSearch == ERR)
+	{
+		if(build())
+			return ERR;
+		loaded = true;
+		return OK;
+	}
+	if(fstat(fdSearch, &st))
+		return ERR;
+	map = NULL;
+	if(st.st_size)
+	{
+		// the file is opened for appending only
+		const int fd = open(searchPath, O_RDONLY);
+
+		if(fd == ERR)
+			return ERR;
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED)
+			return ERR;
+	}
+	if((size_t) st.st_size < sizeof(struct search_header) ||
+			memcmp(map, SEARCH_MAGIC, 6) ||
+			((struct search_header*) map)->version != SEARCH_VERSION)
+	{
+		// not an index this version understands
+		if(map)
+			munmap(map, st.st_size);
+		dropfile();
+		return load();
+	}
+	for(off = sizeof(struct search_header); off + sizeof(struct record_header) <= (size_t) st.st_size; )
+	{
+		struct record_header hdr;
+
+		memcpy(&hdr, map + off, sizeof(hdr));
+		if(hdr.length > st.st_size - off - sizeof(hdr) ||
+				crc32c(crc32c(0, &hdr.length, sizeof(hdr.length)),
+					map + off + sizeof(hdr), hdr.length) != hdr.crc)
+			break;
+		if(apply(map + off + sizeof(hdr), hdr.length))
+		{
+			munmap(map, st.st_size);
+			dropfile();
+			return load();
+		}
+		off += sizeof(hdr) + hdr.length;
+	}
+	munmap(map, st.st_size);
+	// a record that was cut off by a crash is dropped
+	if(off != (size_t) st.st_size && ftruncate(fdSearch, off))
+	{
+		dropfile();
+		return load();
+	}
+	loaded = true;
+	// compacting drops the docs from memory, they're loaded again from the new file
+	compactifneeded();
+	return loaded ? OK : load();
+}
+
+int
+search_open(const char *path)
+{
+	search_close();
+	searchPath = strdup(path);
+	if(!searchPath)
+		return ERR;
+	// an index written before the accounts were encrypted holds values
+	if(cryptActive)
+	{
+		if(remove(path) && errno != ENOENT)
+			return ERR;
+		return OK;
+	}
+	// without a file the index is built by the first search
+	fdSearch = open(path, O_WRONLY | O_APPEND);
+	if(fdSearch == ERR && errno != ENOENT)
+		return ERR;
+	return OK;
+}
+
+void
+search_close(void)
+{
+	if(fdSearch != ERR)
+		close(fdSearch);
+	fdSearch = ERR;
+	clearindex();
+	free(searchPath);
+	searchPath = NULL;
+}
+
+void
+search_invalidate(void)
+{
+	dropfile();
+}
+
+void
+search_added(const char *accName, U32 nAccName, const char *name, U32 nName,
+		const char *value, size_t nValue)
+{
+	if(fdSearch == ERR && !loaded)
+		return;
+	beginrecord(SEARCH_ADD, accName, nAccName);
+	putbytes(name, nName);
+	putterms(name, nName);
+	if(!cryptActive && !search_secret(name, nName))
+		putterms(value, nValue);
+	appendrecord();
+}
+
+void
+search_removed(const char *accName, U32 nAccName, const char *name, U32 nName)
+{
+	if(fdSearch == ERR && !loaded)
+		return;
+	beginrecord(SEARCH_REMOVE, accName, nAccName);
+	putbytes(name, nName);
+	appendrecord();
+	if(loaded)
+		compactifneeded();
+}
+
+void
+search_accountadded(const char *accName, U32 nAccName, const char *data, size_t nData)
+{
+	struct account acc;
+	struct record r;
+
+	// walk the data like a mapped account
+	acc.data = data;
+	acc.nData = nData;
+	acc.pos = 0;
+	while(account_next(&acc, &r) > 0)
+		search_added(accName, nAccName, r.name, r.nName, r.value, r.nValue);
+}
+
+void
+search_accountremoved(const char *accName, U32 nAccName)
+{
+	if(fdSearch == ERR && !loaded)
+		return;
+	beginrecord(SEARCH_REMOVEACCOUNT, accName, nAccName);
+	appendrecord();
+	if(loaded)
+		compactifneeded();
+}
+
+static bool
+hasterm(const struct doc *doc, const char *str, U32 nStr)
+{
+	for(U32 i = keylength(doc->data); i < doc->nData; i += 1 + (U8) doc->data[i])
+		if((U8) doc->data[i] == nStr && !memcmp(doc->data + i + 1, str, nStr))
+			return true;
+	return false;
+}
+
+int
+search_query(const char *query, size_t nQuery,
+		int (*proc)(const char *accName, U32 nAccName, const char *name, U32 nName, void *arg),
+		void *arg)
+{
+	const struct term *rarest = NULL;
+	char *q;
+	size_t nQ;
+
+	beginrecord(SEARCH_ADD, "", 0);
+	if(putterms(query, nQuery) || recFailed)
+		return ERR;
+	// the terms of the query are built like a record so they are stored the same way
+	nQ = nRec - sizeof(struct record_header) - 2;
+	if(!nQ)
+	{
+		errno = EINVAL;
+		return ERR;
+	}
+	q = malloc(nQ);
+	if(!q)
+		return ERR;
+	memcpy(q, rec + sizeof(struct record_header) + 2, nQ);
+	if(load())
+	{
+		free(q);
+		return ERR;
+	}
+	// only docs listed for every term can match, so the list of the rarest
+	// term is enough to check
+	for(size_t i = 0; i < nQ; i += 1 + (U8) q[i])
+	{
+		const struct term *term;
+
+		term = capTerms ? termslot(terms, capTerms, q + i + 1, (U8) q[i],
+				hashname(q + i + 1, (U8) q[i])) : NULL;
+		if(!term || !term->str)
+		{
+			free(q);
+			return OK;
+		}
+		if(!rarest || term->nDocs < rarest->nDocs)
+			rarest = term;
+	}
+	for(U32 d = 0; d < rarest->nDocs; d++)
+	{
+		const struct doc *const doc = docs + rarest->docs[d];
+		size_t i;
+
+		if(!doc->alive)
+			continue;
+		for(i = 0; i < nQ && hasterm(doc, q + i + 1, (U8) q[i]); i += 1 + (U8) q[i]);
+		if(i < nQ)
+			continue;
+		if(proc(doc->data + 1, (U8) doc->data[0],
+					doc->data + 2 + (U8) doc->data[0], (U8) doc->data[1 + (U8) doc->data[0]], arg))
+			break;
+	}
+	free(q);
+	return OK;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include "pwmgr.h"
+
+// locked memory for everything that may hold a secret, it is never swapped
+// out and left out of core dumps; a command allocates from the top chunk by
+// bumping its top and everything is wiped at once when the command is done,
+// only the first chunk is kept after that
+#define SECURE_CHUNK 0x10000
+#define SECURE_ALIGN 16
+#define ALIGNED(n) (((n) + SECURE_ALIGN - 1) & ~(size_t) (SECURE_ALIGN - 1))
+
+struct chunk {
+	struct chunk *prev;
+	size_t size;
+	size_t top;
+};
+
+#define HEADER_SIZE ALIGNED(sizeof(struct chunk))
+
+static struct chunk *chunks;
+
+static void *
+lockedmap(size_t n)
+{
+	void *map;
+
+	map = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+		return NULL;
+	// over the limit of locked memory the secrets are still wiped and not dumped
+	mlock(map, n);
+	madvise(map, n, MADV_DONTDUMP);
+	return map;
+}
+
+static size_t
+pagealign(size_t n)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+
+	return (n + page - 1) & ~(page - 1);
+}
+
+static void
+unmapchunk(struct chunk *c)
+{
+	const size_t size = c->size;
+
+	munlock(c, size);
+	munmap(c, size);
+}
+
+void *
+secure_alloc(size_t n)
+{
+	struct chunk *c;
+	void *ptr;
+
+	n = ALIGNED(n);
+	if(!chunks || chunks->size - chunks->top < n)
+	{
+		const size_t size = pagealign(MAX(n + HEADER_SIZE, (size_t) SECURE_CHUNK));
+
+		c = lockedmap(size);
+		if(!c)
+			return NULL;
+		c->prev = chunks;
+		c->size = size;
+		c->top = HEADER_SIZE;
+		chunks = c;
+	}
+	ptr = (char*) chunks + chunks->top;
+	chunks->top += n;
+	return ptr;
+}
+
+void
+secure_free(void *ptr, size_t n)
+{
+	struct chunk *c;
+
+	if(!ptr)
+		return;
+	explicit_bzero(ptr, n);
+	n = ALIGNED(n);
+	c = chunks;
+	// only the latest allocation can be given back right away
+	if(!c || (char*) ptr + n != (char*) c + c->top)
+		return;
+	c->top -= n;
+	if(c->top == HEADER_SIZE && c->prev)
+	{
+		chunks = c->prev;
+		unmapchunk(c);
+	}
+}
+
+void
+secure_reset(void)
+{
+	struct chunk *c;
+
+	while((c = chunks))
+	{
+		explicit_bzero((char*) c + HEADER_SIZE, c->top - HEADER_SIZE);
+		c->top = HEADER_SIZE;
+		if(!c->prev)
+			break;
+		chunks = c->prev;
+		unmapchunk(c);
+	}
+}
+
+void *
+secure_keep(size_t n)
+{
+	return lockedmap(pagealign(MAX(n, (size_t) 1)));
+}
@@ -22,6 +22,33 @@ peektoken(struct input *input, struct value *value)
 		value->word++;
 		value->nWord -= 2;
 	}
+	else if(tok->type == TVARIABLE)
+	{
+		static TOKEN expanded;
+		struct variable *var;
+		const char *str;
+		U32 nStr;
+
+		// unknown variables are left as they are
+		var = getvariable(value->word + 1, value->nWord - 1);
+		if(!var)
+			return tok;
+		str = variablevalue(var, &nStr);
+		value->word = (char*) str;
+		value->nWord = nStr;
+		expanded.pos = tok->pos;
+		if(var->number)
+			expanded.type = TNUMBER;
+		else
+		{
+			expanded.type = nStr && nStr <= MAX_NAME && (isalpha(*str) || *str == '_') ?
+				TWORD : TSTRING;
+			for(U32 i = 1; i < nStr && expanded.type == TWORD; i++)
+				if(!isalnum(str[i]) && str[i] != '_')
+					expanded.type = TSTRING;
+		}
+		return &expanded;
+	}
 	return tok;
 }
 
@@ -51,11 +78,18 @@ gettokenlen(struct input *input, U32 token)
 	switch(tok->type)
 	{
 	case TWORD:
+	case TVARIABLE:
 		str = input->buf + tok->pos;
-		l = 0;
+		l = tok->type == TVARIABLE;
 		while(isalnum(str[l]) || str[l] == '_')
 			l++;
 		break;
+	case TNUMBER:
+		str = input->buf + tok->pos;
+		l = 0;
+		while(isdigit(str[l]))
+			l++;
+		break;
 	case TSTRING:
 		str = input->buf + tok->pos;
 		l = 1;
@@ -74,6 +108,14 @@ gettokenlen(struct input *input, U32 token)
 
 int
 tokenize(struct input *input)
+{
+	U32 from = 0;
+
+	return retokenize(input, &from);
+}
+
+int
+retokenize(struct input *input, U32 *from)
 {
 	static const U32 map[0x100] = {
 		[' '] = ESPACE,
@@ -89,6 +131,7 @@ tokenize(struct input *input)
 		['A' ... 'Z'] = TWORD,
 		['0' ... '9'] = TNUMBER,
 		['_'] = TWORD,
+		['$'] = TVARIABLE,
 		[':'] = TCOLON,
 		['.'] = TDOT,
 		[','] = TCOMMA,
@@ -110,7 +153,16 @@ tokenize(struct input *input)
 	input->iToken = 0;
 	tokens = input->tokens;
 	capTokens = input->capTokens;
-	for(buf = input->buf; *buf; buf++)
+	// the lexer is in its initial state at the start of every token, the tokens
+	// before the edit are kept and lexing resumes at the last token starting before it
+	// because the edit may extend that token
+	nTokens = input->nTokens;
+	while(nTokens && tokens[nTokens - 1].pos >= *from)
+		nTokens--;
+	if(nTokens)
+		nTokens--;
+	*from = nTokens ? tokens[nTokens].pos : 0;
+	for(buf = input->buf + *from; *buf; buf++)
 	{
 		U32 m;
 
@@ -154,6 +206,14 @@ tokenize(struct input *input)
 			if(m == TNUMBER)
 				goto fusion;
 			break;
+		case TVARIABLE:
+			if(m == TWORD || m == TNUMBER)
+			{
+				// the variable name continues like a word
+				last = TWORD;
+				goto fusion;
+			}
+			break;
 		}
 		if(!m) // unrecognized character
 		{
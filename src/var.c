@@ -1,40 +1,227 @@
+#include <errno.h>
 #include "pwmgr.h"
 
 U32 area = 200 * 200;
 U32 inputHeight = 3;
 
+// names and values live in an arena of secure memory that is never freed,
+// a value is only moved when a longer value replaces it
+#define ARENA_CHUNK 0x1000
+
+static char *arena;
+static size_t nArena, capArena;
+
+// open addressing table of all variables, the load factor stays below one half
 static struct variable *variables;
+static U32 capVariables;
 static U32 nVariables;
 
+// these are defined inside of src/main.c
+int set_area(struct variable *var, U32 value);
+int set_inputheight(struct variable *var, U32 value);
+int set_sync(struct variable *var, U32 value);
+
+static char *
+arenaalloc(size_t n)
+{
+	char *ptr;
+
+	if(n > capArena - nArena)
+	{
+		const size_t capChunk = MAX(n, (size_t) ARENA_CHUNK);
+
+		ptr = secure_keep(capChunk);
+		if(!ptr)
+			return NULL;
+		// large values get a chunk of their own so the current chunk stays in use
+		if(capChunk > ARENA_CHUNK)
+			return ptr;
+		arena = ptr;
+		nArena = 0;
+		capArena = capChunk;
+	}
+	ptr = arena + nArena;
+	nArena += n;
+	return ptr;
+}
+
+static struct variable *
+slotof(const char *name, U32 nName, U32 hash)
+{
+	const U32 mask = capVariables - 1;
+	struct variable *var;
+
+	for(U32 i = hash & mask; ; i = (i + 1) & mask)
+	{
+		var = variables + i;
+		if(!var->name || (var->hash == hash && var->nName == nName &&
+					!memcmp(var->name, name, nName)))
+			return var;
+	}
+}
+
+static int
+grow(void)
+{
+	struct variable *old = variables;
+	const U32 capOld = capVariables;
+
+	capVariables = MAX(capOld * 2, 32);
+	variables = calloc(capVariables, sizeof(*variables));
+	if(!variables)
+	{
+		variables = old;
+		capVariables = capOld;
+		return ERR;
+	}
+	for(U32 i = 0; i < capOld; i++)
+		if(old[i].name)
+			*slotof(old[i].name, old[i].nName, old[i].hash) = old[i];
+	free(old);
+	return OK;
+}
+
+static struct variable *
+insert(const char *name, U32 nName)
+{
+	struct variable *var;
+	char *interned;
+	U32 hash;
+
+	if((nVariables + 1) * 2 > capVariables && grow())
+		return NULL;
+	interned = arenaalloc(nName + 1);
+	if(!interned)
+		return NULL;
+	memcpy(interned, name, nName);
+	interned[nName] = 0;
+	hash = hashname(name, nName);
+	var = slotof(name, nName, hash);
+	memset(var, 0, sizeof(*var));
+	var->name = interned;
+	var->nName = nName;
+	var->hash = hash;
+	nVariables++;
+	return var;
+}
+
 static void __attribute__((constructor))
 init(void)
 {
-	static const struct variable builtin_variables[] = {
-		{ "area", NULL },
-		{ "inputHeight", NULL },
+	static const struct {
+		const char *name;
+		U32 *number;
+		int (*set)(struct variable *var, U32 value);
+	} builtin_variables[] = {
+		{ "area", &area, set_area },
+		{ "inputHeight", &inputHeight, set_inputheight },
+		{ "syncEntries", &syncEntries, set_sync },
+		{ "syncInterval", &syncInterval, set_sync },
+		{ "compactEntries", &compactEntries, NULL },
 	};
-	
-	variables = malloc(sizeof(builtin_variables));
-	nVariables = ARRLEN(builtin_variables);
-	memcpy(variables, builtin_variables, sizeof(builtin_variables));
+	struct variable *var;
+
+	for(U32 i = 0; i < ARRLEN(builtin_variables); i++)
+	{
+		var = insert(builtin_variables[i].name, strlen(builtin_variables[i].name));
+		if(!var)
+			return;
+		var->number = builtin_variables[i].number;
+		var->set = builtin_variables[i].set;
+	}
 }
 
-void
-addvariable(const struct variable *var)
+struct variable *
+addvariable(const char *name, U32 nName, const char *value, U32 nValue)
 {
-	variables = realloc(variables, sizeof(*variables) * (nVariables + 1));
-	variables[nVariables++] = *var;
+	struct variable *var;
+
+	var = insert(name, nName);
+	if(!var)
+		return NULL;
+	if(setvariable(var, value, nValue))
+	{
+		// the name stays in the arena, the slot is simply empty again
+		var->name = NULL;
+		nVariables--;
+		return NULL;
+	}
+	return var;
 }
 
 struct variable *
 getvariable(const char *name, U32 nName)
 {
-	for(U32 v = 0; v < nVariables; v++)
+	struct variable *var;
+
+	if(!nVariables)
+		return NULL;
+	var = slotof(name, nName, hashname(name, nName));
+	return var->name ? var : NULL;
+}
+
+int
+setvariable(struct variable *var, const char *value, U32 nValue)
+{
+	if(var->number)
 	{
-		if(!strncmp(variables[v].name, name, nName)
-				&& !variables[v].name[nName])
-			return variables + v;
+		char num[24];
+		char *end;
+		U32 n;
+
+		if(!nValue || nValue >= sizeof(num))
+			goto invalid;
+		memcpy(num, value, nValue);
+		num[nValue] = 0;
+		n = strtoul(num, &end, 0);
+		if(*end)
+			goto invalid;
+		if(var->set)
+			return var->set(var, n);
+		*var->number = n;
+		return OK;
+	invalid:
+		errno = EINVAL;
+		return ERR;
 	}
-	return NULL;
+	if(nValue >= var->capValue)
+	{
+		char *newValue;
+
+		newValue = arenaalloc(nValue + 1);
+		if(!newValue)
+			return ERR;
+		// the space of the old value is not used again but it shouldn't keep the value
+		if(var->value)
+			explicit_bzero(var->value, var->capValue);
+		var->value = newValue;
+		var->capValue = nValue + 1;
+	}
+	memcpy(var->value, value, nValue);
+	var->value[nValue] = 0;
+	var->nValue = nValue;
+	return OK;
 }
 
+const char *
+variablevalue(struct variable *var, U32 *nValue)
+{
+	if(var->number)
+	{
+		// numbers are formatted into the variable's own buffer so values
+		// of different variables can be used together
+		if(!var->value)
+		{
+			var->value = arenaalloc(12);
+			if(!var->value)
+			{
+				*nValue = 0;
+				return "";
+			}
+			var->capValue = 12;
+		}
+		var->nValue = snprintf(var->value, var->capValue, "%u", *var->number);
+	}
+	*nValue = var->nValue;
+	return var->value ? var->value : "";
+}
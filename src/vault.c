@@ -0,0 +1,615 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stddef.h>
+#include "pwmgr.h"
+
+// vault layout
+// [header][buckets][records...]
+// each bucket holds the offset of the first record of its chain (0 is the end of a chain)
+// records are
+// [next][hash][nName][nData][capData][name][data]
+// data is stored exactly like the contents of an account file
+//
+// a record is never changed once it's reachable, a new one is written after
+// the end and synced before the pointer to the old one is switched over, so
+// a crash leaves either record in the chain; the old record is zeroed once
+// the switch is synced as well, only then nothing points to it anymore
+#define VAULT_MAGIC "PWVAULT\0"
+#define VAULT_VERSION 1
+#define VAULT_MIN_BUCKETS 64
+#define VAULT_MAX_NAME 255
+
+struct vault_header {
+	char magic[8];
+	U32 version;
+	U32 nBuckets;
+	U64 buckets;
+	U64 end;
+	U64 nAccounts;
+	U64 garbage;
+};
+
+struct vault_record {
+	U64 next;
+	U32 hash;
+	U32 nName;
+	U32 nData;
+	U32 capData;
+};
+
+int fdVault = ERR;
+static char *vaultPath;
+static struct vault_header header;
+
+static int
+preadall(int fd, void *buf, size_t n, U64 off)
+{
+	ssize_t r;
+
+	while(n)
+	{
+		r = pread(fd, buf, n, off);
+		if(r <= 0)
+		{
+			if(!r)
+				errno = EIO;
+			else if(errno == EINTR)
+				continue;
+			return ERR;
+		}
+		buf = (char*) buf + r;
+		n -= r;
+		off += r;
+	}
+	return OK;
+}
+
+static int
+pwriteall(int fd, const void *buf, size_t n, U64 off)
+{
+	ssize_t r;
+
+	while(n)
+	{
+		r = pwrite(fd, buf, n, off);
+		if(r < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return ERR;
+		}
+		buf = (const char*) buf + r;
+		n -= r;
+		off += r;
+	}
+	return OK;
+}
+
+static int
+writeheader(int fd, const struct vault_header *hdr)
+{
+	return pwriteall(fd, hdr, sizeof(*hdr), 0);
+}
+
+// overwrites a record that was unlinked with zeroes
+static int
+wipe(int fd, U64 off, U64 n)
+{
+	static const char zeroes[4096];
+
+	while(n)
+	{
+		const size_t nZero = MIN(n, sizeof(zeroes));
+
+		if(pwriteall(fd, zeroes, nZero, off))
+			return ERR;
+		off += nZero;
+		n -= nZero;
+	}
+	return OK;
+}
+
+// finds the record of an account;
+// link receives the offset of the pointer that points to the record
+static int
+locate(const char *name, U32 nName, U32 hash, U64 *link, U64 *off, struct vault_record *rec)
+{
+	char recName[VAULT_MAX_NAME];
+
+	// no record has a longer name and it wouldn't fit recName
+	if(nName > VAULT_MAX_NAME)
+	{
+		errno = ENAMETOOLONG;
+		return ERR;
+	}
+	*link = header.buckets + sizeof(U64) * (hash & (header.nBuckets - 1));
+	if(preadall(fdVault, off, sizeof(*off), *link))
+		return ERR;
+	while(*off)
+	{
+		if(preadall(fdVault, rec, sizeof(*rec), *off))
+			return ERR;
+		if(rec->hash == hash && rec->nName == nName)
+		{
+			if(preadall(fdVault, recName, nName, *off + sizeof(*rec)))
+				return ERR;
+			if(!memcmp(recName, name, nName))
+				return OK;
+		}
+		*link = *off + offsetof(struct vault_record, next);
+		*off = rec->next;
+	}
+	errno = ENOENT;
+	return ERR;
+}
+
+// appends a record to the end of a vault and links it into its chain
+static int
+append(int fd, struct vault_header *hdr, U64 *buckets,
+		const char *name, U32 nName, const char *data, U32 nData)
+{
+	struct vault_record rec;
+	U64 off;
+	U64 link;
+
+	rec.hash = hashname(name, nName);
+	rec.nName = nName;
+	rec.nData = nData;
+	rec.capData = nData;
+	link = hdr->buckets + sizeof(U64) * (rec.hash & (hdr->nBuckets - 1));
+	if(buckets)
+		rec.next = buckets[rec.hash & (hdr->nBuckets - 1)];
+	else if(preadall(fd, &rec.next, sizeof(rec.next), link))
+		return ERR;
+	off = hdr->end;
+	if(pwriteall(fd, &rec, sizeof(rec), off) ||
+			pwriteall(fd, name, nName, off + sizeof(rec)) ||
+			pwriteall(fd, data, nData, off + sizeof(rec) + nName))
+		return ERR;
+	hdr->end = off + sizeof(rec) + nName + rec.capData;
+	hdr->nAccounts++;
+	if(buckets)
+	{
+		buckets[rec.hash & (hdr->nBuckets - 1)] = off;
+		return OK;
+	}
+	// the record is complete before it becomes reachable
+	if(fdatasync(fd))
+		return ERR;
+	return pwriteall(fd, &off, sizeof(off), link);
+}
+
+static int
+create(const char *path, U32 nBuckets, struct vault_header *hdr)
+{
+	int fd;
+
+	fd = open(path, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+	if(fd == ERR)
+		return ERR;
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, VAULT_MAGIC, sizeof(hdr->magic));
+	hdr->version = VAULT_VERSION;
+	hdr->nBuckets = nBuckets;
+	hdr->buckets = sizeof(*hdr);
+	hdr->end = hdr->buckets + sizeof(U64) * nBuckets;
+	// the bucket array reads as zeroes
+	if(ftruncate(fd, hdr->end) || writeheader(fd, hdr))
+	{
+		close(fd);
+		remove(path);
+		return ERR;
+	}
+	return fd;
+}
+
+static int
+finish(int fd, const char *tmpPath, struct vault_header *hdr, const U64 *buckets)
+{
+	if(pwriteall(fd, buckets, sizeof(*buckets) * hdr->nBuckets, hdr->buckets) ||
+			writeheader(fd, hdr) || fsync(fd) ||
+			rename(tmpPath, vaultPath))
+		return ERR;
+	if(fdVault != ERR)
+		close(fdVault);
+	fdVault = fd;
+	header = *hdr;
+	return OK;
+}
+
+// writes all live records into a fresh vault with the given amount of buckets
+// and atomically replaces the current one, this drops all garbage
+static int
+rebuild(U32 nBuckets)
+{
+	char tmpPath[strlen(vaultPath) + 5];
+	int fd;
+	struct vault_header hdr;
+	U64 *oldBuckets = NULL, *buckets = NULL;
+	char *buf = NULL;
+	U32 capBuf = 0;
+
+	strcpy(tmpPath, vaultPath);
+	strcat(tmpPath, ".tmp");
+	fd = create(tmpPath, nBuckets, &hdr);
+	if(fd == ERR)
+		return ERR;
+	oldBuckets = malloc(sizeof(*oldBuckets) * header.nBuckets);
+	buckets = calloc(nBuckets, sizeof(*buckets));
+	if(!oldBuckets || !buckets ||
+			preadall(fdVault, oldBuckets, sizeof(*oldBuckets) * header.nBuckets, header.buckets))
+		goto err;
+	for(U32 b = 0; b < header.nBuckets; b++)
+	{
+		struct vault_record rec;
+
+		for(U64 off = oldBuckets[b]; off; off = rec.next)
+		{
+			if(preadall(fdVault, &rec, sizeof(rec), off))
+				goto err;
+			if(rec.nName + rec.nData > capBuf)
+			{
+				capBuf = rec.nName + rec.nData;
+				free(buf);
+				buf = malloc(capBuf);
+				if(!buf)
+					goto err;
+			}
+			if(preadall(fdVault, buf, rec.nName + rec.nData, off + sizeof(rec)) ||
+					append(fd, &hdr, buckets, buf, rec.nName, buf + rec.nName, rec.nData))
+				goto err;
+		}
+	}
+	if(finish(fd, tmpPath, &hdr, buckets))
+		goto err;
+	free(buf);
+	free(buckets);
+	free(oldBuckets);
+	return OK;
+err:
+	free(buf);
+	free(buckets);
+	free(oldBuckets);
+	close(fd);
+	remove(tmpPath);
+	return ERR;
+}
+
+// grows the bucket array when chains get long and drops garbage when more than
+// half of the file is unreachable
+static int
+maintain(void)
+{
+	if(header.nAccounts > header.nBuckets)
+		return rebuild(header.nBuckets * 2);
+	if(header.garbage > 0x10000 && header.garbage > header.end / 2)
+		return rebuild(header.nBuckets);
+	return OK;
+}
+
+static int
+openvault(const char *path, struct vault_header *hdr)
+{
+	int fd;
+	struct stat st;
+
+	fd = open(path, O_RDWR);
+	if(fd == ERR)
+		return ERR;
+	if(preadall(fd, hdr, sizeof(*hdr), 0) || fstat(fd, &st))
+	{
+		close(fd);
+		return ERR;
+	}
+	if(memcmp(hdr->magic, VAULT_MAGIC, sizeof(hdr->magic)) ||
+			hdr->version != VAULT_VERSION ||
+			!hdr->nBuckets || (hdr->nBuckets & (hdr->nBuckets - 1)))
+	{
+		close(fd);
+		errno = EINVAL;
+		return ERR;
+	}
+	// a crash may have kept a record that is already linked but not the
+	// header that covers it, nothing is ever written after the end of the file
+	hdr->end = MAX(hdr->end, (U64) st.st_size);
+	return fd;
+}
+
+int
+vault_open(const char *path)
+{
+	int fd;
+	struct vault_header hdr;
+
+	fd = openvault(path, &hdr);
+	if(fd == ERR)
+		return ERR;
+	free(vaultPath);
+	vaultPath = strdup(path);
+	fdVault = fd;
+	header = hdr;
+	return OK;
+}
+
+int
+vault_reload(void)
+{
+	int fd;
+	struct vault_header hdr;
+
+	if(fdVault == ERR)
+		return OK;
+	// the file may have been replaced as well, so it's opened by its path
+	fd = openvault(vaultPath, &hdr);
+	if(fd == ERR)
+		return ERR;
+	close(fdVault);
+	fdVault = fd;
+	header = hdr;
+	return OK;
+}
+
+void
+vault_close(void)
+{
+	if(fdVault == ERR)
+		return;
+	close(fdVault);
+	fdVault = ERR;
+	free(vaultPath);
+	vaultPath = NULL;
+}
+
+int
+vault_compact(void)
+{
+	if(fdVault == ERR)
+		return OK;
+	return rebuild(header.nBuckets);
+}
+
+int
+vault_get(const char *name, U32 nName, char **data, U32 *nData)
+{
+	U64 link, off;
+	struct vault_record rec;
+	char *buf;
+
+	if(locate(name, nName, hashname(name, nName), &link, &off, &rec))
+		return ERR;
+	buf = malloc(rec.nData + 1);
+	if(!buf)
+		return ERR;
+	if(preadall(fdVault, buf, rec.nData, off + sizeof(rec) + nName))
+	{
+		free(buf);
+		return ERR;
+	}
+	buf[rec.nData] = 0;
+	*data = buf;
+	*nData = rec.nData;
+	return OK;
+}
+
+// gives the file offset and size of the data of an account so it can be mapped
+int
+vault_find(const char *name, U32 nName, U64 *data, U32 *nData)
+{
+	U64 link, off;
+	struct vault_record rec;
+
+	if(locate(name, nName, hashname(name, nName), &link, &off, &rec))
+		return ERR;
+	*data = off + sizeof(rec) + nName;
+	*nData = rec.nData;
+	return OK;
+}
+
+int
+vault_put(const char *name, U32 nName, const char *data, U32 nData)
+{
+	U64 link, off;
+	struct vault_record rec;
+	const U64 newOff = header.end;
+	U32 oldCap;
+
+	if(locate(name, nName, hashname(name, nName), &link, &off, &rec))
+		return ERR;
+	// the new record takes the place of the old one inside the chain
+	oldCap = rec.capData;
+	rec.nData = nData;
+	rec.capData = nData;
+	if(pwriteall(fdVault, &rec, sizeof(rec), newOff) ||
+			pwriteall(fdVault, name, nName, newOff + sizeof(rec)) ||
+			pwriteall(fdVault, data, nData, newOff + sizeof(rec) + nName) ||
+			fdatasync(fdVault) ||
+			pwriteall(fdVault, &newOff, sizeof(newOff), link))
+		return ERR;
+	header.end = newOff + sizeof(rec) + nName + rec.capData;
+	header.garbage += sizeof(rec) + nName + oldCap;
+	if(writeheader(fdVault, &header) || fdatasync(fdVault) ||
+			wipe(fdVault, off, sizeof(rec) + nName + oldCap))
+		return ERR;
+	return maintain();
+}
+
+int
+vault_insert(const char *name, U32 nName, const char *data, U32 nData)
+{
+	U64 link, off;
+	struct vault_record rec;
+
+	if(!locate(name, nName, hashname(name, nName), &link, &off, &rec))
+	{
+		errno = EEXIST;
+		return ERR;
+	}
+	if(errno != ENOENT)
+		return ERR;
+	if(append(fdVault, &header, NULL, name, nName, data, nData) ||
+			writeheader(fdVault, &header))
+		return ERR;
+	return maintain();
+}
+
+int
+vault_remove(const char *name, U32 nName)
+{
+	U64 link, off;
+	struct vault_record rec;
+
+	if(locate(name, nName, hashname(name, nName), &link, &off, &rec))
+		return ERR;
+	if(pwriteall(fdVault, &rec.next, sizeof(rec.next), link))
+		return ERR;
+	header.nAccounts--;
+	header.garbage += sizeof(rec) + nName + rec.capData;
+	if(writeheader(fdVault, &header) || fdatasync(fdVault) ||
+			wipe(fdVault, off, sizeof(rec) + nName + rec.capData))
+		return ERR;
+	return maintain();
+}
+
+int
+vault_foreach(int (*proc)(const char *name, U32 nName, void *arg), void *arg)
+{
+	U64 *buckets;
+	char name[VAULT_MAX_NAME];
+
+	buckets = malloc(sizeof(*buckets) * header.nBuckets);
+	if(!buckets)
+		return ERR;
+	if(preadall(fdVault, buckets, sizeof(*buckets) * header.nBuckets, header.buckets))
+		goto err;
+	for(U32 b = 0; b < header.nBuckets; b++)
+	{
+		struct vault_record rec;
+
+		for(U64 off = buckets[b]; off; off = rec.next)
+		{
+			if(preadall(fdVault, &rec, sizeof(rec), off) ||
+					rec.nName > VAULT_MAX_NAME ||
+					preadall(fdVault, name, rec.nName, off + sizeof(rec)))
+				goto err;
+			if(proc(name, rec.nName, arg))
+			{
+				free(buckets);
+				return OK;
+			}
+		}
+	}
+	free(buckets);
+	return OK;
+err:
+	free(buckets);
+	return ERR;
+}
+
+// moves all account files of a directory into a new vault at the given path,
+// the account files are only removed after the vault was fully written
+int
+vault_convert(const char *dirPath, const char *path)
+{
+	char tmpPath[strlen(path) + 5];
+	DIR *dir;
+	struct dirent *dirent;
+	int fd;
+	struct vault_header hdr;
+	U64 *buckets = NULL;
+	U32 nBuckets = VAULT_MIN_BUCKETS;
+	U64 nFiles = 0;
+	char *buf = NULL;
+	size_t capBuf = 0;
+
+	if(!access(path, F_OK))
+	{
+		errno = EEXIST;
+		return ERR;
+	}
+	dir = opendir(dirPath);
+	if(!dir)
+		return ERR;
+	while((dirent = readdir(dir)))
+		if(dirent->d_type == DT_REG && !strchr(dirent->d_name, '.'))
+			nFiles++;
+	while(nBuckets < nFiles)
+		nBuckets *= 2;
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+	fd = create(tmpPath, nBuckets, &hdr);
+	if(fd == ERR)
+		goto err;
+	buckets = calloc(nBuckets, sizeof(*buckets));
+	if(!buckets)
+		goto err;
+	rewinddir(dir);
+	while((dirent = readdir(dir)))
+	{
+		int fdAcc;
+		struct stat st;
+		size_t nData = 0;
+		ssize_t nRead;
+
+		if(dirent->d_type != DT_REG || strchr(dirent->d_name, '.'))
+			continue;
+		fdAcc = openat(dirfd(dir), dirent->d_name, O_RDONLY);
+		if(fdAcc == ERR)
+			goto err;
+		if(fstat(fdAcc, &st) || st.st_size > UINT32_MAX)
+		{
+			close(fdAcc);
+			goto err;
+		}
+		if((size_t) st.st_size > capBuf)
+		{
+			capBuf = st.st_size;
+			free(buf);
+			buf = malloc(capBuf);
+			if(!buf)
+			{
+				close(fdAcc);
+				goto err;
+			}
+		}
+		while(nData < (size_t) st.st_size &&
+				(nRead = read(fdAcc, buf + nData, st.st_size - nData)) > 0)
+			nData += nRead;
+		close(fdAcc);
+		if(nData != (size_t) st.st_size ||
+				append(fd, &hdr, buckets, dirent->d_name, strlen(dirent->d_name), buf, nData))
+			goto err;
+	}
+	free(vaultPath);
+	vaultPath = strdup(path);
+	if(finish(fd, tmpPath, &hdr, buckets))
+		goto err;
+	fd = ERR;
+	rewinddir(dir);
+	while((dirent = readdir(dir)))
+		if(dirent->d_type == DT_REG && !strchr(dirent->d_name, '.'))
+			unlinkat(dirfd(dir), dirent->d_name, 0);
+	closedir(dir);
+	free(buckets);
+	free(buf);
+	return OK;
+err:
+	if(fd != ERR)
+	{
+		close(fd);
+		remove(tmpPath);
+	}
+	if(fdVault == ERR)
+	{
+		free(vaultPath);
+		vaultPath = NULL;
+	}
+	closedir(dir);
+	free(buckets);
+	free(buf);
+	return ERR;
+}
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <errno.h>
+#include <pthread.h>
+#include "pwmgr.h"
+
+// the directory of the accounts is watched with inotify so the caches (the
+// names index, the property indexes and the search) follow changes of other
+// processes; only the account that changed is updated
+//
+// this process sees the events of its own writes as well, so every write
+// notes how the file looks afterwards and an event is only applied when the
+// file looks different by now; inotify queues the event during the write,
+// so once all events were read none of the notes are needed anymore
+//
+// it's not known which account of a vault changed, the vault is read again
+// and the names and the search are dropped instead
+#define VAULT_NAME ".vault"
+
+struct stamp {
+	bool exists;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+struct note {
+	U32 hash;
+	U32 nName;
+	char *name;
+	struct stamp stamp;
+};
+
+static int fdWatch = ERR;
+static int wdWatch = ERR;
+// open addressing table with a load factor below one half
+static struct note *notes;
+static U32 nNotes, capNotes;
+static pthread_mutex_t notesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+stampof(const char *name, U32 nName, struct stamp *stamp)
+{
+	char filePath[strlen(realPath) + nName + 2];
+	struct stat st;
+
+	sprintf(filePath, "%s/%.*s", realPath, (int) nName, name);
+	memset(stamp, 0, sizeof(*stamp));
+	if(stat(filePath, &st))
+		return;
+	stamp->exists = true;
+	stamp->ino = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->mtime = st.st_mtim;
+}
+
+static bool
+samestamp(const struct stamp *a, const struct stamp *b)
+{
+	return a->exists == b->exists && a->ino == b->ino && a->size == b->size &&
+		a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+static struct note *
+noteslot(struct note *table, U32 cap, const char *name, U32 nName, U32 hash)
+{
+	const U32 mask = cap - 1;
+
+	for(U32 i = hash & mask; ; i = (i + 1) & mask)
+		if(!table[i].name || (table[i].hash == hash && table[i].nName == nName &&
+					!memcmp(table[i].name, name, nName)))
+			return table + i;
+}
+
+// a note that can't be made only means the event is applied needlessly
+static void
+note(const char *name, U32 nName, const struct stamp *stamp)
+{
+	const U32 hash = hashname(name, nName);
+	struct note *n;
+
+	if((nNotes + 1) * 2 > capNotes)
+	{
+		const U32 cap = MAX(capNotes * 2, 64);
+		struct note *const table = calloc(cap, sizeof(*table));
+
+		if(!table)
+			return;
+		for(U32 i = 0; i < capNotes; i++)
+			if(notes[i].name)
+				*noteslot(table, cap, notes[i].name, notes[i].nName, notes[i].hash) = notes[i];
+		free(notes);
+		notes = table;
+		capNotes = cap;
+	}
+	n = noteslot(notes, capNotes, name, nName, hash);
+	if(!n->name)
+	{
+		n->name = malloc(MAX(nName, 1));
+		if(!n->name)
+			return;
+		memcpy(n->name, name, nName);
+		n->hash = hash;
+		n->nName = nName;
+		nNotes++;
+	}
+	n->stamp = *stamp;
+}
+
+static void
+clearnotes(void)
+{
+	for(U32 i = 0; i < capNotes; i++)
+	{
+		free(notes[i].name);
+		notes[i].name = NULL;
+	}
+	nNotes = 0;
+}
+
+// whether the file changed since it was last noted, the current look is noted
+static bool
+changedsince(const char *name, U32 nName)
+{
+	struct stamp stamp;
+	const struct note *n;
+	bool changed;
+
+	stampof(name, nName, &stamp);
+	pthread_mutex_lock(&notesLock);
+	n = capNotes ? noteslot(notes, capNotes, name, nName, hashname(name, nName)) : NULL;
+	changed = !n || !n->name || !samestamp(&n->stamp, &stamp);
+	if(changed)
+		note(name, nName, &stamp);
+	pthread_mutex_unlock(&notesLock);
+	return changed;
+}
+
+static void
+accountchanged(const char *name, U32 nName)
+{
+	struct account acc;
+
+	property_invalidate(name, nName);
+	search_accountremoved(name, nName);
+	if(account_open(name, nName, &acc))
+	{
+		if(errno == ENOENT)
+			names_removed(name, nName);
+		else
+			names_added(name, nName);
+		return;
+	}
+	names_added(name, nName);
+	search_accountadded(name, nName, acc.data, acc.nData);
+	account_close(&acc);
+}
+
+// everything may have changed
+static void
+changedall(void)
+{
+	vault_reload();
+	names_invalidate();
+	search_invalidate();
+}
+
+int
+watch_open(const char *dirPath)
+{
+	// writes to the vault don't close it, account files are always closed
+	const U32 mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE |
+		(fdVault != ERR ? IN_MODIFY : 0);
+
+	if(fdWatch == ERR)
+	{
+		fdWatch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if(fdWatch == ERR)
+			return ERR;
+	}
+	// watching the same directory again only replaces the mask
+	wdWatch = inotify_add_watch(fdWatch, dirPath, mask);
+	if(wdWatch == ERR)
+	{
+		watch_close();
+		return ERR;
+	}
+	return OK;
+}
+
+void
+watch_close(void)
+{
+	if(fdWatch != ERR)
+		close(fdWatch);
+	fdWatch = ERR;
+	wdWatch = ERR;
+	clearnotes();
+	free(notes);
+	notes = NULL;
+	capNotes = 0;
+}
+
+void
+watch_update(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+
+	if(fdWatch == ERR)
+		return;
+	while((n = read(fdWatch, buf, sizeof(buf))) > 0)
+		for(char *ptr = buf; ptr < buf + n; )
+		{
+			const struct inotify_event *const ev = (const struct inotify_event*) ptr;
+			const U32 nName = ev->len ? strlen(ev->name) : 0;
+
+			ptr += sizeof(*ev) + ev->len;
+			if(ev->mask & IN_Q_OVERFLOW)
+			{
+				changedall();
+				continue;
+			}
+			if(ev->wd != wdWatch || !nName)
+				continue;
+			// in a vault only the vault file matters, otherwise only the
+			// account files which are the ones without a dot
+			if(fdVault != ERR ? strcmp(ev->name, VAULT_NAME) : !!strchr(ev->name, '.'))
+				continue;
+			if(!changedsince(ev->name, nName))
+				continue;
+			if(fdVault != ERR)
+				changedall();
+			else
+				accountchanged(ev->name, nName);
+		}
+	// all events of the writes so far are read
+	if(n < 0 && errno == EAGAIN)
+	{
+		pthread_mutex_lock(&notesLock);
+		clearnotes();
+		pthread_mutex_unlock(&notesLock);
+	}
+}
+
+void
+watch_wrote(const char *name, U32 nName)
+{
+	struct stamp stamp;
+
+	if(fdWatch == ERR)
+		return;
+	if(fdVault != ERR)
+	{
+		name = VAULT_NAME;
+		nName = sizeof(VAULT_NAME) - 1;
+	}
+	stampof(name, nName, &stamp);
+	pthread_mutex_lock(&notesLock);
+	note(name, nName, &stamp);
+	pthread_mutex_unlock(&notesLock);
+}
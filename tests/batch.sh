@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Running without curses: -c commands, -f scripts, commands on stdin and the
+# usage errors
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+out=$(run -c 'add account a' -c 'add property user account a value "alice"' -c 'info account a')
+expect "$out" "user = alice" "-c commands run in order"
+
+# blank lines are skipped and a failing command doesn't stop the script
+printf 'add account b\n\n   \nbogus\nadd property user account b value "bob"\ninfo account b' >"$HOME/script"
+out=$(run -f "$HOME/script")
+expect "$out" "Branch 'bogus' doesn't exist" "a bad line of a script is reported"
+expect "$out" "user = bob" "the script goes on after a bad line and runs its last line without a newline"
+
+out=$(printf 'info account a\ninfo account b\n' | run -f -)
+expect "$out" "user = alice" "-f - reads the script from stdin"
+expect "$out" "user = bob" "every line of the script on stdin is run"
+
+out=$(printf 'info account a\nquit\ninfo account b\n' | run)
+expect "$out" "user = alice" "without options the commands are read from stdin"
+reject "$out" "user = bob" "quit ends the commands read from stdin"
+
+# with a script file the passphrases still come from stdin
+printf 'vault encrypt\ninfo account a\n' >"$HOME/script"
+out=$(printf 'correct\ncorrect\n' | run -f "$HOME/script")
+expect "$out" "Encrypted 2 accounts" "a script reads the passphrases from stdin"
+expect "$out" "user = alice" "the script goes on after the passphrase"
+out=$(printf 'correct\n' | run -c 'info account b')
+expect "$out" "user = bob" "the startup passphrase is read before the -c commands"
+
+out=$(run -f "$HOME/missing")
+status=$?
+expect "$out" "could not open '.*/missing'" "a missing script is reported"
+[ $status = 1 ] && pass || fail "a missing script exits with 1" "exit status $status"
+out=$(run -c 'info account a' -f "$HOME/script")
+status=$?
+expect "$out" "^usage:" "-c and -f can't be combined"
+[ $status = 2 ] && pass || fail "a usage error exits with 2" "exit status $status"
+out=$(run -x)
+expect "$out" "^usage:" "an unknown option prints the usage"
+out=$(run extra)
+expect "$out" "^usage:" "an argument that isn't an option prints the usage"
+
+finish
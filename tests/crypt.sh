@@ -0,0 +1,87 @@
+#!/bin/sh
+#
+# Encryption of the accounts: nothing is stored in plaintext, the right
+# passphrase decrypts and a wrong one or changed data is refused
+#
+
+. "$(dirname "$0")/lib.sh"
+
+# plain STRING DESCRIPTION, no file of the accounts holds the string
+plain()
+{
+	if grep -r -q -a -F -e "$1" "$DIR"
+	then
+		fail "$2" "$(grep -r -l -a -F -e "$1" "$DIR")"
+	else
+		pass
+	fi
+}
+
+for mode in files vault
+do
+	fresh
+	[ $mode = vault ] && run -c 'vault migrate' >/dev/null
+	# the removed value and the undone entry are in the backup before encrypting
+	run -c 'add account mail' -c 'add property pass account mail value "HUNTER2"' \
+		-c 'add property pin account mail value "PIN4711"' -c 'remove property pin account mail' \
+		-c 'backup undo' -c 'add property note account mail value "NOTEWORD"' -c 'search "noteword"' >/dev/null
+	out=$(printf 'correct\ncorrect\n' | run -c 'vault encrypt')
+	expect "$out" "Encrypted 1 accounts" "$mode: the accounts are encrypted"
+	plain HUNTER2 "$mode: no value is left in plaintext"
+	plain PIN4711 "$mode: no removed value is left in plaintext"
+	plain noteword "$mode: no value is left in the search index"
+
+	out=$(printf 'correct\n' | run -c 'info account mail' -c 'add property url account mail value "NEWURL"' \
+		-c 'info backup')
+	expect "$out" "pass = HUNTER2" "$mode: the right passphrase decrypts"
+	expect "$out" "Added property 'url' to account 'mail' with value 'NEWURL'" \
+		"$mode: the sealed backup entries are read back"
+	plain NEWURL "$mode: new values are encrypted"
+	out=$(printf 'correct\n' | run -c 'search "note"' -c 'search "newurl"')
+	expect "$out" "mail note" "$mode: property names are still searched"
+	reject "$out" "mail url" "$mode: values aren't searched"
+	plain newurl "$mode: the search index isn't written"
+	out=$(printf 'correct\n' | run -c 'remove property pin account mail' -c 'backup undo' -c 'backup undo' \
+		-c 'info account mail')
+	expect "$out" "Undone: Removed property 'pin'" "$mode: a sealed removal is undone"
+	expect "$out" "pin = PIN4711" "$mode: a sealed removal brings back its value"
+	expect "$out" "Undone: Added property 'url'" "$mode: a sealed addition is undone"
+	reject "$out" "url = NEWURL" "$mode: the undone addition is gone"
+
+	out=$(printf 'wrong\n' | run -c 'info account mail')
+	expect "$out" "no valid passphrase was given" "$mode: a wrong passphrase is refused"
+	reject "$out" "HUNTER2" "$mode: nothing is shown with a wrong passphrase"
+done
+
+# the data of an account can't be changed unnoticed
+fresh
+run -c 'add account a' -c 'add property p account a value "value"' >/dev/null
+printf 'correct\ncorrect\n' | run -c 'vault encrypt' >/dev/null
+printf 'X' | dd of="$DIR/a" bs=1 seek=20 conv=notrunc 2>/dev/null
+out=$(printf 'correct\n' | run -c 'info account a' -c 'check all')
+expect "$out" "Couldn't open account 'a' ('Bad message')" "changed data is refused"
+expect "$out" "Account 'a' can't be decrypted, its data was changed" "check notices changed data"
+
+# a key rotation re-encrypts the accounts and the backup for the new passphrase
+for mode in files vault
+do
+	fresh
+	[ $mode = vault ] && run -c 'vault migrate' >/dev/null
+	run -c 'add account a' -c 'add property p account a value "rotated"' -c 'add account b' >/dev/null
+	printf 'old\nold\n' | run -c 'vault encrypt' >/dev/null
+	out=$(printf 'old\nnew\nnew\n' | run -c 'vault rekey')
+	expect "$out" "Re-encrypted 2 accounts with the new passphrase" "$mode: the key is rotated"
+	out=$(printf 'old\n' | run -c 'info account a')
+	expect "$out" "no valid passphrase was given" "$mode: the old passphrase is refused after a rotation"
+	out=$(printf 'new\n' | run -c 'info account a' -c 'add property q account a value "after"' \
+		-c 'info backup' -c 'check all')
+	expect "$out" "p = rotated" "$mode: the new passphrase decrypts"
+	expect "$out" "Snapshot of account 'a'" "$mode: the backup is readable with the new key"
+	expect "$out" "everything is fine" "$mode: everything checks fine after a rotation"
+	out=$(printf 'new\nnew\nnew\n' | run -c 'vault rekey')
+	expect "$out" "Re-encrypted 2 accounts" "$mode: the key can be rotated again"
+	out=$(printf 'new\n' | run -c 'backup undo' -c 'info account a')
+	expect "$out" "Undone: Added property 'q'" "$mode: entries of the old key can be undone after a rotation"
+done
+
+finish
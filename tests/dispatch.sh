@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Dispatching through the command tree: every command and subcommand the
+# tree lists is found and unknown ones are reported with the options
+#
+
+. "$(dirname "$0")/lib.sh"
+
+# options OUTPUT, the names listed after "Possible options are:"
+options()
+{
+	printf '%s\n' "$1" | sed -n '/^Possible options are:$/,$p' | sed -n 's/^	\([a-z]*\).*/\1/p'
+}
+
+fresh
+out=$(run -c 'help zzz')
+expect "$out" "Branch 'zzz' doesn't exist" "an unknown command is reported"
+top=$(options "$out")
+[ "$(printf '%s\n' "$top" | wc -l)" -ge 15 ] && pass || fail "the commands are listed" "$out"
+for t in $top
+do
+	out=$(run -c "help $t")
+	reject "$out" "doesn't exist" "'$t' is found"
+	out=$(run -c "help $t zzz")
+	for s in $(options "$out")
+	do
+		out=$(run -c "help $t $s")
+		reject "$out" "doesn't" "'$t $s' is found"
+	done
+done
+
+out=$(run -c 'help vault rekey')
+expect "$out" "^re-encrypts all accounts" "a subcommand gives its own help"
+out=$(run -c 'info zzz')
+expect "$out" "Branch 'info' doesn't have the option 'zzz'" "an unknown subcommand is reported"
+expect "$out" "^	account name	" "the subcommands are listed with their arguments"
+out=$(run -c 'infox account a')
+expect "$out" "Branch 'infox' doesn't exist" "a longer name than a command isn't that command"
+out=$(run -c 'inf account a')
+expect "$out" "Branch 'inf' doesn't exist" "a prefix of a command isn't that command"
+
+finish
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# CSV quoting and JSON escaping, both round tripped through export and import
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+first=$HOME
+printf 'account,name,value\nacc,comma,"a,b"\nacc,quote,"say ""hi"""\nacc,newline,"one\ntwo"\n'\
+'acc,backslash,C:\\dir\\file\nacc,control,x\001\ty\nacc,plain,simple\n' >"$HOME/in.csv"
+out=$(run -c "import \"$HOME/in.csv\"" -c "export csv \"$HOME/out.csv\"" -c "export json \"$HOME/out.json\"")
+expect "$out" "Imported 6 properties into 1 new accounts" "the tricky values are imported"
+csv=$(cat "$HOME/out.csv")
+expect "$csv" '^acc,comma,"a,b"$' "a comma is quoted"
+expect "$csv" '^acc,quote,"say ""hi"""$' "quotes are doubled"
+expect "$csv" '^acc,newline,"one$' "a line break is quoted"
+expect "$csv" '^acc,backslash,C:\\dir\\file$' "a backslash is written as it is"
+expect "$csv" '^acc,plain,simple$' "a plain value is not quoted"
+json=$(cat "$HOME/out.json")
+expect "$json" '"quote":"say \\"hi\\""' "quotes are escaped"
+expect "$json" '"newline":"one\\ntwo"' "a line break is escaped"
+expect "$json" '"backslash":"C:\\\\dir\\\\file"' "a backslash is escaped"
+expect "$json" '"control":"x\\u0001\\ty"' "control characters are escaped"
+
+# the files written by export read back the same
+fresh
+out=$(run -c "import \"$first/out.json\"" -c "export csv \"$HOME/out.csv\"")
+expect "$out" "Imported 6 properties into 1 new accounts" "the exported JSON is imported"
+if cmp -s "$first/out.csv" "$HOME/out.csv"
+then
+	pass
+else
+	fail "JSON round trips through import and export" "$(diff "$first/out.csv" "$HOME/out.csv")"
+fi
+fresh
+out=$(run -c "import \"$first/out.csv\"" -c "export json \"$HOME/out.json\"")
+expect "$out" "Imported 6 properties into 1 new accounts" "the exported CSV is imported"
+if cmp -s "$first/out.json" "$HOME/out.json"
+then
+	pass
+else
+	fail "CSV round trips through import and export" "$(diff "$first/out.json" "$HOME/out.json")"
+fi
+
+# an archive holds the data as it is
+fresh
+run -c "import \"$first/in.csv\"" -c "export archive \"$HOME/out.pwa\"" >/dev/null
+archive=$HOME/out.pwa
+fresh
+out=$(run -c "import \"$archive\"" -c "export csv \"$HOME/out.csv\"")
+expect "$out" "Imported 6 properties into 1 new accounts" "the archive is imported"
+if cmp -s "$first/out.csv" "$HOME/out.csv"
+then
+	pass
+else
+	fail "an archive round trips through import and export" "$(diff "$first/out.csv" "$HOME/out.csv")"
+fi
+
+finish
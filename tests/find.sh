@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# The sorted index of account names: fuzzy find, its ranking and the names
+# kept in sync with created, removed and outside accounts
+#
+
+. "$(dirname "$0")/lib.sh"
+
+# first OUTPUT, the first account listed in the output
+first()
+{
+	printf '%s\n' "$1" | grep '^	' | head -n 1
+}
+
+for mode in files vault
+do
+	fresh
+	[ $mode = vault ] && run -c 'vault migrate' >/dev/null
+	run -c 'add account mailbox' -c 'add account mail' -c 'add account Gmail_work' -c 'add account bank' >/dev/null
+
+	out=$(run -c 'find "mail"')
+	expect "$out" "^	mailbox$" "$mode: a name starting with the pattern is found"
+	expect "$out" "^	Gmail_work$" "$mode: a name containing the pattern is found"
+	reject "$out" "^	bank$" "$mode: a name without the pattern isn't found"
+	expect "$(first "$out")" "^	mail$" "$mode: the shortest exact match ranks first"
+	out=$(run -c 'find "MAIL"')
+	expect "$(first "$out")" "^	mail$" "$mode: the pattern is matched ignoring case"
+	out=$(run -c 'find "gwk"')
+	expect "$(first "$out")" "^	Gmail_work$" "$mode: the pattern is matched as a subsequence"
+	out=$(run -c 'find "mial"')
+	expect "$out" "No account matches 'mial'" "$mode: characters out of order don't match"
+
+	out=$(run -c 'list accounts')
+	expect "$(printf '%s\n' "$out" | grep '^	' | tr -d '\t' | tr '\n' ' ')" \
+		"^Gmail_work bank mail mailbox $" "$mode: the accounts are listed in order"
+
+	out=$(run -c 'remove account mailbox' -c 'find "mail"' -c 'add account mailer' -c 'find "mailer"')
+	reject "$out" "^	mailbox$" "$mode: a removed account isn't found"
+	expect "$out" "^	mailer$" "$mode: a created account is found right away"
+done
+
+# an account file made outside of the program is picked up by the next start
+fresh
+run -c 'add account mail' >/dev/null
+: >"$DIR/zeta"
+out=$(run -c 'find "zeta"')
+expect "$out" "^	zeta$" "an account made by another program is found"
+
+finish
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# The backup journal: entries with a wrong checksum are rejected and a torn
+# tail is noticed and cut off
+#
+
+. "$(dirname "$0")/lib.sh"
+
+# offset of the first occurrence of a string inside a file
+offsetof()
+{
+	grep -a -b -o -F -e "$2" "$1" | head -n 1 | cut -d: -f1
+}
+
+fresh
+run -c 'add account a' -c 'add property x account a value "first"' \
+	-c 'add property y account a value "second"' >/dev/null
+off=$(offsetof "$DIR/.backup" first)
+printf 'X' | dd of="$DIR/.backup" bs=1 seek="$off" conv=notrunc 2>/dev/null
+out=$(run -c 'info backup')
+expect "$out" "Corrupt backup entry at offset" "an entry with a wrong checksum is reported"
+reject "$out" "Xirst" "an entry with a wrong checksum is not shown"
+expect "$out" "Added property 'y' to account 'a' with value 'second'" \
+	"the entries after a corrupt one are still read"
+out=$(run -c 'check all')
+expect "$out" "The backup is corrupt from byte" "check finds the corrupt entry"
+out=$(run -c 'backup undo' -c 'backup undo')
+expect "$out" "Undone: Added property 'y'" "the entry after the corrupt one can be undone"
+expect "$out" "Unable to read backup entry 2" "the corrupt entry can't be undone"
+
+fresh
+run -c 'add account a' -c 'add property x account a value "first"' \
+	-c 'add property y account a value "second"' >/dev/null
+size=$(wc -c <"$DIR/.backup")
+# a write that didn't finish
+truncate -s $((size - 3)) "$DIR/.backup"
+out=$(run -c 'info backup')
+expect "$out" "there are no valid entries after it" "a torn tail is reported"
+expect "$out" "Added property 'x' to account 'a' with value 'first'" "the entries before a torn tail are read"
+out=$(run -c 'check all')
+expect "$out" "The backup is corrupt from byte" "check finds the torn tail"
+out=$(run -c 'check repair')
+expect "$out" "Cut [0-9]* bytes off the end of the backup" "repair cuts off the torn tail"
+out=$(run -c 'check all')
+expect "$out" "everything is fine" "the backup is fine after the repair"
+out=$(run -c 'add property z account a value "third"' -c 'info backup')
+expect "$out" "3 - Added property 'z'" "new entries follow the repaired backup"
+out=$(run -c 'backup undo' -c 'backup undo' -c 'info account a')
+expect "$out" "Undone: Added property 'x'" "the entries before the torn tail can be undone"
+reject "$out" "x = first" "undoing removes the property again"
+
+finish
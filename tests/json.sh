@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# NDJSON output with -j: one object per line and every string escaped,
+# including bytes that aren't valid UTF-8
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+printf 'account,name,value\nacc,quote,"say ""hi"""\nacc,newline,"one\ntwo"\nacc,backslash,C:\\dir\n'\
+'acc,control,x\001\ty\nacc,utf,caf\303\251\nacc,bad,a\377b\300\257c\355\240\200d\n' >"$HOME/in.csv"
+out=$(run -j -c "import \"$HOME/in.csv\"" -c 'info account acc' -c 'list accounts' \
+	-c 'info account nope' -c 'help')
+expect "$out" '^{"type":"log","text":"Imported 6 properties into 1 new accounts"}$' "a message is a log object"
+expect "$out" '^{"type":"error","text":"Couldn'"'"'t open account '"'"'nope'"'"' (.*)"}$' "an error is an error object"
+expect "$out" '^{"type":"account","name":"acc"}$' "an account of a list is an account object"
+expect "$out" '^{"type":"property","account":"acc","name":"utf","value":"café"}$' \
+	"a property is a property object and valid UTF-8 is written as it is"
+expect "$out" '"value":"say \\"hi\\""' "quotes are escaped"
+expect "$out" '"value":"one\\ntwo"' "a line break is escaped"
+expect "$out" '"value":"C:\\\\dir"' "a backslash is escaped"
+expect "$out" '"value":"x\\u0001\\ty"' "control characters are escaped"
+expect "$out" '"value":"a\\ufffdb\\ufffd\\ufffdc\\ufffd\\ufffd\\ufffdd"' \
+	"stray, overlong and surrogate bytes become replacement characters"
+
+# every line is one object, nothing is written outside of one
+bad=$(printf '%s\n' "$out" | grep -v '^{"type":"[a-z]*",.*}$')
+[ -z "$bad" ] && pass || fail "every line of the output is an object" "$bad"
+if printf '%s' "$out" | grep -q "$(printf '\t')"
+then
+	fail "no raw tab is written"
+else
+	pass
+fi
+if printf '%s' "$out" | LC_ALL=C grep -q "$(printf '\377')"
+then
+	fail "no invalid byte is written"
+else
+	pass
+fi
+
+finish
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Helpers of the tests, a test sources this file and ends with finish;
+# every test runs the program built by build.sh inside a fresh home
+#
+
+BIN=$(cd "$(dirname "$0")/.." && pwd)/build/out
+PASSED=0
+FAILED=0
+HOMES=
+
+# makes an empty home with its Passwords directory, DIR is that directory
+fresh()
+{
+	HOME=$(mktemp -d)
+	export HOME
+	HOMES="$HOMES $HOME"
+	DIR=$HOME/Passwords
+	mkdir "$DIR"
+}
+
+# runs the program with the given arguments, the input is passed on for passphrases
+run()
+{
+	"$BIN" "$@" 2>&1
+}
+
+pass()
+{
+	PASSED=$((PASSED + 1))
+}
+
+fail()
+{
+	FAILED=$((FAILED + 1))
+	echo "FAIL: $1"
+	[ -n "$2" ] && printf '%s\n' "$2" | sed 's/^/    /'
+}
+
+# expect OUTPUT PATTERN DESCRIPTION, the output has a line matching the pattern
+expect()
+{
+	if printf '%s\n' "$1" | grep -q -e "$2"
+	then
+		pass
+	else
+		fail "$3" "$1"
+	fi
+}
+
+# like expect but no line may match
+reject()
+{
+	if printf '%s\n' "$1" | grep -q -e "$2"
+	then
+		fail "$3" "$1"
+	else
+		pass
+	fi
+}
+
+# contains FILE STRING, the file holds the bytes of the string
+contains()
+{
+	grep -q -a -F -e "$2" "$1"
+}
+
+finish()
+{
+	for h in $HOMES
+	do
+		rm -rf "$h"
+	done
+	echo "$(basename "$0"): $PASSED passed, $FAILED failed"
+	[ $FAILED = 0 ]
+}
+
+if [ ! -x "$BIN" ]
+then
+	echo "$BIN is missing, run build.sh first"
+	exit 1
+fi
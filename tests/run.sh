@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Runs every test against build/out, the exit status is 1 when any failed
+#
+
+cd "$(dirname "$0")" || exit 1
+status=0
+
+for t in *.sh
+do
+	case $t in
+	lib.sh|run.sh)
+		continue
+		;;
+	esac
+	sh "$t" </dev/null || status=1
+done
+
+exit $status
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# The search index: kept in sync with the accounts across processes, a torn
+# record at its end and values of secret properties that are never indexed
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+# the first search builds the index, the changes after it are appended
+out=$(run -c 'add account mail' -c 'add property user account mail value "alice smith"' \
+	-c 'add property url account mail value "https://mail.example"' -c 'search "alice"')
+expect "$out" "mail user" "a value is found"
+out=$(run -c 'add account bank' -c 'add property user account bank value "alice jones"' -c 'search "alice"')
+expect "$out" "mail user" "a property added before the change is still found"
+expect "$out" "bank user" "an added property is found"
+out=$(run -c 'search "alice smith"')
+expect "$out" "mail user" "every word of a query must be in the property"
+reject "$out" "bank user" "a property with only some words of the query isn't found"
+out=$(run -c 'remove property user account bank' -c 'search "alice"')
+reject "$out" "bank user" "a removed property isn't found"
+out=$(run -c 'search "url"')
+expect "$out" "mail url" "a property name is found"
+
+out=$(run -c 'remove account mail' -c 'search "alice"')
+reject "$out" "mail user" "the properties of a removed account aren't found"
+out=$(run -c 'backup undo' -c 'search "alice"')
+expect "$out" "mail user" "undoing the removal of an account brings back its properties"
+out=$(run -c 'backup redo' -c 'search "example"')
+reject "$out" "mail url" "redoing the removal of an account drops them again"
+run -c 'backup undo' >/dev/null
+
+# a record that was cut off by a crash is dropped, the ones before it stay
+run -c 'add property note account bank value "torn tail"' >/dev/null
+size=$(wc -c <"$DIR/.search")
+truncate -s $((size - 3)) "$DIR/.search"
+out=$(run -c 'search "alice"' -c 'search "torn"')
+expect "$out" "mail user" "the records before a torn one are kept"
+reject "$out" "bank note" "a torn record is dropped"
+out=$(run -c 'add property memo account bank value "after the tear"' -c 'search "tear"')
+expect "$out" "bank memo" "records appended after a torn one are read"
+
+# a secret word anywhere in the name keeps the value out of the index
+fresh
+run -c 'add account card' -c 'add property password account card value "TOPSECRET"' \
+	-c 'add property cardpin account card value "PIN4711"' \
+	-c 'add property api_key account card value "KEYVALUE"' \
+	-c 'add property holder account card value "jane doe"' -c 'search "jane"' >/dev/null
+out=$(run -c 'search "topsecret"' -c 'search "pin4711"' -c 'search "keyvalue"' -c 'search "jane"')
+reject "$out" "card password" "the value of a password isn't found"
+reject "$out" "card cardpin" "the value of a property with pin inside its name isn't found"
+reject "$out" "card api_key" "the value of a property with key inside its name isn't found"
+expect "$out" "card holder" "other values are found"
+if grep -q -a -i -e TOPSECRET -e PIN4711 -e KEYVALUE "$DIR/.search"
+then
+	fail "no secret value is written to the index"
+else
+	pass
+fi
+out=$(run -c 'search "cardpin"')
+expect "$out" "card cardpin" "the name of a secret property is found"
+
+finish
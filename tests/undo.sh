@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Undo and redo of the backup entries: accounts, properties and imports
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+out=$(run -c 'add account a' -c 'add property user account a value "alice"' \
+	-c 'backup undo' -c 'info account a')
+expect "$out" "Undone: Added property 'user'" "adding a property is undone"
+reject "$out" "user = alice" "the undone property is gone"
+out=$(run -c 'backup redo' -c 'info account a')
+expect "$out" "Redone: Added property 'user'" "adding a property is redone"
+expect "$out" "user = alice" "the redone property is back"
+
+out=$(run -c 'remove property user account a' -c 'backup undo' -c 'info account a')
+expect "$out" "Undone: Removed property 'user'" "removing a property is undone"
+expect "$out" "user = alice" "undoing a removal brings back the old value"
+out=$(run -c 'backup redo' -c 'info account a')
+reject "$out" "user = alice" "removing a property is redone"
+
+out=$(run -c 'add property pass account a value "secret"' -c 'remove account a' \
+	-c 'backup undo' -c 'info account a')
+expect "$out" "Undone: Removed account 'a'" "removing an account is undone"
+expect "$out" "pass = secret" "the account comes back with its properties"
+out=$(run -c 'backup redo' -c 'info account a')
+expect "$out" "Couldn't open account 'a'" "removing an account is redone"
+
+out=$(run -c 'backup undo' -c 'backup undo' -c 'backup undo' -c 'backup undo' -c 'backup undo' \
+	-c 'backup undo' -c 'backup undo' -c 'info account a')
+expect "$out" "Undone: Added account 'a'" "adding an account is undone"
+expect "$out" "There is nothing to undo" "undo stops at the first entry"
+out=$(run -c 'backup redo' -c 'info account a')
+expect "$out" "Redone: Added account 'a'" "adding an account is redone"
+
+# a new entry drops the entries that were undone
+out=$(run -c 'add account b' -c 'backup redo')
+expect "$out" "There is nothing to redo" "a new entry drops what was undone"
+
+fresh
+cat >"$HOME/in.csv" <<'CSV'
+account,name,value
+mail,user,alice
+mail,pass,hunter2
+bank,pin,1234
+CSV
+out=$(run -c "import \"$HOME/in.csv\"" -c 'backup undo' -c 'info account mail' -c 'info account bank')
+expect "$out" "Imported 3 properties into 2 new accounts" "the import works"
+expect "$out" "Undone: Imported 2 accounts" "an import is undone as one"
+expect "$out" "Couldn't open account 'mail'" "undoing an import removes the first account"
+expect "$out" "Couldn't open account 'bank'" "undoing an import removes the second account"
+out=$(run -c 'backup redo' -c 'info account mail' -c 'info account bank')
+expect "$out" "Redone: Imported 2 accounts" "an import is redone"
+expect "$out" "pass = hunter2" "redoing an import brings back the properties"
+expect "$out" "pin = 1234" "redoing an import brings back every account"
+
+finish
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Variables: creating them, expanding $name into words, strings and numbers
+# and the typed built-in variables
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+# every new variable is confirmed with a line of the input
+out=$(printf 'y\ny\ny\n' | run -c 'set acc value mail' -c 'add account $acc' \
+	-c 'set note value "hello world"' -c 'add property note account $acc value $note' \
+	-c 'set n value 42' -c 'add property num account mail value $n' -c 'info account mail')
+expect "$out" "Variable 'acc' created" "a variable is created"
+expect "$out" "inside '.*/mail'" "a variable holding a name expands to a word"
+expect "$out" "note = hello world" "a variable holding a string expands to a string"
+expect "$out" "num = 42" "a variable holding a number expands to a number"
+
+out=$(printf 'y\n' | run -c 'set acc value mail' -c 'set acc value bank' -c 'add account $acc')
+expect "$out" "inside '.*/bank'" "setting a variable again replaces its value"
+
+out=$(printf 'y\n' | run -c 'set spaced value "two words"' -c 'add account $spaced')
+reject "$out" "Created new account" "a string that isn't a name isn't used as a name"
+
+out=$(run -c 'info account $missing')
+expect "$out" "Variable 'missing' doesn't exist" "an unknown variable is reported"
+reject "$out" "Couldn't open account" "a command with an unknown variable isn't run"
+
+out=$(printf 'n\n' | run -c 'set declined value x' -c 'info account $declined')
+expect "$out" "Creation of variable cancelled" "the creation of a variable can be declined"
+expect "$out" "Variable 'declined' doesn't exist" "a declined variable isn't created"
+
+out=$(run -c 'set area value "wide"')
+expect "$out" "the value must be a number" "a built-in variable only takes numbers"
+out=$(run -c 'set area value 3')
+reject "$out" "Unable to set variable" "a built-in variable takes a number"
+
+finish
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# The single file vault: putting, growing and removing records and compacting
+#
+
+. "$(dirname "$0")/lib.sh"
+
+fresh
+run -c 'add account mail' -c 'add property user account mail value "alice"' -c 'vault migrate' >/dev/null
+if [ -f "$DIR/.vault" ] && [ ! -f "$DIR/mail" ]
+then
+	pass
+else
+	fail "migrate moves the account files into the vault" "$(ls -a "$DIR")"
+fi
+out=$(run -c 'info account mail')
+expect "$out" "user = alice" "a migrated account keeps its properties"
+
+# every property makes the record larger than it was
+out=$(run -c 'add property pass account mail value "OLDSECRET"' \
+	-c 'add property note account mail value "a note that is quite a bit longer than the others"' \
+	-c 'add property url account mail value "https://mail.example"' \
+	-c 'info account mail')
+expect "$out" "user = alice" "a grown record keeps the first property"
+expect "$out" "pass = OLDSECRET" "a grown record keeps the middle property"
+expect "$out" "url = https://mail.example" "a grown record has the new property"
+
+out=$(run -c 'remove property pass account mail' -c 'info account mail')
+reject "$out" "OLDSECRET" "a removed property is gone"
+if contains "$DIR/.vault" OLDSECRET
+then
+	fail "the records given up by put are zeroed"
+else
+	pass
+fi
+
+out=$(run -c 'add account bank' -c 'add property pin account bank value "GONEPIN"' -c 'remove account bank' -c 'info account bank')
+expect "$out" "Couldn't open account 'bank'" "a removed account can't be shown"
+if contains "$DIR/.vault" GONEPIN
+then
+	fail "the record of a removed account is zeroed"
+else
+	pass
+fi
+
+# the backup keeps the data of a removed account although its record is zeroed
+out=$(run -c 'add account m' -c 'add property pass account m value "secret"' -c 'remove account m' \
+	-c 'backup undo' -c 'info account m')
+expect "$out" "pass = secret" "undoing the removal of an account brings its properties back"
+
+# rewriting a large account over and over leaves garbage that gets compacted
+value=$(printf '%03000d' 0)
+run -c 'add account big' -c "add property blob account big value \"$value\"" >/dev/null
+i=0
+while [ $i -lt 64 ]
+do
+	echo "add property p$i account big value \"v$i\""
+	i=$((i + 1))
+done | run >/dev/null
+size=$(wc -c <"$DIR/.vault")
+if [ "$size" -lt 100000 ]
+then
+	pass
+else
+	fail "the garbage of rewritten records is compacted" "the vault has $size bytes"
+fi
+out=$(run -c 'info account big')
+expect "$out" "p63 = v63" "the last property survives the compaction"
+expect "$out" "blob = 0000" "the first property survives the compaction"
+out=$(run -c 'info account mail')
+expect "$out" "url = https://mail.example" "the other accounts survive the compaction"
+out=$(run -c 'check all')
+expect "$out" "everything is fine" "the vault checks fine afterwards"
+
+finish
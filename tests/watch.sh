@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Two processes: one keeps running with its caches while another changes
+# the accounts, the first one sees every change
+#
+
+. "$(dirname "$0")/lib.sh"
+
+# waitfor FILE PATTERN, waits up to five seconds for a line of the file to match
+waitfor()
+{
+	i=0
+	while ! grep -q -e "$2" "$1" 2>/dev/null && [ $i -lt 50 ]
+	do
+		sleep 0.1
+		i=$((i + 1))
+	done
+}
+
+for mode in files vault
+do
+	fresh
+	[ $mode = vault ] && run -c 'vault migrate' >/dev/null
+	run -c 'add account a' -c 'add property user account a value "alice"' >/dev/null
+	mkfifo "$HOME/fifo"
+	run <"$HOME/fifo" >"$HOME/out" &
+	pid=$!
+	exec 3>"$HOME/fifo"
+	# fill the property index, the names and the search index
+	echo 'info account a' >&3
+	echo 'list accounts' >&3
+	echo 'search "alice"' >&3
+	waitfor "$HOME/out" "a user"
+
+	run -c 'add property pin account a value "1234"' -c 'remove property user account a' \
+		-c 'add account b' -c 'add property user account b value "bob"' >/dev/null
+	echo 'info account a' >&3
+	echo 'add property user account a value "again"' >&3
+	echo 'list accounts' >&3
+	echo 'search "bob"' >&3
+	echo 'info account a' >&3
+	exec 3>&-
+	wait $pid
+	out=$(cat "$HOME/out")
+	expect "$out" "pin = 1234" "$mode: a property added by another process is seen"
+	expect "$out" "Written 'again' to account 'a'" \
+		"$mode: a property removed by another process can be added again"
+	expect "$out" "^	b$" "$mode: an account created by another process is listed"
+	expect "$out" "b user" "$mode: a property added by another process is searched"
+	if [ "$(printf '%s\n' "$out" | grep -c 'user = ')" = 2 ]
+	then
+		pass
+	else
+		fail "$mode: a property removed by another process is gone" "$out"
+	fi
+done
+
+finish